@@ -85,6 +85,11 @@ menuentry "MinOS (Safe Mode)" {
     multiboot /boot/kernel.bin safe_mode=1
     boot
 }
+
+menuentry "MinOS (4KB kernel pages)" {
+    multiboot /boot/kernel.bin nopse
+    boot
+}
 EOF
 
 # Create ISO image
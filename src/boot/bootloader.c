@@ -6,6 +6,49 @@
 /* Multiboot information structure pointer */
 static multiboot_info_t* multiboot_info = NULL;
 
+/* Physical range of the initial ramdisk module (empty without one) */
+static uint32_t initrd_start = 0;
+static uint32_t initrd_end = 0;
+
+/* Check whether a module command line mentions a word such as "initrd" */
+static int boot_module_named(multiboot_module_t* mod, const char* name) {
+    char* string = (char*)mod->string;
+    size_t len = strlen(name);
+    
+    if (!string) {
+        return 0;
+    }
+    
+    for (; *string; string++) {
+        if (strncmp(string, name, len) == 0) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/* Pick the initial ramdisk out of the boot modules: the one whose command
+ * line names it, or else the first */
+static void boot_find_initrd(void) {
+    multiboot_module_t* mods = (multiboot_module_t*)multiboot_info->mods_addr;
+    
+    if (multiboot_info->mods_count == 0) {
+        return;
+    }
+    
+    multiboot_module_t* initrd = &mods[0];
+    for (uint32_t i = 0; i < multiboot_info->mods_count; i++) {
+        if (boot_module_named(&mods[i], "initrd")) {
+            initrd = &mods[i];
+            break;
+        }
+    }
+    
+    initrd_start = initrd->mod_start;
+    initrd_end = initrd->mod_end;
+}
+
 /* Initialize the boot system */
 void boot_init(multiboot_info_t* mbi) {
     terminal_writestring("Initializing boot system...\n");
@@ -37,8 +80,17 @@ void boot_init(multiboot_info_t* mbi) {
     
     if (multiboot_info->flags & (1 << 3)) {
         terminal_writestring("Modules: count=");
-        // Print module count
+        terminal_writedec(multiboot_info->mods_count);
         terminal_writestring("\n");
+        
+        boot_find_initrd();
+        if (initrd_end > initrd_start) {
+            terminal_writestring("Initial ramdisk at ");
+            terminal_writehex(initrd_start);
+            terminal_writestring(", ");
+            terminal_writedec((initrd_end - initrd_start) / 1024);
+            terminal_writestring("KB\n");
+        }
     }
     
     if (multiboot_info->flags & (1 << 6)) {
@@ -90,6 +142,28 @@ mmap_entry_t* boot_get_memory_map(uint32_t* count) {
     return entries;
 }
 
+/* Get boot modules */
+multiboot_module_t* boot_get_modules(uint32_t* count) {
+    if (!multiboot_info || !(multiboot_info->flags & (1 << 3))) {
+        *count = 0;
+        return NULL;
+    }
+    
+    *count = multiboot_info->mods_count;
+    return (multiboot_module_t*)multiboot_info->mods_addr;
+}
+
+/* Get the physical range of the initial ramdisk module */
+int boot_get_initrd(uint32_t* start, uint32_t* end) {
+    if (initrd_end <= initrd_start) {
+        return -1;
+    }
+    
+    *start = initrd_start;
+    *end = initrd_end;
+    return 0;
+}
+
 /* Get command line */
 char* boot_get_cmdline(void) {
     if (!multiboot_info || !(multiboot_info->flags & (1 << 2))) {
@@ -99,6 +173,33 @@ char* boot_get_cmdline(void) {
     return (char*)multiboot_info->cmdline;
 }
 
+/* Check the command line for a whole-word option such as "nopse" */
+int boot_has_option(const char* option) {
+    char* cmdline = boot_get_cmdline();
+    size_t len = strlen(option);
+    
+    if (!cmdline) {
+        return 0;
+    }
+    
+    while (*cmdline) {
+        // Skip to the start of the next word
+        while (*cmdline == ' ') {
+            cmdline++;
+        }
+        
+        if (strncmp(cmdline, option, len) == 0 && (cmdline[len] == ' ' || cmdline[len] == '\0')) {
+            return 1;
+        }
+        
+        while (*cmdline && *cmdline != ' ') {
+            cmdline++;
+        }
+    }
+    
+    return 0;
+}
+
 /* Get boot device */
 uint32_t boot_get_boot_device(void) {
     if (!multiboot_info || !(multiboot_info->flags & (1 << 1))) {
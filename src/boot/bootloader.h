@@ -41,6 +41,20 @@ typedef struct {
     uint32_t type;
 } __attribute__((packed)) mmap_entry_t;
 
+/* Memory map entry types */
+#define MMAP_TYPE_AVAILABLE    1
+#define MMAP_TYPE_RESERVED     2
+#define MMAP_TYPE_ACPI         3
+#define MMAP_TYPE_NVS          4
+
+/* Boot module (e.g. the initial ramdisk) */
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t string;
+    uint32_t reserved;
+} multiboot_module_t;
+
 /* Initialize the boot system */
 void boot_init(multiboot_info_t* mbi);
 
@@ -50,9 +64,19 @@ void boot_get_memory_info(uint32_t* mem_lower, uint32_t* mem_upper);
 /* Get memory map */
 mmap_entry_t* boot_get_memory_map(uint32_t* count);
 
+/* Get boot modules */
+multiboot_module_t* boot_get_modules(uint32_t* count);
+
+/* Get the physical range of the initial ramdisk module; returns -1 if
+ * the bootloader loaded none */
+int boot_get_initrd(uint32_t* start, uint32_t* end);
+
 /* Get command line */
 char* boot_get_cmdline(void);
 
+/* Check the command line for a whole-word option such as "nopse" */
+int boot_has_option(const char* option);
+
 /* Get boot device */
 uint32_t boot_get_boot_device(void);
 
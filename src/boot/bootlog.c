@@ -0,0 +1,134 @@
+#include "bootlog.h"
+#include "../kernel/kernel.h"
+#include "../kernel/serial.h"
+#include "../kernel/timer.h"
+#include "../kernel/cpu.h"
+#include "../kernel/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Stages in the order they finished */
+static bootlog_stage_t stages[BOOTLOG_MAX_STAGES];
+static uint32_t stage_count = 0;
+static spinlock_t bootlog_lock = SPINLOCK_INIT;
+
+/* Where a table goes */
+typedef struct {
+    void (*writestring)(const char*);
+    void (*writedec)(uint32_t);
+} bootlog_out_t;
+
+/* Add a stage; stages may finish on several CPUs at once */
+static void bootlog_add(const char* name, int chained, uint64_t start) {
+    uint32_t flags = spin_lock_irqsave(&bootlog_lock);
+    uint64_t now = rdtsc();
+    
+    if (stage_count < BOOTLOG_MAX_STAGES) {
+        if (chained) {
+            start = stage_count ? stages[stage_count - 1].tsc : now;
+        }
+        stages[stage_count].name = name;
+        stages[stage_count].start = start;
+        stages[stage_count].tsc = now;
+        stage_count++;
+    }
+    spin_unlock_irqrestore(&bootlog_lock, flags);
+}
+
+/* Record that a boot stage has finished */
+void bootlog_mark(const char* name) {
+    bootlog_add(name, 1, 0);
+}
+
+/* Record a stage that ran alongside others */
+void bootlog_record(const char* name, uint64_t start) {
+    bootlog_add(name, 0, start);
+}
+
+/* Get the number of stages recorded */
+uint32_t bootlog_count() {
+    return stage_count;
+}
+
+/* Get a recorded stage */
+const bootlog_stage_t* bootlog_get(uint32_t index) {
+    return index < stage_count ? &stages[index] : NULL;
+}
+
+/* Convert TSC cycles to microseconds once the TSC is calibrated */
+static uint32_t bootlog_us(uint64_t cycles) {
+    uint32_t tsc_per_us = timer_tsc_per_us();
+    
+    return (uint32_t)(tsc_per_us ? cycles / tsc_per_us : cycles);
+}
+
+/* Get the time from the first mark to the last */
+uint32_t bootlog_total_us() {
+    return stage_count ? bootlog_us(stages[stage_count - 1].tsc - stages[0].tsc) : 0;
+}
+
+/* Write a number right-aligned in a column */
+static void bootlog_column(const bootlog_out_t* out, uint32_t value, uint32_t width) {
+    uint32_t digits = 1;
+    
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    while (digits++ < width) {
+        out->writestring(" ");
+    }
+    out->writedec(value);
+}
+
+/* Print each stage's own time and the time since kernel entry; stages
+ * that ran in parallel overlap */
+static void bootlog_table(const bootlog_out_t* out) {
+    if (!stage_count) {
+        return;
+    }
+    
+    out->writestring(timer_tsc_per_us() ? "Boot stages (us):\n" : "Boot stages (TSC cycles):\n");
+    out->writestring("        STAGE       SINCE ENTRY  NAME\n");
+    
+    // The TSC starts at reset, so the first mark's value is the time spent
+    // in firmware and the boot loader
+    out->writestring("  ");
+    bootlog_column(out, bootlog_us(stages[0].tsc), 11);
+    out->writestring("  ");
+    bootlog_column(out, 0, 16);
+    out->writestring("  firmware and loader\n");
+    
+    for (uint32_t i = 1; i < stage_count; i++) {
+        out->writestring("  ");
+        bootlog_column(out, bootlog_us(stages[i].tsc - stages[i].start), 11);
+        out->writestring("  ");
+        bootlog_column(out, bootlog_us(stages[i].tsc - stages[0].tsc), 16);
+        out->writestring("  ");
+        out->writestring(stages[i].name);
+        out->writestring("\n");
+    }
+}
+
+/* Print the stage table on the terminal */
+void bootlog_print() {
+    bootlog_out_t out = { terminal_writestring, terminal_writedec };
+    bootlog_table(&out);
+}
+
+/* Print the stage table and a summary line on the serial console */
+void bootlog_print_serial() {
+    bootlog_out_t out = { serial_writestring, serial_writedec };
+    bootlog_table(&out);
+    
+    // One line per stage and a final one, easy to pick out of a log
+    for (uint32_t i = 1; i < stage_count; i++) {
+        serial_writestring("BOOTLOG stage ");
+        serial_writestring(stages[i].name);
+        serial_writestring(" ");
+        serial_writedec(bootlog_us(stages[i].tsc - stages[i].start));
+        serial_writestring("\n");
+    }
+    serial_writestring("BOOTLOG done ");
+    serial_writedec(bootlog_total_us());
+    serial_writestring(timer_tsc_per_us() ? " us\n" : " cycles\n");
+}
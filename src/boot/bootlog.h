@@ -0,0 +1,39 @@
+#ifndef BOOTLOG_H
+#define BOOTLOG_H
+
+#include <stdint.h>
+
+/* Boot stages recorded at most */
+#define BOOTLOG_MAX_STAGES 48
+
+/* A finished boot stage */
+typedef struct {
+    const char* name;
+    uint64_t start;      // rdtsc when the stage started
+    uint64_t tsc;        // rdtsc when the stage finished
+} bootlog_stage_t;
+
+/* Record that a boot stage has finished, having started when the stage
+ * before it finished; the first mark is the kernel entry, and the TSC
+ * counts from reset up to it */
+void bootlog_mark(const char* name);
+
+/* Record a stage that ran alongside others and started at a given TSC */
+void bootlog_record(const char* name, uint64_t start);
+
+/* Get the number of stages recorded and one of them */
+uint32_t bootlog_count(void);
+const bootlog_stage_t* bootlog_get(uint32_t index);
+
+/* Get the time from the first mark to the last in microseconds (cycles
+ * before the TSC is calibrated) */
+uint32_t bootlog_total_us(void);
+
+/* Print the stage table on the terminal */
+void bootlog_print(void);
+
+/* Print the stage table and a "BOOTLOG done" summary line on the serial
+ * console, for tools/boot_bench.sh */
+void bootlog_print_serial(void);
+
+#endif /* BOOTLOG_H */
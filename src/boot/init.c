@@ -1,64 +1,155 @@
 #include "init.h"
 #include "bootloader.h"
 #include "initrd.h"
+#include "bootlog.h"
+#include "initcall.h"
 #include "../fs/vfs.h"
 #include "../fs/minfs.h"
 #include "../fs/file.h"
+#include "../net/network.h"
+#include "../net/ip.h"
+#include "../net/tcp.h"
+#include "../net/socket.h"
+#include "../pkg/package.h"
+#include "../security/user.h"
+#include "../security/access_control.h"
+#include "../security/update.h"
 #include "../kernel/kernel.h"
 #include "../kernel/memory.h"
 #include "../kernel/interrupt.h"
 #include "../kernel/process.h"
 #include "../kernel/syscall.h"
 #include "../kernel/timer.h"
+#include "../kernel/gdt.h"
+#include "../kernel/smp.h"
+#include "../kernel/vdso.h"
+#include "../kernel/softirq.h"
+#include "../kernel/workqueue.h"
+#include "../kernel/serial.h"
 #include <stdint.h>
 #include <string.h>
 
+/* Mount the initial ramdisk as the root file system. This runs in an
+ * initcall worker's address space, cloned before the initrd is mapped; the
+ * page fault handler brings the module window into it on first use */
+static void rootfs_init(void) {
+    init_mount_root();
+}
+
+/* Subsystems started once the scheduler and the other CPUs are up */
+static initcall_t subsystem_initcalls[] = {
+    INITCALL("vfs",            vfs_init,            0,             NULL),
+    INITCALL("minfs",          minfs_init,          0,             "vfs"),
+    INITCALL("file",           file_init,           0,             "vfs"),
+    INITCALL("rootfs",         rootfs_init,         0,             "vfs"),
+    INITCALL("network",        network_init,        0,             NULL),
+    INITCALL("ip",             ip_init,             0,             "network"),
+    INITCALL("tcp",            tcp_init,            0,             "ip"),
+    INITCALL("socket",         socket_init,         0,             "tcp", "file"),
+    INITCALL("user",           user_init,           0,             NULL),
+    INITCALL("access_control", access_control_init, 0,             "user"),
+    INITCALL("package",        package_init,        INITCALL_LAZY, "file", "network"),
+    INITCALL("update",         update_init,         INITCALL_LAZY, "package"),
+};
+
 /* Initialize the system */
 void init_system() {
     terminal_writestring("Initializing MinOS system...\n");
     
+    // Load our own GDT and the boot CPU's TSS
+    gdt_init();
+    bootlog_mark("gdt_init");
+    
     // Initialize memory management
     memory_init();
+    bootlog_mark("memory_init");
     
     // Initialize interrupts
     interrupts_init();
+    bootlog_mark("interrupts_init");
+    
+    // Serial port, for trace dumps
+    serial_init();
+    bootlog_mark("serial_init");
     
     // Initialize system timer (100Hz)
     timer_init(100);
+    bootlog_mark("timer_init");
+    
+    // Clock page mapped into every process
+    vdso_init();
+    bootlog_mark("vdso_init");
     
     // Initialize process management
     process_init();
+    bootlog_mark("process_init");
     
     // Initialize system call interface
     syscall_init();
-    
-    // Initialize file systems
-    vfs_init();
-    minfs_init();
-    file_init();
+    bootlog_mark("syscall_init");
     
     // Enable interrupts
     interrupts_enable();
     
+    // Start the other CPUs (needs the timer running)
+    smp_init();
+    bootlog_mark("smp_init");
+    
+    // Device interrupts through the I/O APIC when there is one (the PIT
+    // calibration in smp_init() still used the PIC)
+    if (irq_use_ioapic() == 0) {
+        terminal_writestring("I/O APIC routing enabled\n");
+    }
+    bootlog_mark("irq_use_ioapic");
+    
+    // Kernel threads for deferred interrupt work, one softirq thread per CPU
+    softirq_init();
+    bootlog_mark("softirq_init");
+    workqueue_init();
+    bootlog_mark("workqueue_init");
+    
+    // Stop the periodic tick if the local APICs can take over
+    if (timer_set_tickless(1) == 0) {
+        terminal_writestring("Tickless timer enabled\n");
+    }
+    bootlog_mark("timer_set_tickless");
+    
+    // File systems, network stack and user management, in parallel where
+    // their dependencies allow; package management waits for first use
+    for (uint32_t i = 0; i < sizeof(subsystem_initcalls) / sizeof(subsystem_initcalls[0]); i++) {
+        initcall_register(&subsystem_initcalls[i]);
+    }
+    initcall_run();
+    bootlog_mark("initcall_run");
+    
     terminal_writestring("System initialization complete\n");
+    bootlog_print_serial();
 }
 
 /* Mount the root file system */
 int init_mount_root() {
     terminal_writestring("Mounting root file system...\n");
     
-    // Try to mount the root file system from the boot device
-    uint32_t boot_device = boot_get_boot_device();
-    
     // For now, we'll use the initial ramdisk as the root file system
     // In a real implementation, we would detect and mount the actual root device
     
-    // Get the location of the initial ramdisk from multiboot info
-    // This would typically be passed by the bootloader
-    uint32_t initrd_location = 0x200000; // Example location, would be determined dynamically
+    // The bootloader loaded the initial ramdisk as a module; its frames are
+    // already reserved, so map it read-only where it is instead of copying
+    uint32_t initrd_start, initrd_end;
+    if (boot_get_initrd(&initrd_start, &initrd_end) != 0) {
+        terminal_writestring("No initial ramdisk module\n");
+        return -1;
+    }
+    
+    uint32_t initrd_size = initrd_end - initrd_start;
+    void* initrd_image = module_map(initrd_start, initrd_size);
+    if (!initrd_image) {
+        terminal_writestring("Failed to map initial ramdisk\n");
+        return -1;
+    }
     
     // Initialize the initial ramdisk
-    fs_node_t* initrd_root = initrd_init(initrd_location);
+    fs_node_t* initrd_root = initrd_init((uint32_t)initrd_image, initrd_size);
     if (!initrd_root) {
         terminal_writestring("Failed to initialize initial ramdisk\n");
         return -1;
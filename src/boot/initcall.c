@@ -0,0 +1,183 @@
+#include "initcall.h"
+#include "bootlog.h"
+#include "../kernel/kernel.h"
+#include "../kernel/process.h"
+#include "../kernel/spinlock.h"
+#include "../kernel/smp.h"
+#include "../kernel/cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Registered initcalls, and the processes waiting for one to finish */
+static initcall_t* initcalls = NULL;
+static process_t* waiters[MAX_CPUS * 2];
+static uint32_t waiter_count = 0;
+static spinlock_t initcall_lock = SPINLOCK_INIT;
+
+/* Boot initcalls not yet finished */
+static volatile uint32_t boot_remaining = 0;
+
+/* Add an initcall to the registry */
+void initcall_register(initcall_t* call) {
+    uint32_t flags = spin_lock_irqsave(&initcall_lock);
+    call->state = INITCALL_PENDING;
+    call->runner = NULL;
+    call->next = initcalls;
+    initcalls = call;
+    spin_unlock_irqrestore(&initcall_lock, flags);
+}
+
+/* Find an initcall by name */
+static initcall_t* initcall_find(const char* name) {
+    for (initcall_t* call = initcalls; call; call = call->next) {
+        if (strcmp(call->name, name) == 0) {
+            return call;
+        }
+    }
+    return NULL;
+}
+
+/* Check whether an initcall's dependencies have finished (lock held); a
+ * dependency nobody registered counts as finished */
+static int initcall_ready(initcall_t* call) {
+    for (int i = 0; i < INITCALL_MAX_DEPS && call->deps[i]; i++) {
+        initcall_t* dep = initcall_find(call->deps[i]);
+        if (dep && dep->state != INITCALL_DONE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Wait until another initcall finishes; drops the lock */
+static void initcall_wait(uint32_t flags) {
+    if (waiter_count < MAX_CPUS * 2) {
+        waiters[waiter_count++] = process_current();
+        process_block_unlock(&initcall_lock);
+        irq_restore(flags);
+    } else {
+        // No room on the list: poll instead
+        spin_unlock_irqrestore(&initcall_lock, flags);
+        process_yield();
+    }
+}
+
+/* Run an initcall claimed by the caller, then wake everyone waiting */
+static void initcall_call(initcall_t* call) {
+    uint64_t start = rdtsc();
+    call->fn();
+    bootlog_record(call->name, start);
+    
+    uint32_t flags = spin_lock_irqsave(&initcall_lock);
+    call->state = INITCALL_DONE;
+    call->runner = NULL;
+    if (!(call->flags & INITCALL_LAZY)) {
+        boot_remaining--;
+    }
+    for (uint32_t i = 0; i < waiter_count; i++) {
+        process_wake(waiters[i]);
+    }
+    waiter_count = 0;
+    spin_unlock_irqrestore(&initcall_lock, flags);
+}
+
+/* Take ready boot initcalls and run them until none are left */
+static void initcall_worker(void* unused) {
+    (void)unused;
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&initcall_lock);
+        if (boot_remaining == 0) {
+            spin_unlock_irqrestore(&initcall_lock, flags);
+            return;
+        }
+        
+        initcall_t* next = NULL;
+        for (initcall_t* call = initcalls; call; call = call->next) {
+            if (call->state == INITCALL_PENDING && !(call->flags & INITCALL_LAZY) && initcall_ready(call)) {
+                next = call;
+                break;
+            }
+        }
+        
+        // Everything left is running elsewhere or waits on what is
+        if (!next) {
+            initcall_wait(flags);
+            continue;
+        }
+        
+        next->state = INITCALL_RUNNING;
+        next->runner = process_current();
+        spin_unlock_irqrestore(&initcall_lock, flags);
+        
+        initcall_call(next);
+    }
+}
+
+/* Run every initcall that is not lazy, in parallel where the dependencies
+ * allow. The caller works too; each other CPU gets a helper thread */
+void initcall_run() {
+    uint32_t flags = spin_lock_irqsave(&initcall_lock);
+    
+    // Whatever a boot initcall needs cannot wait for first use
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (initcall_t* call = initcalls; call; call = call->next) {
+            for (int i = 0; !(call->flags & INITCALL_LAZY) && i < INITCALL_MAX_DEPS && call->deps[i]; i++) {
+                initcall_t* dep = initcall_find(call->deps[i]);
+                if (dep && (dep->flags & INITCALL_LAZY)) {
+                    dep->flags &= ~INITCALL_LAZY;
+                    changed = 1;
+                }
+            }
+        }
+    }
+    
+    boot_remaining = 0;
+    for (initcall_t* call = initcalls; call; call = call->next) {
+        if (call->state == INITCALL_PENDING && !(call->flags & INITCALL_LAZY)) {
+            boot_remaining++;
+        }
+    }
+    spin_unlock_irqrestore(&initcall_lock, flags);
+    
+    uint32_t online = smp_online_mask();
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if ((online & (1u << cpu)) && cpu != cpu_id()) {
+            process_create_kernel("initcall", initcall_worker, NULL, 1, 1u << cpu);
+        }
+    }
+    
+    initcall_worker(NULL);
+}
+
+/* Run a lazy initcall on first use */
+void initcall_require(const char* name) {
+    uint32_t flags = spin_lock_irqsave(&initcall_lock);
+    initcall_t* call = initcall_find(name);
+    
+    // Already done, or we are inside it (its fn uses its own interface)
+    if (!call || call->state == INITCALL_DONE || call->runner == process_current()) {
+        spin_unlock_irqrestore(&initcall_lock, flags);
+        return;
+    }
+    
+    if (call->state == INITCALL_PENDING) {
+        call->state = INITCALL_RUNNING;
+        call->runner = process_current();
+        spin_unlock_irqrestore(&initcall_lock, flags);
+        
+        for (int i = 0; i < INITCALL_MAX_DEPS && call->deps[i]; i++) {
+            initcall_require(call->deps[i]);
+        }
+        initcall_call(call);
+        return;
+    }
+    
+    // Someone else is running it
+    while (call->state != INITCALL_DONE) {
+        initcall_wait(flags);
+        flags = spin_lock_irqsave(&initcall_lock);
+    }
+    spin_unlock_irqrestore(&initcall_lock, flags);
+}
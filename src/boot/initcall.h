@@ -0,0 +1,55 @@
+#ifndef INITCALL_H
+#define INITCALL_H
+
+#include <stdint.h>
+
+/*
+ * Subsystem initialization by dependency. Each initcall names the
+ * initcalls that must finish before it starts. initcall_run() runs every
+ * registered initcall once its dependencies are done, on all CPUs at
+ * once, so independent subsystems start in parallel. Lazy initcalls are
+ * left out and run on the first initcall_require() instead.
+ */
+
+/* Dependencies an initcall may name */
+#define INITCALL_MAX_DEPS 4
+
+/* Initcall flags */
+#define INITCALL_LAZY 0x1   // Run on first use, not at boot
+
+/* Initcall states */
+#define INITCALL_PENDING 0
+#define INITCALL_RUNNING 1
+#define INITCALL_DONE    2
+
+struct process;
+
+/* A subsystem's initialization function and what it needs first */
+typedef struct initcall {
+    const char* name;
+    void (*fn)(void);
+    const char* deps[INITCALL_MAX_DEPS];    // Initcall names; unused ones NULL
+    uint32_t flags;
+    
+    // Kept by the registry
+    volatile uint32_t state;
+    struct process* runner;                 // Process running fn
+    struct initcall* next;
+} initcall_t;
+
+/* Initcall table entry: INITCALL("minfs", minfs_init, 0, "vfs") */
+#define INITCALL(call_name, call_fn, call_flags, ...) \
+    { .name = (call_name), .fn = (call_fn), .flags = (call_flags), .deps = { __VA_ARGS__ } }
+
+/* Add an initcall to the registry */
+void initcall_register(initcall_t* call);
+
+/* Run every initcall that is not lazy, in parallel where the dependencies
+ * allow, and return when all have finished */
+void initcall_run(void);
+
+/* Run a lazy initcall and its dependencies if that has not happened yet,
+ * or wait for whoever is running it; a no-op from inside the initcall */
+void initcall_require(const char* name);
+
+#endif /* INITCALL_H */
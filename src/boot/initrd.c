@@ -1,41 +1,301 @@
 #include "initrd.h"
 #include "../fs/vfs.h"
 #include "../kernel/kernel.h"
+#include "../kernel/memory.h"
+#include "../kernel/frame.h"
+#include "../kernel/spinlock.h"
+#include "../kernel/timer.h"
+#include "../kernel/cpu.h"
 #include <stdint.h>
 #include <string.h>
 
-/* Initial ramdisk magic number */
-#define INITRD_MAGIC 0x52444E49 /* "INRD" */
+/* No chunk decoded yet */
+#define INITRD_NO_CHUNK 0xFFFFFFFF
 
-/* Initial ramdisk version */
-#define INITRD_VERSION 0x0001
+/* A file in the initrd, whichever version the image is */
+typedef struct {
+    const char* name;
+    uint32_t offset;      // Data (version 1) or chunk table (version 2)
+    uint32_t length;      // Uncompressed length
+    uint32_t stored;      // Bytes taken in the image
+    
+    // Version 2: the last chunk decoded, kept for the next read
+    uint8_t* chunk;
+    uint32_t chunk_index;
+    spinlock_t lock;
+    
+    // Page cache for mappings: a frame per page, filled on first map
+    uint32_t* pages;
+} initrd_file_t;
 
 /* Initial ramdisk data */
 static uint32_t initrd_location = 0;
 static initrd_header_t* initrd_header = NULL;
-static initrd_file_header_t* file_headers = NULL;
+static initrd_file_t* initrd_files = NULL;
 static fs_node_t* initrd_root = NULL;
-static fs_node_t* initrd_dev = NULL;
+
+/* Decompression statistics */
+static volatile uint32_t chunks_decoded = 0;
+static volatile uint32_t chunk_buffers = 0;
+
+/* Read an LZ4 length extension: bytes of 255 and a final byte, all added */
+static int lz4_length(const uint8_t** ip, const uint8_t* iend, uint32_t* length) {
+    uint8_t byte;
+    
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    
+    return 0;
+}
+
+/* Decode one LZ4 block; returns the decoded size, or -1 if the block is
+ * corrupt or does not fit */
+static int lz4_decode(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_len;
+    
+    while (ip < iend) {
+        uint32_t token = *ip++;
+        
+        // Literals
+        uint32_t length = token >> 4;
+        if (length == 15 && lz4_length(&ip, iend, &length) != 0) {
+            return -1;
+        }
+        if (length > (uint32_t)(iend - ip) || length > (uint32_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+        
+        // The last sequence has no match
+        if (ip == iend) {
+            break;
+        }
+        
+        // Match: a little-endian offset back into the output
+        if (iend - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return -1;
+        }
+        
+        length = (token & 15) + 4;
+        if (length == 19 && lz4_length(&ip, iend, &length) != 0) {
+            return -1;
+        }
+        if (length > (uint32_t)(oend - op)) {
+            return -1;
+        }
+        
+        // Overlapping matches repeat the bytes just written, so copy forward
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            while (length--) {
+                *op++ = *match++;
+            }
+        }
+    }
+    
+    return (int)(op - dst);
+}
+
+/* Copy part of a chunk of a version 2 file, decoding the chunk unless it
+ * is stored as it is or is the one decoded last */
+static int initrd_copy_chunk(initrd_file_t* file, uint32_t index, uint32_t offset, uint32_t count, uint8_t* buffer) {
+    uint32_t nchunks = (file->length + INITRD_CHUNK_SIZE - 1) / INITRD_CHUNK_SIZE;
+    uint32_t* ends = (uint32_t*)(initrd_location + file->offset);
+    uint8_t* data = (uint8_t*)(ends + nchunks);
+    uint32_t start = index ? ends[index - 1] : 0;
+    uint32_t end = ends[index];
+    uint32_t length = file->length - index * INITRD_CHUNK_SIZE;
+    if (length > INITRD_CHUNK_SIZE) {
+        length = INITRD_CHUNK_SIZE;
+    }
+    
+    // The table is only checked as it is used
+    if (end < start || end > file->stored - nchunks * sizeof(uint32_t)) {
+        return -1;
+    }
+    
+    // Chunks that do not compress are stored as they are
+    if (end - start == length) {
+        memcpy(buffer, data + start + offset, count);
+        return 0;
+    }
+    
+    // The decode buffer is allocated on the first read of the file
+    if (!file->chunk) {
+        uint8_t* chunk = (uint8_t*)kmalloc(INITRD_CHUNK_SIZE);
+        if (!chunk) {
+            return -1;
+        }
+        
+        uint32_t flags = spin_lock_irqsave(&file->lock);
+        if (!file->chunk) {
+            file->chunk = chunk;
+            chunk = NULL;
+        }
+        spin_unlock_irqrestore(&file->lock, flags);
+        
+        if (chunk) {
+            kfree(chunk);
+        } else {
+            __sync_fetch_and_add(&chunk_buffers, 1);
+        }
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&file->lock);
+    if (file->chunk_index != index) {
+        if (lz4_decode(data + start, end - start, file->chunk, length) != (int)length) {
+            file->chunk_index = INITRD_NO_CHUNK;
+            spin_unlock_irqrestore(&file->lock, flags);
+            terminal_writestring("initrd: corrupt chunk in ");
+            terminal_writestring(file->name);
+            terminal_writestring("\n");
+            return -1;
+        }
+        file->chunk_index = index;
+        __sync_fetch_and_add(&chunks_decoded, 1);
+    }
+    memcpy(buffer, file->chunk + offset, count);
+    spin_unlock_irqrestore(&file->lock, flags);
+    
+    return 0;
+}
 
 /* Read from an initrd file */
 static uint32_t initrd_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
-    initrd_file_header_t header = file_headers[node->inode];
+    initrd_file_t* file = &initrd_files[node->inode];
     
     // Check if offset is beyond file size
-    if (offset >= header.length) {
+    if (offset >= file->length) {
         return 0;
     }
     
     // Calculate how much to read
     uint32_t read_size = size;
-    if (offset + size > header.length) {
-        read_size = header.length - offset;
+    if (read_size > file->length - offset) {
+        read_size = file->length - offset;
     }
     
-    // Copy data from the ramdisk
-    memcpy(buffer, (uint8_t*)(initrd_location + header.offset + offset), read_size);
+    // Copy data straight from the ramdisk
+    if (initrd_header->version == INITRD_VERSION) {
+        memcpy(buffer, (uint8_t*)(initrd_location + file->offset + offset), read_size);
+        return read_size;
+    }
     
-    return read_size;
+    // Compressed files are decoded a chunk at a time as they are read
+    uint32_t done = 0;
+    while (done < read_size) {
+        uint32_t index = (offset + done) / INITRD_CHUNK_SIZE;
+        uint32_t chunk_offset = (offset + done) % INITRD_CHUNK_SIZE;
+        uint32_t count = INITRD_CHUNK_SIZE - chunk_offset;
+        if (count > read_size - done) {
+            count = read_size - done;
+        }
+        
+        if (initrd_copy_chunk(file, index, chunk_offset, count, buffer + done) != 0) {
+            break;
+        }
+        done += count;
+    }
+    
+    return done;
+}
+
+/* Hand out a reference to the frame caching a page of a file, reading
+ * the page in on first use */
+static uint32_t initrd_map(fs_node_t* node, uint32_t offset) {
+    initrd_file_t* file = &initrd_files[node->inode];
+    uint32_t npages = (file->length + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t index = offset / PAGE_SIZE;
+    
+    if (offset >= file->length) {
+        return VFS_MAP_NONE;
+    }
+    
+    // The frame table is allocated on the first map of the file
+    if (!file->pages) {
+        uint32_t* pages = (uint32_t*)kmalloc(npages * sizeof(uint32_t));
+        if (!pages) {
+            return VFS_MAP_NONE;
+        }
+        for (uint32_t i = 0; i < npages; i++) {
+            pages[i] = FRAME_NONE;
+        }
+        
+        uint32_t flags = spin_lock_irqsave(&file->lock);
+        if (!file->pages) {
+            file->pages = pages;
+            pages = NULL;
+        }
+        spin_unlock_irqrestore(&file->lock, flags);
+        
+        if (pages) {
+            kfree(pages);
+        }
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&file->lock);
+    uint32_t frame = file->pages[index];
+    if (frame != FRAME_NONE) {
+        frame_ref(frame);
+    }
+    spin_unlock_irqrestore(&file->lock, flags);
+    if (frame != FRAME_NONE) {
+        return frame;
+    }
+    
+    // Read the page outside the lock, which decoding takes itself
+    frame = frame_alloc();
+    if (frame == FRAME_NONE) {
+        return VFS_MAP_NONE;
+    }
+    uint32_t size = file->length - index * PAGE_SIZE;
+    if (size > PAGE_SIZE) {
+        size = PAGE_SIZE;
+    }
+    uint8_t* data = (uint8_t*)kmap_frame(frame);
+    memset(data, 0, PAGE_SIZE); // Past end of file reads as zeroes
+    int ok = initrd_read(node, index * PAGE_SIZE, PAGE_SIZE, data) == size;
+    kunmap_frame(data);
+    if (!ok) {
+        frame_free(frame);
+        return VFS_MAP_NONE;
+    }
+    
+    // The cache keeps one reference and the caller gets another; a
+    // mapper that lost the race uses the winner's frame
+    flags = spin_lock_irqsave(&file->lock);
+    uint32_t cached = file->pages[index];
+    if (cached == FRAME_NONE) {
+        file->pages[index] = frame;
+        frame_ref(frame);
+    } else {
+        frame_ref(cached);
+    }
+    spin_unlock_irqrestore(&file->lock, flags);
+    
+    if (cached != FRAME_NONE) {
+        frame_free(frame);
+        return cached;
+    }
+    return frame;
 }
 
 /* Read directory entries from initrd */
@@ -54,7 +314,7 @@ static dirent_t* initrd_readdir(fs_node_t* node, uint32_t index) {
         
         // Create a directory entry
         static dirent_t dirent;
-        strcpy(dirent.name, (char*)file_headers[index].name);
+        strcpy(dirent.name, initrd_files[index].name);
         dirent.inode = index;
         
         return &dirent;
@@ -74,22 +334,23 @@ static fs_node_t* initrd_finddir(fs_node_t* node, char* name) {
     if (node == initrd_root) {
         // Search for the file
         for (uint32_t i = 0; i < initrd_header->num_files; i++) {
-            if (strcmp(name, (char*)file_headers[i].name) == 0) {
+            if (strcmp(name, initrd_files[i].name) == 0) {
                 // Create a file node
-                fs_node_t* file_node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+                fs_node_t* file_node = vfs_alloc_node();
                 strcpy(file_node->name, name);
                 file_node->mask = 0444; // Read-only
                 file_node->uid = 0;
                 file_node->gid = 0;
                 file_node->flags = VFS_FILE;
                 file_node->inode = i;
-                file_node->length = file_headers[i].length;
+                file_node->length = initrd_files[i].length;
                 file_node->read = initrd_read;
                 file_node->write = NULL; // Read-only
                 file_node->open = NULL;
                 file_node->close = NULL;
                 file_node->readdir = NULL;
                 file_node->finddir = NULL;
+                file_node->map = initrd_map;
                 file_node->impl = 0;
                 
                 return file_node;
@@ -101,7 +362,7 @@ static fs_node_t* initrd_finddir(fs_node_t* node, char* name) {
 }
 
 /* Initialize the initial ramdisk */
-fs_node_t* initrd_init(uint32_t location) {
+fs_node_t* initrd_init(uint32_t location, uint32_t size) {
     terminal_writestring("Initializing initial ramdisk...\n");
     
     // Save the location
@@ -110,6 +371,11 @@ fs_node_t* initrd_init(uint32_t location) {
     // Get the header
     initrd_header = (initrd_header_t*)location;
     
+    if (size < sizeof(initrd_header_t)) {
+        terminal_writestring("Invalid initial ramdisk: too small\n");
+        return NULL;
+    }
+    
     // Verify the magic number
     if (initrd_header->magic != INITRD_MAGIC) {
         terminal_writestring("Invalid initial ramdisk: bad magic number\n");
@@ -117,16 +383,65 @@ fs_node_t* initrd_init(uint32_t location) {
     }
     
     // Verify the version
-    if (initrd_header->version != INITRD_VERSION) {
+    uint32_t header_size;
+    if (initrd_header->version == INITRD_VERSION) {
+        header_size = sizeof(initrd_file_header_t);
+    } else if (initrd_header->version == INITRD_VERSION_LZ4) {
+        header_size = sizeof(initrd_file_header_lz4_t);
+    } else {
         terminal_writestring("Invalid initial ramdisk: unsupported version\n");
         return NULL;
     }
     
-    // Get the file headers
-    file_headers = (initrd_file_header_t*)(location + sizeof(initrd_header_t));
+    // The image is used in place, so every file must lie inside the module
+    uint32_t num_files = initrd_header->num_files;
+    if (num_files > (size - sizeof(initrd_header_t)) / header_size) {
+        terminal_writestring("Invalid initial ramdisk: truncated file table\n");
+        return NULL;
+    }
+    
+    initrd_files = (initrd_file_t*)kmalloc(num_files * sizeof(initrd_file_t));
+    if (num_files && !initrd_files) {
+        terminal_writestring("Initial ramdisk: out of memory\n");
+        return NULL;
+    }
+    
+    // Collect the file headers of either version in one table
+    uint8_t* file_header = (uint8_t*)(location + sizeof(initrd_header_t));
+    for (uint32_t i = 0; i < num_files; i++, file_header += header_size) {
+        initrd_file_t* file = &initrd_files[i];
+        
+        if (initrd_header->version == INITRD_VERSION) {
+            initrd_file_header_t* header = (initrd_file_header_t*)file_header;
+            file->name = (const char*)header->name;
+            file->offset = header->offset;
+            file->length = header->length;
+            file->stored = header->length;
+        } else {
+            initrd_file_header_lz4_t* header = (initrd_file_header_lz4_t*)file_header;
+            file->name = (const char*)header->name;
+            file->offset = header->offset;
+            file->length = header->length;
+            file->stored = header->stored;
+        }
+        file->chunk = NULL;
+        file->chunk_index = INITRD_NO_CHUNK;
+        spin_init(&file->lock);
+        file->pages = NULL;
+        
+        // Names must end within their field and files within the image
+        uint32_t nchunks = (file->length + INITRD_CHUNK_SIZE - 1) / INITRD_CHUNK_SIZE;
+        if (file->name[63] != '\0' || file->offset > size || file->stored > size - file->offset ||
+            (initrd_header->version == INITRD_VERSION_LZ4 && nchunks > file->stored / sizeof(uint32_t))) {
+            terminal_writestring("Invalid initial ramdisk: file outside the image\n");
+            kfree(initrd_files);
+            initrd_files = NULL;
+            return NULL;
+        }
+    }
     
     // Create the root directory node
-    initrd_root = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+    initrd_root = vfs_alloc_node();
     strcpy(initrd_root->name, "initrd");
     initrd_root->mask = 0555; // Read and execute
     initrd_root->uid = 0;
@@ -140,17 +455,72 @@ fs_node_t* initrd_init(uint32_t location) {
     initrd_root->close = NULL;
     initrd_root->readdir = initrd_readdir;
     initrd_root->finddir = initrd_finddir;
+    initrd_root->map = NULL;
     initrd_root->impl = 0;
     
     terminal_writestring("Initial ramdisk initialized with ");
-    // Print number of files
+    terminal_writedec(initrd_header->num_files);
     terminal_writestring(" files\n");
     
     return initrd_root;
 }
 
-/* Create an initial ramdisk from a directory */
-int initrd_create(const char* directory, const char* output_file) {
-    // This function would be implemented in a host tool, not in the kernel
-    return -1;
+/* Read every file in the initial ramdisk twice and report the image size,
+ * read times and memory held for decompression */
+void initrd_benchmark() {
+    if (!initrd_root) {
+        terminal_writestring("initrd: no initial ramdisk mounted\n");
+        return;
+    }
+    
+    uint8_t* buffer = (uint8_t*)kmalloc(INITRD_CHUNK_SIZE);
+    if (!buffer) {
+        terminal_writestring("initrd: out of memory\n");
+        return;
+    }
+    
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < initrd_header->num_files; i++) {
+        total += initrd_files[i].length;
+    }
+    
+    terminal_writestring("initrd: ");
+    terminal_writedec(initrd_header->num_files);
+    terminal_writestring(initrd_header->version == INITRD_VERSION ? " files, raw, " : " files, LZ4, ");
+    terminal_writedec(initrd_header->size / 1024);
+    terminal_writestring("KB image for ");
+    terminal_writedec(total / 1024);
+    terminal_writestring("KB of files\n");
+    
+    // The first pass decodes every chunk; the second shows whether reading
+    // a file again is any cheaper
+    fs_node_t node;
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t decoded = chunks_decoded;
+        uint64_t start = rdtsc();
+        
+        for (uint32_t i = 0; i < initrd_header->num_files; i++) {
+            node.inode = i;
+            for (uint32_t offset = 0; offset < initrd_files[i].length; offset += INITRD_CHUNK_SIZE) {
+                initrd_read(&node, offset, INITRD_CHUNK_SIZE, buffer);
+            }
+        }
+        
+        uint64_t cycles = rdtsc() - start;
+        uint32_t tsc_per_us = timer_tsc_per_us();
+        terminal_writestring(pass == 0 ? "  first read:  " : "  second read: ");
+        terminal_writedec((uint32_t)(tsc_per_us ? cycles / tsc_per_us : cycles));
+        terminal_writestring(tsc_per_us ? " us, " : " cycles, ");
+        terminal_writedec(chunks_decoded - decoded);
+        terminal_writestring(" chunks decoded\n");
+    }
+    
+    kfree(buffer);
+    
+    // Raw images are read in place; compressed ones add a buffer per file read
+    terminal_writestring("  memory: ");
+    terminal_writedec(initrd_header->size / 1024);
+    terminal_writestring("KB image + ");
+    terminal_writedec(chunk_buffers * (INITRD_CHUNK_SIZE / 1024));
+    terminal_writestring("KB decode buffers\n");
 }
@@ -4,6 +4,16 @@
 #include "../fs/vfs.h"
 #include <stdint.h>
 
+/* Initial ramdisk magic number */
+#define INITRD_MAGIC 0x52444E49 /* "INRD" */
+
+/* Initial ramdisk versions */
+#define INITRD_VERSION     0x0001  /* Files stored as they are */
+#define INITRD_VERSION_LZ4 0x0002  /* Files stored as LZ4 compressed chunks */
+
+/* Uncompressed bytes in each chunk of a version 2 file */
+#define INITRD_CHUNK_SIZE  0x10000
+
 /* Initial ramdisk header */
 typedef struct {
     uint32_t magic;       /* Magic number to identify initrd */
@@ -19,10 +29,24 @@ typedef struct {
     uint32_t length;      /* Length of file in bytes */
 } initrd_file_header_t;
 
-/* Initialize the initial ramdisk */
-fs_node_t* initrd_init(uint32_t location);
+/* Version 2 file header. The file is cut into INITRD_CHUNK_SIZE chunks,
+ * each an independent LZ4 block, or stored as it is when that is no
+ * smaller. At offset is a table with the end of each chunk, counted from
+ * the end of the table, followed by the chunks themselves */
+typedef struct {
+    uint8_t name[64];     /* Filename (null-terminated) */
+    uint32_t offset;      /* Offset of the chunk table from start of initrd */
+    uint32_t length;      /* Uncompressed length of file in bytes */
+    uint32_t stored;      /* Bytes taken in the initrd, table included */
+} initrd_file_header_lz4_t;
+
+/* Initialize the initial ramdisk from an image of the given size mapped at
+ * location; the image is read in place and must stay mapped. Images are
+ * built with tools/initrd_create */
+fs_node_t* initrd_init(uint32_t location, uint32_t size);
 
-/* Create an initial ramdisk from a directory */
-int initrd_create(const char* directory, const char* output_file);
+/* Read every file in the initial ramdisk twice and report the image size,
+ * read times and memory held for decompression */
+void initrd_benchmark(void);
 
 #endif /* INITRD_H */
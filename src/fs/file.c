@@ -1,6 +1,7 @@
 #include "file.h"
 #include "vfs.h"
 #include "../kernel/kernel.h"
+#include "../kernel/kmem.h"
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
@@ -11,6 +12,9 @@
 /* File descriptor table */
 static file_descriptor_t* fd_table[MAX_OPEN_FILES];
 
+/* Cache for file_descriptor_t */
+static kmem_cache_t* fd_cache = NULL;
+
 /* Current working directory */
 static char current_dir[256] = "/";
 
@@ -23,15 +27,20 @@ void file_init() {
         fd_table[i] = NULL;
     }
     
+    fd_cache = kmem_cache_create("file_descriptor", sizeof(file_descriptor_t));
+    
     // Set up standard file descriptors (stdin, stdout, stderr)
     // To be implemented when we have device files
     
     terminal_writestring("File system interface initialized\n");
 }
 
+/* First descriptor handed out; 0-2 are kept for the standard streams */
+#define FIRST_FD 3
+
 /* Allocate a file descriptor */
 static int alloc_fd() {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+    for (int i = FIRST_FD; i < MAX_OPEN_FILES; i++) {
         if (fd_table[i] == NULL) {
             return i;
         }
@@ -157,6 +166,15 @@ int file_open(const char* path, uint32_t flags) {
         return -1; // Cannot open directory as file
     }
     
+    return file_open_node(node, flags);
+}
+
+/* Open an already resolved VFS node */
+int file_open_node(fs_node_t* node, uint32_t flags) {
+    if (!node) {
+        return -1;
+    }
+    
     // Allocate a file descriptor
     int fd = alloc_fd();
     if (fd < 0) {
@@ -164,12 +182,13 @@ int file_open(const char* path, uint32_t flags) {
     }
     
     // Allocate a file descriptor structure
-    file_descriptor_t* file = (file_descriptor_t*)kmalloc(sizeof(file_descriptor_t));
+    file_descriptor_t* file = (file_descriptor_t*)kmem_cache_alloc(fd_cache);
     if (!file) {
         return -1; // Out of memory
     }
     
-    // Initialize the file descriptor
+    // Initialize the file descriptor; it holds the node until closed
+    vfs_ref(node);
     file->node = node;
     file->offset = 0;
     file->flags = flags;
@@ -194,6 +213,22 @@ int file_open(const char* path, uint32_t flags) {
     return fd;
 }
 
+/* Get the VFS node behind a file descriptor */
+fs_node_t* file_get_node(int fd) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || fd_table[fd] == NULL) {
+        return NULL;
+    }
+    return fd_table[fd]->node;
+}
+
+/* Get the open flags of a file descriptor */
+int file_get_flags(int fd) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || fd_table[fd] == NULL) {
+        return -1;
+    }
+    return fd_table[fd]->flags;
+}
+
 /* Close a file */
 int file_close(int fd) {
     // Check if the file descriptor is valid
@@ -211,9 +246,10 @@ int file_close(int fd) {
     if (file->refcount == 0) {
         // Close the file
         vfs_close(file->node);
+        vfs_unref(file->node);
         
         // Free the file descriptor
-        kfree(file);
+        kmem_cache_free(fd_cache, file);
     }
     
     // Clear the file descriptor table entry
@@ -29,6 +29,15 @@ void file_init(void);
 /* Open a file */
 int file_open(const char* path, uint32_t flags);
 
+/* Open an already resolved VFS node */
+int file_open_node(fs_node_t* node, uint32_t flags);
+
+/* Get the VFS node behind a file descriptor */
+fs_node_t* file_get_node(int fd);
+
+/* Get the open flags of a file descriptor */
+int file_get_flags(int fd);
+
 /* Close a file */
 int file_close(int fd);
 
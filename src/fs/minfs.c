@@ -503,8 +503,7 @@ fs_node_t* minfs_mount(fs_node_t* device) {
     }
     
     // Create root node
-    fs_node_t* root = (fs_node_t*)kmalloc(sizeof(fs_node_t));
-    memset(root, 0, sizeof(fs_node_t));
+    fs_node_t* root = vfs_alloc_node();
     
     strcpy(root->name, "/");
     root->mask = 0755;
@@ -1,5 +1,7 @@
 #include "vfs.h"
 #include "../kernel/kernel.h"
+#include "../kernel/kmem.h"
+#include "../kernel/spinlock.h"
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
@@ -7,6 +9,12 @@
 /* Root file system node */
 static fs_node_t* fs_root = NULL;
 
+/* Cache for fs_node_t */
+static kmem_cache_t* node_cache = NULL;
+
+/* Protects node reference counts */
+static spinlock_t node_lock = SPINLOCK_INIT;
+
 /* Initialize the VFS */
 void vfs_init() {
     terminal_writestring("Initializing Virtual File System...\n");
@@ -14,9 +22,62 @@ void vfs_init() {
     // Root node will be set when a file system is mounted
     fs_root = NULL;
     
+    node_cache = kmem_cache_create("fs_node", sizeof(fs_node_t));
+    
     terminal_writestring("VFS initialized\n");
 }
 
+/* Allocate a zeroed file system node */
+fs_node_t* vfs_alloc_node() {
+    fs_node_t* node = (fs_node_t*)kmem_cache_alloc(node_cache);
+    if (node) {
+        memset(node, 0, sizeof(fs_node_t));
+    }
+    return node;
+}
+
+/* Free a file system node, or leave it to the last reference */
+void vfs_free_node(fs_node_t* node) {
+    if (!node) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&node_lock);
+    int in_use = node->refcount != 0;
+    node->released = 1;
+    spin_unlock_irqrestore(&node_lock, flags);
+    
+    if (!in_use) {
+        kmem_cache_free(node_cache, node);
+    }
+}
+
+/* Take a reference to a node */
+void vfs_ref(fs_node_t* node) {
+    if (!node) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&node_lock);
+    node->refcount++;
+    spin_unlock_irqrestore(&node_lock, flags);
+}
+
+/* Drop a reference to a node, freeing it if its owner already has */
+void vfs_unref(fs_node_t* node) {
+    if (!node) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&node_lock);
+    int last = --node->refcount == 0 && node->released;
+    spin_unlock_irqrestore(&node_lock, flags);
+    
+    if (last) {
+        kmem_cache_free(node_cache, node);
+    }
+}
+
 /* Get the root node */
 fs_node_t* vfs_get_root() {
     return fs_root;
@@ -101,3 +162,12 @@ void vfs_unlink(fs_node_t* node, char* name) {
         node->unlink(node, name);
     }
 }
+
+/* Get the cached frame holding a page of a file, with a reference taken */
+uint32_t vfs_map(fs_node_t* node, uint32_t offset) {
+    // Check if the node has a map function
+    if (node->map != 0) {
+        return node->map(node, offset);
+    }
+    return VFS_MAP_NONE;
+}
@@ -18,6 +18,9 @@
 #define VFS_WRITE       0x02
 #define VFS_EXECUTE     0x04
 
+/* Returned by vfs_map() for pages that cannot be mapped directly */
+#define VFS_MAP_NONE    0xFFFFFFFF
+
 /* Seek modes */
 #define VFS_SEEK_SET    0x01
 #define VFS_SEEK_CUR    0x02
@@ -36,6 +39,7 @@ typedef struct dirent* (*readdir_type_t)(struct fs_node*, uint32_t);
 typedef struct fs_node* (*finddir_type_t)(struct fs_node*, char* name);
 typedef void (*create_type_t)(struct fs_node*, char* name, uint16_t permission);
 typedef void (*unlink_type_t)(struct fs_node*, char* name);
+typedef uint32_t (*map_type_t)(struct fs_node*, uint32_t offset);
 
 /* File system node structure */
 typedef struct fs_node {
@@ -47,6 +51,8 @@ typedef struct fs_node {
     uint32_t inode;             /* Inode number */
     uint32_t length;            /* File size */
     uint32_t impl;              /* Implementation-specific data */
+    uint32_t refcount;          /* Open files and mappings using the node */
+    uint32_t released;          /* Freed by its owner while still in use */
     
     /* File operations */
     read_type_t read;
@@ -57,6 +63,7 @@ typedef struct fs_node {
     finddir_type_t finddir;
     create_type_t create;
     unlink_type_t unlink;
+    map_type_t map;             /* Optional: frame caching a page of the file */
     
     struct fs_node* ptr;        /* Used for mountpoints and symlinks */
 } fs_node_t;
@@ -76,10 +83,20 @@ dirent_t* vfs_readdir(fs_node_t* node, uint32_t index);
 fs_node_t* vfs_finddir(fs_node_t* node, char* name);
 void vfs_create(fs_node_t* node, char* name, uint16_t permission);
 void vfs_unlink(fs_node_t* node, char* name);
+uint32_t vfs_map(fs_node_t* node, uint32_t offset);
 
 /* Initialize the VFS */
 void vfs_init(void);
 
+/* Allocate a zeroed node, and free one. A node freed while open files or
+ * mappings hold references goes when the last reference is dropped */
+fs_node_t* vfs_alloc_node(void);
+void vfs_free_node(fs_node_t* node);
+
+/* Take and drop a reference to a node */
+void vfs_ref(fs_node_t* node);
+void vfs_unref(fs_node_t* node);
+
 /* Mount a file system */
 int vfs_mount(char* path, fs_node_t* node);
 
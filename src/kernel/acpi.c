@@ -0,0 +1,172 @@
+#include "acpi.h"
+#include "memory.h"
+#include "kernel.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Root system description pointer (ACPI 1.0 part) */
+typedef struct {
+    char signature[8];        // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* MADT layout after the common header */
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+/* MADT entry header */
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+/* MADT processor local APIC entry */
+typedef struct {
+    madt_entry_t header;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_t;
+
+/* MADT I/O APIC entry */
+typedef struct {
+    madt_entry_t header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+/* MADT interrupt source override: an ISA IRQ wired to another interrupt */
+typedef struct {
+    madt_entry_t header;
+    uint8_t bus;              // 0 for ISA
+    uint8_t source;           // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_override_t;
+
+static acpi_madt_info_t madt_info;
+
+/* Sum of a table's bytes; valid tables sum to zero */
+static uint8_t acpi_checksum(const void *data, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+/* Scan a physical range (identity mapped, below 1MB) for the RSDP */
+static acpi_rsdp_t *rsdp_scan(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t*)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, sizeof(acpi_rsdp_t)) == 0) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/* Map a whole table given its physical address */
+static acpi_header_t *acpi_map_table(uint32_t phys) {
+    acpi_header_t *header = (acpi_header_t*)mmio_map(phys, sizeof(acpi_header_t));
+    if (!header) {
+        return NULL;
+    }
+
+    header = (acpi_header_t*)mmio_map(phys, header->length);
+    if (!header || acpi_checksum(header, header->length) != 0) {
+        return NULL;
+    }
+    return header;
+}
+
+/* Record the processors, I/O APICs and ISA overrides listed in the MADT */
+static void madt_parse(acpi_madt_t *madt) {
+    madt_info.lapic_addr = madt->lapic_addr;
+
+    // ISA IRQs arrive on the interrupt of the same number unless overridden
+    for (uint32_t irq = 0; irq < ISA_IRQS; irq++) {
+        madt_info.isa_gsi[irq] = irq;
+    }
+
+    uint32_t offset = sizeof(acpi_madt_t);
+    while (offset + sizeof(madt_entry_t) <= madt->header.length) {
+        madt_entry_t *entry = (madt_entry_t*)((uint8_t*)madt + offset);
+        if (entry->length < sizeof(madt_entry_t)) {
+            break; // Malformed table
+        }
+
+        if (entry->type == MADT_LOCAL_APIC) {
+            madt_lapic_t *lapic = (madt_lapic_t*)entry;
+            if ((lapic->flags & MADT_CPU_ENABLED) && madt_info.ncpus < MAX_CPUS) {
+                madt_info.apic_ids[madt_info.ncpus++] = lapic->apic_id;
+            }
+        } else if (entry->type == MADT_IO_APIC && madt_info.nioapics < MAX_IOAPICS) {
+            madt_ioapic_t *ioapic = (madt_ioapic_t*)entry;
+            acpi_ioapic_t *info = &madt_info.ioapics[madt_info.nioapics++];
+            info->id = ioapic->ioapic_id;
+            info->addr = ioapic->addr;
+            info->gsi_base = ioapic->gsi_base;
+        } else if (entry->type == MADT_INT_OVERRIDE) {
+            madt_override_t *override = (madt_override_t*)entry;
+            if (override->bus == 0 && override->source < ISA_IRQS) {
+                madt_info.isa_gsi[override->source] = override->gsi;
+                madt_info.isa_flags[override->source] = override->flags;
+            }
+        }
+
+        offset += entry->length;
+    }
+}
+
+/* Find the MADT through the RSDP and RSDT */
+int acpi_init() {
+    memset(&madt_info, 0, sizeof(madt_info));
+
+    // The RSDP is in the first KB of the EBDA or in the BIOS area. The
+    // EBDA segment is read through a pointer GCC cannot follow, so that
+    // -Warray-bounds does not flag the fixed address.
+    uint16_t *ebda_segment = (uint16_t*)0x40E;
+    asm("" : "+r"(ebda_segment));
+    uint32_t ebda = (uint32_t)*ebda_segment << 4;
+    acpi_rsdp_t *rsdp = ebda ? rsdp_scan(ebda, ebda + 1024) : NULL;
+    if (!rsdp) {
+        rsdp = rsdp_scan(0xE0000, 0x100000);
+    }
+    if (!rsdp) {
+        return -1;
+    }
+
+    acpi_header_t *rsdt = acpi_map_table(rsdp->rsdt_addr);
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        return -1;
+    }
+
+    uint32_t count = (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t);
+    uint32_t *entries = (uint32_t*)(rsdt + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        acpi_header_t *table = acpi_map_table(entries[i]);
+        if (table && memcmp(table->signature, "APIC", 4) == 0) {
+            madt_parse((acpi_madt_t*)table);
+            return madt_info.ncpus ? 0 : -1;
+        }
+    }
+
+    return -1;
+}
+
+/* Get the parsed MADT */
+const acpi_madt_info_t *acpi_get_madt() {
+    return &madt_info;
+}
@@ -0,0 +1,63 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "cpu.h"
+#include <stdint.h>
+
+/* Common header of every ACPI system description table */
+typedef struct {
+    char signature[4];
+    uint32_t length;          // Whole table, header included
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/* MADT entry types */
+#define MADT_LOCAL_APIC 0
+#define MADT_IO_APIC    1
+#define MADT_INT_OVERRIDE 2
+
+/* Interrupt source override flags (MPS INTI): each field 0 means the bus
+ * default, which for ISA is active high and edge triggered */
+#define MADT_POLARITY_MASK   0x3
+#define MADT_POLARITY_LOW    0x3
+#define MADT_TRIGGER_MASK    0xC
+#define MADT_TRIGGER_LEVEL   0xC
+
+/* I/O APICs recorded and legacy ISA interrupt lines */
+#define MAX_IOAPICS  4
+#define ISA_IRQS     16
+
+/* Local APIC entry flag: processor is usable */
+#define MADT_CPU_ENABLED 0x1
+
+/* An I/O APIC listed in the MADT */
+typedef struct {
+    uint32_t id;
+    uint32_t addr;                  // Physical address of its registers
+    uint32_t gsi_base;              // First interrupt it handles
+} acpi_ioapic_t;
+
+/* What the MADT says about the interrupt hardware */
+typedef struct {
+    uint32_t lapic_addr;            // Physical address of the local APICs
+    uint32_t ncpus;                 // Enabled processors found
+    uint8_t apic_ids[MAX_CPUS];     // Local APIC ID of each processor
+    uint32_t nioapics;              // I/O APICs found
+    acpi_ioapic_t ioapics[MAX_IOAPICS];
+    uint32_t isa_gsi[ISA_IRQS];     // Interrupt each ISA IRQ arrives on
+    uint16_t isa_flags[ISA_IRQS];   // Its MADT_POLARITY_* and MADT_TRIGGER_* flags
+} acpi_madt_info_t;
+
+/* Find the MADT through the RSDP and RSDT; returns -1 if there is none */
+int acpi_init(void);
+
+/* Get the parsed MADT (valid after acpi_init() succeeded) */
+const acpi_madt_info_t *acpi_get_madt(void);
+
+#endif /* ACPI_H */
@@ -0,0 +1,128 @@
+#include "apic.h"
+#include "memory.h"
+#include "timer.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include <stdint.h>
+
+/* PIT ticks the calibration runs for */
+#define CALIBRATE_TICKS 5
+
+/* Mapped local APIC registers (every CPU sees its own at this address) */
+static volatile uint8_t *lapic_base = 0;
+
+/* Local APIC timer counts (at divide 16) per PIT tick */
+static uint32_t lapic_ticks_per_tick = 0;
+
+/* Read a local APIC register */
+static uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+/* Write a local APIC register */
+static void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(lapic_base + reg) = value;
+}
+
+/* Map the local APIC registers and enable the boot CPU's APIC */
+int lapic_init(uint32_t phys) {
+    lapic_base = (volatile uint8_t*)mmio_map(phys, PAGE_SIZE);
+    if (!lapic_base) {
+        return -1;
+    }
+
+    lapic_enable();
+    return 0;
+}
+
+/* Check whether the local APIC is in use */
+int lapic_present() {
+    return lapic_base != 0;
+}
+
+/* Enable the executing CPU's local APIC */
+void lapic_enable() {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | ISR_SPURIOUS);
+}
+
+/* Get the local APIC ID of the executing CPU */
+uint32_t lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* Signal the end of a local APIC interrupt */
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* Wait for the previous IPI to leave */
+static void lapic_wait_icr() {
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_STATUS) {
+        cpu_relax();
+    }
+}
+
+/* Send an IPI to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    lapic_wait_icr();
+}
+
+/* Send a fixed IPI to every CPU but this one */
+void lapic_broadcast_ipi(uint32_t vector) {
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, 0);
+    lapic_write(LAPIC_ICR_LOW, ICR_ALL_BUT_SELF | ICR_ASSERT | vector);
+    lapic_wait_icr();
+}
+
+/* Measure the local APIC timer against the PIT */
+void lapic_timer_calibrate() {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // Start on a tick edge and count down for a few ticks
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() == start) {
+        asm volatile("hlt");
+    }
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    start = timer_get_ticks();
+    while (timer_get_ticks() - start < CALIBRATE_TICKS) {
+        asm volatile("hlt");
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    lapic_ticks_per_tick = elapsed / CALIBRATE_TICKS;
+}
+
+/* Start the local APIC timer firing every given number of PIT ticks */
+void lapic_timer_start(uint32_t ticks) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | ISR_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_ticks_per_tick * ticks);
+}
+
+/* Fire the local APIC timer once after a number of nanoseconds */
+void lapic_timer_oneshot(uint64_t ns) {
+    uint64_t count = ns * lapic_ticks_per_tick / (1000000000 / timer_get_frequency());
+
+    // Zero would stop the timer; past deadlines fire at once
+    if (count == 0) {
+        count = 1;
+    } else if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF; // Fires early and is reprogrammed
+    }
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, ISR_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+}
+
+/* Stop the local APIC timer */
+void lapic_timer_stop() {
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
@@ -0,0 +1,64 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+/* Local APIC register offsets */
+#define LAPIC_ID            0x020
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0  // Spurious interrupt vector
+#define LAPIC_ICR_LOW       0x300  // Interrupt command
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+/* Register bits */
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV_16   0x3
+
+/* Interrupt command fields */
+#define ICR_INIT            0x500
+#define ICR_STARTUP         0x600
+#define ICR_DELIVERY_STATUS 0x1000  // Set while the IPI is being sent
+#define ICR_ASSERT          0x4000
+#define ICR_LEVEL           0x8000
+#define ICR_ALL_BUT_SELF    0xC0000
+
+/* Map the local APIC registers and enable the boot CPU's APIC */
+int lapic_init(uint32_t phys);
+
+/* Check whether the local APIC is in use */
+int lapic_present(void);
+
+/* Enable the executing CPU's local APIC */
+void lapic_enable(void);
+
+/* Get the local APIC ID of the executing CPU */
+uint32_t lapic_id(void);
+
+/* Signal the end of a local APIC interrupt */
+void lapic_eoi(void);
+
+/* Send an IPI (ICR_* command, vector in the low byte) to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+
+/* Send a fixed IPI to every CPU but this one */
+void lapic_broadcast_ipi(uint32_t vector);
+
+/* Measure the local APIC timer against the PIT (interrupts on) */
+void lapic_timer_calibrate(void);
+
+/* Start the local APIC timer firing every given number of PIT ticks */
+void lapic_timer_start(uint32_t ticks);
+
+/* Fire the local APIC timer once after a number of nanoseconds */
+void lapic_timer_oneshot(uint64_t ns);
+
+/* Stop the local APIC timer */
+void lapic_timer_stop(void);
+
+#endif /* APIC_H */
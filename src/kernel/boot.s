@@ -29,6 +29,10 @@ _start:
     # Set up the stack
     mov $stack_top, %esp
 
+    # Pass the multiboot magic and information pointer to kernel_main
+    push %ebx
+    push %eax
+
     # Call the global constructors
     call _init
 
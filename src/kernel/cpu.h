@@ -0,0 +1,88 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "gdt.h"
+#include <stdint.h>
+
+/* EFLAGS interrupt enable bit */
+#define EFLAGS_IF 0x200
+
+/* Maximum number of CPUs */
+#define MAX_CPUS 8
+
+/* Index of the executing CPU. Each CPU loads its own TSS into the task
+ * register, so the selector names the CPU; before gdt_init() it is 0. */
+static inline uint32_t cpu_id(void) {
+    uint16_t tr;
+    asm volatile("str %0" : "=r"(tr));
+    return tr >= GDT_TSS ? (uint32_t)(tr - GDT_TSS) >> 3 : 0;
+}
+
+/* Spin-wait hint */
+static inline void cpu_relax(void) {
+    asm volatile("pause" : : : "memory");
+}
+
+/* Read the time-stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Save EFLAGS and disable interrupts */
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt state saved by irq_save() */
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+/* CPUID feature bits (leaf 1, EDX) */
+#define CPUID_EDX_PSE  (1 << 3)
+#define CPUID_EDX_SEP  (1 << 11)  // SYSENTER/SYSEXIT
+#define CPUID_EDX_SSE2 (1 << 26)
+
+/* CR4 control bits */
+#define CR4_PSE        (1 << 4)
+#define CR4_OSFXSR     (1 << 9)
+
+/* Execute CPUID */
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+/* Read CR4 */
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    asm volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+/* Write CR4 */
+static inline void write_cr4(uint32_t value) {
+    asm volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* Invalidate the TLB entry for a virtual address */
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* Model-specific registers */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* Write a model-specific register */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#endif /* CPU_H */
@@ -0,0 +1,290 @@
+#include "frame.h"
+#include "memory.h"
+#include "kernel.h"
+#include "timer.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Physical frames are tracked in a hierarchy of bitmaps. Level 0 has one
+ * bit per frame (set = free). A bit at level n+1 is set when the matching
+ * level n word has any free bit. Finding a free frame is one bit scan per
+ * level, and allocation and free touch at most FRAME_LEVELS words, no
+ * matter how full memory is.
+ */
+
+/* Bitmap levels */
+static uint32_t* level_bits[FRAME_LEVELS];
+static uint32_t level_words[FRAME_LEVELS];
+
+/* Per-frame reference counts, for frames shared copy-on-write */
+static uint16_t* frame_refs;
+
+/* Frame counts */
+static uint32_t nframes = 0;
+static uint32_t free_frames = 0;
+
+/* Protects the bitmaps, counts and reference counts */
+static spinlock_t frame_lock = SPINLOCK_INIT;
+
+/* Set a frame's free bit and propagate it upwards */
+static void mark_free(uint32_t frame) {
+    for (int level = 0; level < FRAME_LEVELS; level++) {
+        uint32_t word = frame >> 5;
+        uint32_t was_empty = (level_bits[level][word] == 0);
+
+        level_bits[level][word] |= 1u << (frame & 31);
+        if (!was_empty) {
+            break; // Upper levels already know this word has free frames
+        }
+        frame = word;
+    }
+}
+
+/* Clear a frame's free bit and propagate it upwards */
+static void mark_used(uint32_t frame) {
+    for (int level = 0; level < FRAME_LEVELS; level++) {
+        uint32_t word = frame >> 5;
+
+        level_bits[level][word] &= ~(1u << (frame & 31));
+        if (level_bits[level][word] != 0) {
+            break; // Word still has free frames
+        }
+        frame = word;
+    }
+}
+
+/* Test a frame's free bit */
+static int is_free(uint32_t frame) {
+    return (level_bits[0][frame >> 5] >> (frame & 31)) & 1;
+}
+
+/* Initialize the frame allocator */
+void frame_init(uint32_t count) {
+    nframes = count;
+    free_frames = 0;
+
+    // Size each level for the frames below it
+    uint32_t entries = count;
+    for (int level = 0; level < FRAME_LEVELS; level++) {
+        level_words[level] = (entries + 31) / 32;
+        level_bits[level] = (uint32_t*)kmalloc(level_words[level] * sizeof(uint32_t));
+        for (uint32_t i = 0; i < level_words[level]; i++) {
+            level_bits[level][i] = 0;
+        }
+        entries = level_words[level];
+    }
+
+    frame_refs = (uint16_t*)kmalloc(count * sizeof(uint16_t));
+    for (uint32_t i = 0; i < count; i++) {
+        frame_refs[i] = 0;
+    }
+}
+
+/* Mark a physical address range as free */
+void frame_free_range(uint32_t start, uint32_t end) {
+    uint32_t first = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t last = end / PAGE_SIZE;
+
+    if (last > nframes) {
+        last = nframes;
+    }
+
+    for (uint32_t frame = first; frame < last; frame++) {
+        if (!is_free(frame)) {
+            mark_free(frame);
+            free_frames++;
+        }
+    }
+}
+
+/* Mark a physical address range as reserved */
+void frame_reserve_range(uint32_t start, uint32_t end) {
+    uint32_t first = start / PAGE_SIZE;
+    uint32_t last = (end + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if (last > nframes) {
+        last = nframes;
+    }
+
+    for (uint32_t frame = first; frame < last; frame++) {
+        if (is_free(frame)) {
+            mark_used(frame);
+            free_frames--;
+        }
+    }
+}
+
+/* Allocate the lowest free frame */
+uint32_t frame_alloc() {
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+
+    if (free_frames == 0) {
+        spin_unlock_irqrestore(&frame_lock, flags);
+        return FRAME_NONE;
+    }
+
+    // Walk down from the single top-level word
+    uint32_t idx = 0;
+    for (int level = FRAME_LEVELS - 1; level >= 0; level--) {
+        idx = (idx << 5) | __builtin_ctz(level_bits[level][idx]);
+    }
+
+    mark_used(idx);
+    frame_refs[idx] = 1;
+    free_frames--;
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return idx;
+}
+
+/* Drop a reference to a frame, freeing it when none are left */
+void frame_free(uint32_t frame) {
+    if (frame >= nframes) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+
+    if (is_free(frame)) {
+        terminal_writestring("frame_free: double free of frame ");
+        terminal_writehex(frame);
+        terminal_writestring("\n");
+    } else if (frame_refs[frame] == 0) {
+        // Reserved at boot (kernel image, modules): never returned to the pool
+    } else if (frame_refs[frame] > 1) {
+        frame_refs[frame]--;
+    } else {
+        frame_refs[frame] = 0;
+        mark_free(frame);
+        free_frames++;
+    }
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+/* Take another reference to an allocated frame */
+void frame_ref(uint32_t frame) {
+    if (frame >= nframes) {
+        return;
+    }
+
+    // Reserved frames carry no count; mapping them takes no reference
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    if (frame_refs[frame]) {
+        frame_refs[frame]++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+/* Get the number of references to a frame */
+uint32_t frame_refcount(uint32_t frame) {
+    return frame < nframes ? frame_refs[frame] : 0;
+}
+
+/* Check whether a frame is in use */
+int frame_is_used(uint32_t frame) {
+    return frame >= nframes || !is_free(frame);
+}
+
+/* Get the number of managed frames */
+uint32_t frame_count_total() {
+    return nframes;
+}
+
+/* Get the number of free frames */
+uint32_t frame_count_free() {
+    return free_frames;
+}
+
+/* Pairs timed with the reference linear scan */
+#define LINEAR_BENCH_PAIRS 10000
+
+/* Reference: the old first-fit scan over the level 0 bitmap */
+static uint32_t linear_first_free() {
+    for (uint32_t i = 0; i < level_words[0]; i++) {
+        if (level_bits[0][i] != 0) {
+            for (uint32_t j = 0; j < 32; j++) {
+                if (level_bits[0][i] & (1u << j)) {
+                    return i * 32 + j;
+                }
+            }
+        }
+    }
+    return FRAME_NONE;
+}
+
+/* Time alloc/free pairs at one occupancy level */
+static void bench_occupancy(uint32_t percent, uint32_t pairs, uint32_t* held, uint32_t* nheld) {
+    uint32_t target = (nframes * percent) / 100;
+
+    // Fill memory up to the target occupancy
+    while (nframes - free_frames < target) {
+        uint32_t frame = frame_alloc();
+        if (frame == FRAME_NONE) {
+            break;
+        }
+        held[(*nheld)++] = frame;
+    }
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < pairs; i++) {
+        frame_free(frame_alloc());
+    }
+    uint32_t fast = (uint32_t)((rdtsc() - start) / pairs);
+
+    // The reference scan is slow, so it gets a smaller sample
+    uint32_t linear_pairs = pairs < LINEAR_BENCH_PAIRS ? pairs : LINEAR_BENCH_PAIRS;
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    start = rdtsc();
+    for (uint32_t i = 0; i < linear_pairs; i++) {
+        uint32_t frame = linear_first_free();
+        if (frame == FRAME_NONE) {
+            break;
+        }
+        mark_used(frame);
+        mark_free(frame);
+    }
+    uint32_t linear = (uint32_t)((rdtsc() - start) / linear_pairs);
+    spin_unlock_irqrestore(&frame_lock, flags);
+
+    terminal_writestring("  ");
+    terminal_writedec(percent);
+    terminal_writestring("% used: ");
+    terminal_writedec(fast);
+    terminal_writestring(" cycles/pair (linear scan: ");
+    terminal_writedec(linear);
+    terminal_writestring(")\n");
+}
+
+/* Time alloc/free pairs at several occupancy levels */
+void frame_benchmark(uint32_t pairs) {
+    if (pairs == 0) {
+        return;
+    }
+
+    uint32_t nheld = 0;
+    uint32_t* held = (uint32_t*)kmalloc(nframes * sizeof(uint32_t));
+    if (!held) {
+        terminal_writestring("frames: out of memory\n");
+        return;
+    }
+
+    terminal_writestring("frames: ");
+    terminal_writedec(pairs);
+    terminal_writestring(" alloc/free pairs, ");
+    terminal_writedec(nframes);
+    terminal_writestring(" frames\n");
+
+    bench_occupancy(10, pairs, held, &nheld);
+    bench_occupancy(50, pairs, held, &nheld);
+    bench_occupancy(95, pairs, held, &nheld);
+
+    // Give back everything the fill phase took
+    while (nheld) {
+        frame_free(held[--nheld]);
+    }
+    kfree(held);
+}
@@ -0,0 +1,44 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/* Returned by frame_alloc() when physical memory is exhausted */
+#define FRAME_NONE 0xFFFFFFFF
+
+/* Summary levels: 32^4 frames covers the full 4GB physical space */
+#define FRAME_LEVELS 4
+
+/* Initialize the frame allocator; all frames start out reserved */
+void frame_init(uint32_t nframes);
+
+/* Mark a physical address range as free */
+void frame_free_range(uint32_t start, uint32_t end);
+
+/* Mark a physical address range as reserved */
+void frame_reserve_range(uint32_t start, uint32_t end);
+
+/* Allocate the lowest free frame, or FRAME_NONE */
+uint32_t frame_alloc(void);
+
+/* Drop a reference to a frame, freeing it when none are left.
+ * Frames reserved at boot have no count and are never freed. */
+void frame_free(uint32_t frame);
+
+/* Take another reference to an allocated frame (for shared mappings) */
+void frame_ref(uint32_t frame);
+
+/* Get the number of references to a frame */
+uint32_t frame_refcount(uint32_t frame);
+
+/* Check whether a frame is in use */
+int frame_is_used(uint32_t frame);
+
+/* Get the number of managed and free frames */
+uint32_t frame_count_total(void);
+uint32_t frame_count_free(void);
+
+/* Time alloc/free pairs at several occupancy levels */
+void frame_benchmark(uint32_t pairs);
+
+#endif /* FRAME_H */
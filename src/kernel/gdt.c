@@ -0,0 +1,89 @@
+#include "gdt.h"
+#include "cpu.h"
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* GDT entry */
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t  base_middle;
+    uint8_t  access;
+    uint8_t  granularity;  // Limit bits 16-19 and flags
+    uint8_t  base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+/* GDT pointer */
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_ptr_t;
+
+/* Null, kernel code/data, user code/data, then one TSS per CPU */
+#define GDT_ENTRIES (GDT_TSS / 8 + MAX_CPUS)
+
+static gdt_entry_t gdt_entries[GDT_ENTRIES];
+static gdt_ptr_t gdt_ptr;
+static tss_t tss[MAX_CPUS];
+
+/* Set an entry in the GDT */
+static void gdt_set_gate(uint32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt_entries[num].base_low = base & 0xFFFF;
+    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
+    gdt_entries[num].base_high = (base >> 24) & 0xFF;
+    gdt_entries[num].limit_low = limit & 0xFFFF;
+    gdt_entries[num].granularity = ((limit >> 16) & 0x0F) | (flags & 0xF0);
+    gdt_entries[num].access = access;
+}
+
+/* Build the GDT and per-CPU TSSs, and load them on the boot CPU */
+void gdt_init() {
+    gdt_ptr.limit = sizeof(gdt_entries) - 1;
+    gdt_ptr.base = (uint32_t)&gdt_entries;
+
+    // Flat 4GB segments, 4KB granularity, 32-bit
+    gdt_set_gate(0, 0, 0, 0, 0);
+    gdt_set_gate(GDT_KERNEL_CODE / 8, 0, 0xFFFFF, 0x9A, 0xC0);
+    gdt_set_gate(GDT_KERNEL_DATA / 8, 0, 0xFFFFF, 0x92, 0xC0);
+    gdt_set_gate(GDT_USER_CODE / 8, 0, 0xFFFFF, 0xFA, 0xC0);
+    gdt_set_gate(GDT_USER_DATA / 8, 0, 0xFFFFF, 0xF2, 0xC0);
+
+    // Available 32-bit TSS per CPU; no I/O permission bitmap
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        memset(&tss[i], 0, sizeof(tss_t));
+        tss[i].ss0 = GDT_KERNEL_DATA;
+        tss[i].iomap_base = sizeof(tss_t);
+        gdt_set_gate(GDT_TSS / 8 + i, (uint32_t)&tss[i], sizeof(tss_t) - 1, 0x89, 0x00);
+    }
+
+    gdt_load(0);
+}
+
+/* Load the GDT and the TSS of a CPU on that CPU */
+void gdt_load(uint32_t cpu) {
+    // Reload every segment register, CS through a far jump
+    asm volatile("lgdt %0\n"
+                 "ljmp %1, $1f\n"
+                 "1:\n"
+                 "mov %w2, %%ds\n"
+                 "mov %w2, %%es\n"
+                 "mov %w2, %%fs\n"
+                 "mov %w2, %%gs\n"
+                 "mov %w2, %%ss\n"
+                 : : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA) : "memory");
+
+    // The task register also identifies the CPU (see cpu_id())
+    asm volatile("ltr %w0" : : "r"(GDT_TSS + cpu * 8));
+}
+
+/* Set the kernel stack used on entry from user mode on this CPU */
+void tss_set_kernel_stack(uint32_t esp0) {
+    tss[cpu_id()].esp0 = esp0;
+}
+
+/* Get the address of a CPU's TSS esp0 field */
+uint32_t tss_kernel_stack_slot(uint32_t cpu) {
+    return (uint32_t)&tss[cpu] + offsetof(tss_t, esp0);
+}
@@ -0,0 +1,40 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+/* Segment selectors */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18  // Loaded with RPL 3
+#define GDT_USER_DATA   0x20  // Loaded with RPL 3
+#define GDT_TSS         0x28  // First per-CPU TSS; CPU n uses GDT_TSS + 8n
+
+/* Task state segment; only the ring 0 stack fields are used */
+typedef struct tss {
+    uint32_t prev_tss;
+    uint32_t esp0;        // Kernel stack loaded on entry from ring 3
+    uint32_t ss0;         // Kernel stack segment
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* Build the GDT and per-CPU TSSs, and load them on the boot CPU */
+void gdt_init(void);
+
+/* Load the GDT and the TSS of a CPU on that CPU */
+void gdt_load(uint32_t cpu);
+
+/* Set the kernel stack used on entry from user mode on this CPU */
+void tss_set_kernel_stack(uint32_t esp0);
+
+/* Get the address of a CPU's TSS esp0 field (SYSENTER finds the kernel
+ * stack through it) */
+uint32_t tss_kernel_stack_slot(uint32_t cpu);
+
+#endif /* GDT_H */
@@ -0,0 +1,581 @@
+#include "heap.h"
+#include "memory.h"
+#include "kernel.h"
+#include "timer.h"
+#include "cpu.h"
+#include "frame.h"
+#include "zpool.h"
+#include "smp.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * The heap manages the KHEAP_START virtual window in two layers:
+ *
+ *  - Virtual extents of 2^order pages are handed out by a buddy allocator.
+ *    Frames are only mapped for pages that are actually used, so rounding
+ *    a large request up to a power of two costs address space, not RAM.
+ *  - Small requests (up to HEAP_MAX_SMALL) come from per-size-class slabs
+ *    carved out of those extents. Alloc and free are a list pop/push.
+ */
+
+/* Per-page descriptor values */
+#define HEAP_PAGE_FREE       0x20  // Head of a free extent (low bits: order)
+#define HEAP_PAGE_SLAB       0x40  // Page of a slab (low bits: slab order)
+#define HEAP_PAGE_LARGE      0x80  // Head of a large allocation (low bits: order)
+#define HEAP_PAGE_ORDER_MASK 0x1F
+
+/* Null link for the extent lists */
+#define EXTENT_NONE 0xFFFF
+
+/* Slab header, stored at the start of each slab */
+typedef struct slab {
+    struct slab* next;     // Next slab on the partial list
+    struct slab* prev;     // Previous slab on the partial list
+    void* free_list;       // Free objects in this slab
+    uint16_t inuse;        // Objects handed out
+    uint16_t capacity;     // Objects in this slab
+    uint8_t class_idx;     // Size class of this slab
+} slab_t;
+
+/* Objects start after the slab header */
+#define SLAB_HEADER_SIZE 32
+
+/* Size class cache */
+typedef struct {
+    uint32_t object_size;  // Object size in bytes
+    uint32_t slab_order;   // Slab size is 2^slab_order pages
+    slab_t* partial;       // Slabs with at least one free object
+    slab_t* empty;         // A single cached empty slab
+} size_class_t;
+
+/* Heap state */
+static size_class_t classes[HEAP_NUM_CLASSES];
+static uint8_t* page_desc;                        // One descriptor per heap page
+static uint16_t* extent_next;                     // Free extent list links
+static uint16_t* extent_prev;
+static uint16_t free_extents[HEAP_MAX_ORDER + 1]; // Free extent list heads
+static heap_stats_t stats;
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+/* An unmapped extent that must not be reused until other CPUs have
+ * dropped their cached translations of it */
+typedef struct {
+    uint32_t idx;
+    uint32_t order;
+} stale_extent_t;
+
+/* Convert between heap page indices and addresses */
+#define PAGE_TO_ADDR(idx) (KHEAP_START + ((uint32_t)(idx) << 12))
+#define ADDR_TO_PAGE(addr) (((uint32_t)(addr) - KHEAP_START) >> 12)
+
+/* Insert a free extent into its order list */
+static void extent_insert(uint32_t idx, uint32_t order) {
+    page_desc[idx] = HEAP_PAGE_FREE | order;
+    extent_prev[idx] = EXTENT_NONE;
+    extent_next[idx] = free_extents[order];
+    if (free_extents[order] != EXTENT_NONE) {
+        extent_prev[free_extents[order]] = idx;
+    }
+    free_extents[order] = idx;
+}
+
+/* Remove a free extent from its order list */
+static void extent_remove(uint32_t idx, uint32_t order) {
+    if (extent_prev[idx] != EXTENT_NONE) {
+        extent_next[extent_prev[idx]] = extent_next[idx];
+    } else {
+        free_extents[order] = extent_next[idx];
+    }
+    if (extent_next[idx] != EXTENT_NONE) {
+        extent_prev[extent_next[idx]] = extent_prev[idx];
+    }
+    page_desc[idx] = 0;
+}
+
+/* Allocate a virtual extent of 2^order pages */
+static uint32_t extent_alloc(uint32_t order) {
+    uint32_t k = order;
+
+    // Find the smallest free extent that fits
+    while (k <= HEAP_MAX_ORDER && free_extents[k] == EXTENT_NONE) {
+        k++;
+    }
+    if (k > HEAP_MAX_ORDER) {
+        return EXTENT_NONE; // Heap address space exhausted
+    }
+
+    uint32_t idx = free_extents[k];
+    extent_remove(idx, k);
+
+    // Split it down, returning the upper halves to the free lists
+    while (k > order) {
+        k--;
+        extent_insert(idx + (1 << k), k);
+    }
+
+    return idx;
+}
+
+/* Return a virtual extent, merging it with free buddies */
+static void extent_free(uint32_t idx, uint32_t order) {
+    while (order < HEAP_MAX_ORDER) {
+        uint32_t buddy = idx ^ (1 << order);
+        if (buddy >= KHEAP_PAGES || page_desc[buddy] != (HEAP_PAGE_FREE | order)) {
+            break;
+        }
+        extent_remove(buddy, order);
+        idx &= ~(1 << order);
+        order++;
+    }
+
+    extent_insert(idx, order);
+}
+
+/* Back the first npages of an extent with frames, optionally pre-zeroed */
+static void extent_map(uint32_t idx, uint32_t npages, int zero) {
+    page_directory_t* dir = paging_kernel_directory();
+
+    for (uint32_t i = 0; i < npages; i++) {
+        page_t* page = get_page(PAGE_TO_ADDR(idx + i), 0, dir);
+        if (zero) {
+            uint32_t frame = alloc_zeroed_frame();
+            if (frame == FRAME_NONE) {
+                terminal_writestring("PANIC: No free frames!\n");
+                for(;;);
+            }
+            map_frame(page, frame, 1, 1);
+        } else {
+            alloc_frame(page, 1, 1);
+        }
+    }
+    stats.pages_mapped += npages;
+}
+
+/* Release every mapped page of an extent, returning the count */
+static uint32_t extent_unmap(uint32_t idx, uint32_t order) {
+    page_directory_t* dir = paging_kernel_directory();
+    uint32_t released = 0;
+
+    for (uint32_t i = 0; i < (1u << order); i++) {
+        uint32_t addr = PAGE_TO_ADDR(idx + i);
+        page_t* page = get_page(addr, 0, dir);
+        if (!page->present) {
+            break; // Extents are mapped from the front
+        }
+        free_frame(page);
+        invlpg(addr);
+        released++;
+    }
+    stats.pages_mapped -= released;
+
+    return released;
+}
+
+/* Find the size class for a request */
+static uint32_t size_to_class(size_t size) {
+    if (size <= (1 << HEAP_MIN_SHIFT)) {
+        return 0;
+    }
+    return (32 - __builtin_clz(size - 1)) - HEAP_MIN_SHIFT;
+}
+
+/* Find the extent order for a number of pages */
+static uint32_t pages_to_order(uint32_t npages) {
+    if (npages <= 1) {
+        return 0;
+    }
+    return 32 - __builtin_clz(npages - 1);
+}
+
+/* Create a new slab for a size class */
+static slab_t* slab_create(uint32_t class_idx) {
+    size_class_t* cls = &classes[class_idx];
+    uint32_t npages = 1 << cls->slab_order;
+
+    uint32_t idx = extent_alloc(cls->slab_order);
+    if (idx == EXTENT_NONE) {
+        return NULL;
+    }
+    extent_map(idx, npages, 0);
+    for (uint32_t i = 0; i < npages; i++) {
+        page_desc[idx + i] = HEAP_PAGE_SLAB | cls->slab_order;
+    }
+    stats.slab_pages += npages;
+
+    // Thread all objects onto the free list
+    slab_t* slab = (slab_t*)PAGE_TO_ADDR(idx);
+    uint32_t slab_bytes = npages * PAGE_SIZE;
+    slab->capacity = (slab_bytes - SLAB_HEADER_SIZE) / cls->object_size;
+    slab->inuse = 0;
+    slab->class_idx = class_idx;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->free_list = NULL;
+
+    uint8_t* obj = (uint8_t*)slab + SLAB_HEADER_SIZE + (slab->capacity - 1) * cls->object_size;
+    for (uint32_t i = 0; i < slab->capacity; i++) {
+        *(void**)obj = slab->free_list;
+        slab->free_list = obj;
+        obj -= cls->object_size;
+    }
+
+    return slab;
+}
+
+/* Give a slab's pages back to the system; the extent is left stale */
+static void slab_destroy(slab_t* slab, stale_extent_t* stale) {
+    size_class_t* cls = &classes[slab->class_idx];
+    uint32_t idx = ADDR_TO_PAGE(slab);
+
+    stats.slab_pages -= extent_unmap(idx, cls->slab_order);
+    for (uint32_t i = 1; i < (1u << cls->slab_order); i++) {
+        page_desc[idx + i] = 0;
+    }
+    stale->idx = idx;
+    stale->order = cls->slab_order;
+}
+
+/* Push a slab onto the partial list of its class */
+static void slab_list_push(size_class_t* cls, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
+}
+
+/* Unlink a slab from the partial list of its class */
+static void slab_list_remove(size_class_t* cls, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/* Allocate a small object */
+static void* slab_alloc(uint32_t class_idx) {
+    size_class_t* cls = &classes[class_idx];
+    slab_t* slab = cls->partial;
+
+    if (!slab) {
+        // Reuse the cached empty slab before asking for new pages
+        if (cls->empty) {
+            slab = cls->empty;
+            cls->empty = NULL;
+        } else {
+            slab = slab_create(class_idx);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        slab_list_push(cls, slab);
+    }
+
+    void* obj = slab->free_list;
+    slab->free_list = *(void**)obj;
+    slab->inuse++;
+
+    // A full slab leaves the partial list until something is freed
+    if (!slab->free_list) {
+        slab_list_remove(cls, slab);
+    }
+
+    stats.bytes_in_use += cls->object_size;
+    return obj;
+}
+
+/* Free a small object */
+static void slab_free(void* ptr, uint32_t slab_order, stale_extent_t* stale) {
+    slab_t* slab = (slab_t*)((uint32_t)ptr & ~((PAGE_SIZE << slab_order) - 1));
+    size_class_t* cls = &classes[slab->class_idx];
+    int was_full = (slab->free_list == NULL);
+
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->inuse--;
+    stats.bytes_in_use -= cls->object_size;
+
+    if (slab->inuse == 0) {
+        // Keep one empty slab per class to absorb alloc/free churn
+        if (!was_full) {
+            slab_list_remove(cls, slab);
+        }
+        if (!cls->empty) {
+            cls->empty = slab;
+        } else {
+            slab_destroy(slab, stale);
+        }
+    } else if (was_full) {
+        slab_list_push(cls, slab);
+    }
+}
+
+/* Allocate a page-backed block */
+static void* large_alloc(size_t size, int zero) {
+    uint32_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t order = pages_to_order(npages);
+
+    if (order > HEAP_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint32_t idx = extent_alloc(order);
+    if (idx == EXTENT_NONE) {
+        return NULL;
+    }
+
+    extent_map(idx, npages, zero);
+    page_desc[idx] = HEAP_PAGE_LARGE | order;
+    stats.large_pages += npages;
+    stats.bytes_in_use += npages * PAGE_SIZE;
+
+    return (void*)PAGE_TO_ADDR(idx);
+}
+
+/* Free a page-backed block; the extent is left stale */
+static void large_free(void* ptr, uint32_t order, stale_extent_t* stale) {
+    uint32_t idx = ADDR_TO_PAGE(ptr);
+    uint32_t released = extent_unmap(idx, order);
+
+    stats.large_pages -= released;
+    stats.bytes_in_use -= released * PAGE_SIZE;
+    stale->idx = idx;
+    stale->order = order;
+}
+
+/* Initialize the kernel heap */
+void heap_init() {
+    terminal_writestring("Initializing kernel heap...\n");
+
+    page_directory_t* dir = paging_kernel_directory();
+
+    // Create every heap page table up front so that growing the heap
+    // never needs to allocate from the heap itself
+    for (uint32_t addr = KHEAP_START; addr < KHEAP_START + KHEAP_SIZE; addr += 1024 * PAGE_SIZE) {
+        get_page(addr, 1, dir);
+    }
+
+    // Descriptor and link arrays come from the early allocator
+    page_desc = (uint8_t*)kmalloc(KHEAP_PAGES);
+    extent_next = (uint16_t*)kmalloc(KHEAP_PAGES * sizeof(uint16_t));
+    extent_prev = (uint16_t*)kmalloc(KHEAP_PAGES * sizeof(uint16_t));
+    for (uint32_t i = 0; i < KHEAP_PAGES; i++) {
+        page_desc[i] = 0;
+    }
+
+    // The whole window starts out as maximum-order free extents
+    for (uint32_t order = 0; order <= HEAP_MAX_ORDER; order++) {
+        free_extents[order] = EXTENT_NONE;
+    }
+    for (uint32_t idx = 0; idx < KHEAP_PAGES; idx += (1 << HEAP_MAX_ORDER)) {
+        extent_insert(idx, HEAP_MAX_ORDER);
+    }
+
+    // Set up the size classes; bigger objects get multi-page slabs
+    for (uint32_t i = 0; i < HEAP_NUM_CLASSES; i++) {
+        classes[i].object_size = 1 << (HEAP_MIN_SHIFT + i);
+        if (classes[i].object_size >= 1024) {
+            classes[i].slab_order = 2;
+        } else if (classes[i].object_size >= 512) {
+            classes[i].slab_order = 1;
+        } else {
+            classes[i].slab_order = 0;
+        }
+        classes[i].partial = NULL;
+        classes[i].empty = NULL;
+    }
+
+    stats.pages_mapped = 0;
+    stats.slab_pages = 0;
+    stats.large_pages = 0;
+    stats.bytes_in_use = 0;
+    stats.alloc_count = 0;
+    stats.free_count = 0;
+
+    terminal_writestring("Kernel heap initialized\n");
+}
+
+/* Allocate memory from the heap */
+void* heap_alloc(size_t size, int flags) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    uint32_t irq_flags = spin_lock_irqsave(&heap_lock);
+    void* ptr;
+
+    // Page-aligned requests always take the page-backed path; its fresh
+    // frames come pre-zeroed from the pool when HEAP_ZERO is asked for
+    if (size <= HEAP_MAX_SMALL && !(flags & HEAP_ALIGN)) {
+        ptr = slab_alloc(size_to_class(size));
+        if (ptr && (flags & HEAP_ZERO)) {
+            memset(ptr, 0, size);
+        }
+    } else {
+        ptr = large_alloc(size, flags & HEAP_ZERO);
+    }
+
+    if (ptr) {
+        stats.alloc_count++;
+    }
+
+    spin_unlock_irqrestore(&heap_lock, irq_flags);
+    return ptr;
+}
+
+/* Free memory back to the heap */
+void heap_free(void* ptr) {
+    if (!heap_contains(ptr)) {
+        return;
+    }
+
+    stale_extent_t stale = { EXTENT_NONE, 0 };
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    uint8_t desc = page_desc[ADDR_TO_PAGE(ptr)];
+
+    if (desc & HEAP_PAGE_SLAB) {
+        slab_free(ptr, desc & HEAP_PAGE_ORDER_MASK, &stale);
+        stats.free_count++;
+    } else if ((desc & HEAP_PAGE_LARGE) && ((uint32_t)ptr & (PAGE_SIZE - 1)) == 0) {
+        large_free(ptr, desc & HEAP_PAGE_ORDER_MASK, &stale);
+        stats.free_count++;
+    } else {
+        terminal_writestring("kfree: invalid pointer ");
+        terminal_writehex((uint32_t)ptr);
+        terminal_writestring("\n");
+    }
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    // Unmapped pages may still be cached in other CPUs' TLBs; the
+    // shootdown waits on them, so it runs without the heap lock
+    if (stale.idx != EXTENT_NONE) {
+        smp_flush_tlb();
+        flags = spin_lock_irqsave(&heap_lock);
+        extent_free(stale.idx, stale.order);
+        spin_unlock_irqrestore(&heap_lock, flags);
+    }
+}
+
+/* Check whether a pointer belongs to the heap */
+int heap_contains(void* ptr) {
+    uint32_t addr = (uint32_t)ptr;
+    return addr >= KHEAP_START && addr < KHEAP_START + KHEAP_SIZE;
+}
+
+/* Get heap statistics */
+void heap_get_stats(heap_stats_t* out) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+/* Number of live slots used by the benchmark */
+#define BENCH_SLOTS 4096
+
+/* Pick a benchmark object size: mostly small, some page-backed */
+static uint32_t bench_size(uint32_t r) {
+    if ((r & 0xF) == 0) {
+        return PAGE_SIZE + (r >> 4) % (15 * PAGE_SIZE); // 4KB..64KB
+    }
+    return 8 + (r >> 4) % HEAP_MAX_SMALL;               // 8B..2KB
+}
+
+/* Print fragmentation as a percentage of committed heap memory */
+static void bench_print_frag(const char* label, uint32_t live_bytes) {
+    heap_stats_t s;
+    heap_get_stats(&s);
+
+    uint32_t committed = s.pages_mapped * PAGE_SIZE;
+    uint32_t frag = committed ? 100 - (uint32_t)(((uint64_t)live_bytes * 100) / committed) : 0;
+
+    terminal_writestring(label);
+    terminal_writedec(live_bytes / 1024);
+    terminal_writestring("KB live, ");
+    terminal_writedec(committed / 1024);
+    terminal_writestring("KB committed, ");
+    terminal_writedec(frag);
+    terminal_writestring("% fragmentation\n");
+}
+
+/* Allocate and free mixed-size objects, report throughput and fragmentation */
+void heap_benchmark(uint32_t operations) {
+    static void* slots[BENCH_SLOTS];
+    static uint32_t sizes[BENCH_SLOTS];
+    uint32_t seed = 0x12345678;
+    uint32_t live_bytes = 0;
+    uint32_t failures = 0;
+
+    if (operations == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < BENCH_SLOTS; i++) {
+        slots[i] = NULL;
+    }
+
+    terminal_writestring("heap: ");
+    terminal_writedec(operations);
+    terminal_writestring(" mixed-size operations\n");
+
+    uint32_t start_tick = timer_get_ticks();
+    uint64_t start_tsc = rdtsc();
+
+    for (uint32_t op = 0; op < operations; op++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t slot = (seed >> 8) % BENCH_SLOTS;
+
+        if (slots[slot]) {
+            kfree(slots[slot]);
+            live_bytes -= sizes[slot];
+            slots[slot] = NULL;
+        } else {
+            seed = seed * 1103515245 + 12345;
+            sizes[slot] = bench_size(seed >> 4);
+            slots[slot] = kmalloc(sizes[slot]);
+            if (slots[slot]) {
+                live_bytes += sizes[slot];
+            } else {
+                failures++;
+            }
+        }
+    }
+
+    uint64_t cycles = rdtsc() - start_tsc;
+    uint32_t ticks = timer_get_ticks() - start_tick;
+
+    terminal_writestring("  ");
+    terminal_writedec((uint32_t)(cycles / operations));
+    terminal_writestring(" cycles/op");
+    if (ticks) {
+        terminal_writestring(", ");
+        terminal_writedec((uint32_t)(((uint64_t)operations * timer_get_frequency()) / ticks));
+        terminal_writestring(" ops/sec");
+    }
+    terminal_writestring("\n");
+    if (failures) {
+        terminal_writestring("  allocation failures: ");
+        terminal_writedec(failures);
+        terminal_writestring("\n");
+    }
+    bench_print_frag("  steady state: ", live_bytes);
+
+    // Tear down and check that the heap gives memory back
+    for (uint32_t i = 0; i < BENCH_SLOTS; i++) {
+        if (slots[i]) {
+            kfree(slots[i]);
+            slots[i] = NULL;
+        }
+    }
+    bench_print_frag("  after teardown: ", 0);
+}
@@ -0,0 +1,53 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "memory.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel heap virtual address range */
+#define KHEAP_START       0xD0000000
+#define KHEAP_SIZE        0x08000000  // 128MB of virtual space
+#define KHEAP_PAGES       (KHEAP_SIZE / PAGE_SIZE)
+
+/* Slab size classes: 16, 32, ... 2048 bytes */
+#define HEAP_MIN_SHIFT    4
+#define HEAP_NUM_CLASSES  8
+#define HEAP_MAX_SMALL    (1 << (HEAP_MIN_SHIFT + HEAP_NUM_CLASSES - 1))
+
+/* heap_alloc() flags */
+#define HEAP_ALIGN        0x1  // Page-aligned block
+#define HEAP_ZERO         0x2  // Zero-filled block
+
+/* Largest virtual extent is 2^HEAP_MAX_ORDER pages (64MB) */
+#define HEAP_MAX_ORDER    14
+
+/* Heap statistics */
+typedef struct {
+    uint32_t pages_mapped;     // Frames currently backing the heap
+    uint32_t slab_pages;       // Pages owned by slab caches
+    uint32_t large_pages;      // Pages owned by large allocations
+    uint32_t bytes_in_use;     // Usable bytes currently handed out
+    uint32_t alloc_count;      // Total successful allocations
+    uint32_t free_count;       // Total frees
+} heap_stats_t;
+
+/* Initialize the kernel heap (called from memory_init) */
+void heap_init(void);
+
+/* Allocate memory with HEAP_* flags */
+void* heap_alloc(size_t size, int flags);
+
+/* Free memory returned by heap_alloc */
+void heap_free(void* ptr);
+
+/* Check whether a pointer belongs to the heap */
+int heap_contains(void* ptr);
+
+/* Get heap statistics */
+void heap_get_stats(heap_stats_t* stats);
+
+/* Allocate and free mixed-size objects, report throughput and fragmentation */
+void heap_benchmark(uint32_t operations);
+
+#endif /* HEAP_H */
@@ -1,6 +1,14 @@
 #include "interrupt.h"
 #include "kernel.h"
+#include "softirq.h"
+#include "acpi.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "cpu.h"
 #include <stdint.h>
+#include <stddef.h>
 
 /* IDT entries and pointer */
 static idt_entry_t idt_entries[256];
@@ -9,6 +17,25 @@ static idt_ptr_t idt_ptr;
 /* Interrupt handlers array */
 static isr_t interrupt_handlers[256];
 
+/* Interrupts taken per CPU and vector */
+static uint32_t interrupt_counts[MAX_CPUS][256];
+
+/* ISA lines with interrupts wanted (bit n for IRQ n) and the CPU each is
+ * delivered to once the I/O APIC routes them */
+static uint16_t irq_enabled = 0;
+static uint8_t irq_cpu[ISA_IRQS];
+static int irq_ioapic = 0;
+static spinlock_t irq_lock = SPINLOCK_INIT;
+
+/* MSI vectors handed out (bit n for MSI_VECTOR_BASE + n) */
+static uint32_t msi_used = 0;
+
+/* What raises each ISA line */
+static const char *irq_names[ISA_IRQS] = {
+    "timer", "keyboard", "cascade", "serial 2", "serial 1", "parallel 2", "floppy", "parallel 1",
+    "rtc", "irq 9", "irq 10", "irq 11", "mouse", "fpu", "ata 0", "ata 1"
+};
+
 /* Set an entry in the IDT */
 static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags) {
     idt_entries[num].base_lo = base & 0xFFFF;
@@ -18,15 +45,58 @@ static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags
     idt_entries[num].flags = flags;
 }
 
+/* Write the PIC masks: the wanted lines while the PIC delivers them (the
+ * slave's need the cascade line too), none once the I/O APIC does */
+static void pic_update() {
+    uint16_t mask = 0xFFFF;
+    
+    if (!irq_ioapic) {
+        mask = ~irq_enabled;
+        if (irq_enabled & 0xFF00) {
+            mask &= ~(1 << 2);
+        }
+    }
+    
+    outb(0x21, mask & 0xFF);
+    outb(0xA1, mask >> 8);
+}
+
+/* Whether the MADT overrides an ISA line to level triggering */
+static int irq_level(uint32_t irq) {
+    return (acpi_get_madt()->isa_flags[irq] & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL;
+}
+
+/* I/O APIC redirection flags for an ISA line, from its MADT override */
+static uint32_t irq_ioapic_flags(uint32_t irq) {
+    uint16_t flags = acpi_get_madt()->isa_flags[irq];
+    uint32_t result = 0;
+    
+    if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) {
+        result |= IOAPIC_ACTIVE_LOW;
+    }
+    if (irq_level(irq)) {
+        result |= IOAPIC_LEVEL;
+    }
+    if (!(irq_enabled & (1u << irq))) {
+        result |= IOAPIC_MASKED;
+    }
+    return result;
+}
+
+/* Point an ISA line's I/O APIC entry at its vector and CPU */
+static int irq_route(uint32_t irq) {
+    return ioapic_route(acpi_get_madt()->isa_gsi[irq], IRQ0 + irq, smp_apic_id(irq_cpu[irq]), irq_ioapic_flags(irq));
+}
+
 /* Initialize the IDT */
 static void idt_init() {
     idt_ptr.limit = sizeof(idt_entry_t) * 256 - 1;
     idt_ptr.base = (uint32_t)&idt_entries;
     
-    // Clear the IDT
+    // Clear the IDT; handlers registered earlier in boot (such as the
+    // page fault handler from paging_init) are kept
     for (int i = 0; i < 256; i++) {
         idt_set_gate(i, 0, 0, 0);
-        interrupt_handlers[i] = 0;
     }
     
     // Set up ISR handlers
@@ -63,6 +133,15 @@ static void idt_init() {
     idt_set_gate(30, (uint32_t)isr30, 0x08, 0x8E);
     idt_set_gate(31, (uint32_t)isr31, 0x08, 0x8E);
     
+    // System call gate, callable from ring 3
+    idt_set_gate(ISR_SYSCALL, (uint32_t)isr128, 0x08, 0xEE);
+    
+    // Local APIC vectors
+    idt_set_gate(ISR_LAPIC_TIMER, (uint32_t)isr64, 0x08, 0x8E);
+    idt_set_gate(ISR_IPI_TLB, (uint32_t)isr65, 0x08, 0x8E);
+    idt_set_gate(ISR_IPI_RESCHED, (uint32_t)isr66, 0x08, 0x8E);
+    idt_set_gate(ISR_SPURIOUS, (uint32_t)isr255, 0x08, 0x8E);
+    
     // Remap the PIC
     // Initialize master PIC
     outb(0x20, 0x11);  // Start initialization sequence (ICW1)
@@ -77,8 +156,8 @@ static void idt_init() {
     outb(0x21, 0x01);  // ICW4: 8086/88 mode
     outb(0xA1, 0x01);  // ICW4: 8086/88 mode
     
-    outb(0x21, 0x0);   // Enable all IRQs on master PIC
-    outb(0xA1, 0x0);   // Enable all IRQs on slave PIC
+    // Only lines with a handler are unmasked
+    pic_update();
     
     // Set up IRQ handlers
     idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E);
@@ -98,7 +177,30 @@ static void idt_init() {
     idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
     
+    // MSI vectors
+    idt_set_gate(MSI_VECTOR_BASE + 0, (uint32_t)msi0, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 1, (uint32_t)msi1, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 2, (uint32_t)msi2, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 3, (uint32_t)msi3, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 4, (uint32_t)msi4, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 5, (uint32_t)msi5, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 6, (uint32_t)msi6, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 7, (uint32_t)msi7, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 8, (uint32_t)msi8, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 9, (uint32_t)msi9, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 10, (uint32_t)msi10, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 11, (uint32_t)msi11, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 12, (uint32_t)msi12, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 13, (uint32_t)msi13, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 14, (uint32_t)msi14, 0x08, 0x8E);
+    idt_set_gate(MSI_VECTOR_BASE + 15, (uint32_t)msi15, 0x08, 0x8E);
+    
     // Load the IDT
+    idt_load();
+}
+
+/* Load the IDT on the executing CPU */
+void idt_load() {
     asm volatile("lidt %0" : : "m" (idt_ptr));
 }
 
@@ -125,31 +227,199 @@ void interrupts_disable() {
 /* Register an interrupt handler */
 void register_interrupt_handler(uint8_t n, isr_t handler) {
     interrupt_handlers[n] = handler;
+    
+    // A device line is unmasked once something handles it
+    if (handler && n >= IRQ0 && n <= IRQ15) {
+        irq_unmask(n - IRQ0);
+    }
+}
+
+/* Stop delivering the PIC's device interrupts and route them through the
+ * I/O APIC to the boot CPU */
+int irq_use_ioapic() {
+    if (!lapic_present() || ioapic_init() != 0) {
+        return -1;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    
+    // The PIC goes quiet first so no line is delivered twice; IRQ2 is only
+    // the cascade and never raised
+    irq_ioapic = 1;
+    pic_update();
+    for (uint32_t irq = 0; irq < ISA_IRQS; irq++) {
+        if (irq != 2) {
+            irq_route(irq);
+        }
+    }
+    
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return 0;
+}
+
+/* Record whether a line is wanted and mask or unmask it where it arrives */
+static void irq_set_enabled(uint32_t irq, int enabled) {
+    if (irq >= ISA_IRQS) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    if (enabled) {
+        irq_enabled |= 1u << irq;
+    } else {
+        irq_enabled &= ~(1u << irq);
+    }
+    
+    if (irq_ioapic) {
+        ioapic_set_masked(acpi_get_madt()->isa_gsi[irq], !enabled);
+    } else {
+        pic_update();
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+/* Mask an ISA interrupt line */
+void irq_mask(uint32_t irq) {
+    irq_set_enabled(irq, 0);
+}
+
+/* Unmask an ISA interrupt line */
+void irq_unmask(uint32_t irq) {
+    irq_set_enabled(irq, 1);
+}
+
+/* Deliver an ISA interrupt line to one CPU */
+int irq_set_affinity(uint32_t irq, uint32_t cpu) {
+    if (irq >= ISA_IRQS || irq == 2 || cpu >= MAX_CPUS || !(smp_online_mask() & (1u << cpu))) {
+        return -1;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int result = -1;
+    if (irq_ioapic) {
+        irq_cpu[irq] = cpu;
+        result = irq_route(irq);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    
+    return result;
+}
+
+/* Allocate an MSI vector delivered to one CPU */
+int msi_alloc(isr_t handler, uint32_t cpu, uint32_t *address, uint32_t *data) {
+    if (!lapic_present() || cpu >= MAX_CPUS || !(smp_online_mask() & (1u << cpu))) {
+        return -1;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int vector = -1;
+    for (uint32_t n = 0; n < MSI_VECTORS; n++) {
+        if (!(msi_used & (1u << n))) {
+            msi_used |= 1u << n;
+            vector = MSI_VECTOR_BASE + n;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    
+    if (vector < 0) {
+        return -1;
+    }
+    
+    // Edge triggered, fixed delivery: the data is just the vector
+    interrupt_handlers[vector] = handler;
+    *address = MSI_ADDRESS_BASE | (smp_apic_id(cpu) << 12);
+    *data = vector;
+    return vector;
+}
+
+/* Get the number of interrupts a CPU took on a vector */
+uint32_t interrupt_count(uint32_t cpu, uint32_t vector) {
+    return cpu < MAX_CPUS && vector < 256 ? interrupt_counts[cpu][vector] : 0;
+}
+
+/* Get a short name for what raises a vector */
+const char *interrupt_name(uint32_t vector) {
+    if (vector == ISR_PAGE_FAULT) {
+        return "page fault";
+    }
+    if (vector < IRQ0) {
+        return "exception";
+    }
+    if (vector <= IRQ15) {
+        return irq_names[vector - IRQ0];
+    }
+    if (vector >= MSI_VECTOR_BASE && vector < MSI_VECTOR_BASE + MSI_VECTORS) {
+        return "msi";
+    }
+    
+    switch (vector) {
+        case ISR_LAPIC_TIMER:
+            return "local timer";
+        case ISR_IPI_TLB:
+            return "tlb shootdown";
+        case ISR_IPI_RESCHED:
+            return "reschedule";
+        case ISR_SYSCALL:
+            return "syscall";
+        default:
+            return "other";
+    }
 }
 
 /* ISR handler */
-void isr_handler() {
-    // To be implemented
-    terminal_writestring("Received interrupt: ");
-    // Print interrupt number
+void isr_handler(registers_t* regs) {
+    interrupt_counts[cpu_id()][regs->int_no & 0xFF]++;
+    
+    // Call handler if registered
+    if (interrupt_handlers[regs->int_no] != 0) {
+        isr_t handler = interrupt_handlers[regs->int_no];
+        handler(regs);
+        return;
+    }
+    
+    terminal_writestring("Unhandled interrupt: ");
+    terminal_writedec(regs->int_no);
+    terminal_writestring(" at eip ");
+    terminal_writehex(regs->eip);
     terminal_writestring("\n");
 }
 
 /* IRQ handler */
-void irq_handler(uint8_t irq_num) {
-    // Send EOI (End of Interrupt) to PICs
-    if (irq_num >= 40) {
-        // Send reset signal to slave PIC
-        outb(0xA0, 0x20);
+void irq_handler(registers_t* regs) {
+    uint32_t irq_num = regs->int_no;
+    interrupt_counts[cpu_id()][irq_num & 0xFF]++;
+    
+    // MSIs and I/O APIC interrupts end with one local APIC write. A
+    // level-triggered line is only ended once its handler has quietened
+    // the device: ending it earlier clears Remote IRR while the line is
+    // still asserted, and the interrupt is delivered again at once.
+    int level = irq_ioapic && irq_num >= IRQ0 && irq_num <= IRQ15 && irq_level(irq_num - IRQ0);
+    if (irq_ioapic || irq_num >= MSI_VECTOR_BASE) {
+        if (!level) {
+            lapic_eoi();
+        }
+    } else {
+        // Send EOI (End of Interrupt) to PICs
+        if (irq_num >= 40) {
+            // Send reset signal to slave PIC
+            outb(0xA0, 0x20);
+        }
+        // Send reset signal to master PIC
+        outb(0x20, 0x20);
     }
-    // Send reset signal to master PIC
-    outb(0x20, 0x20);
     
     // Call handler if registered
     if (interrupt_handlers[irq_num] != 0) {
         isr_t handler = interrupt_handlers[irq_num];
-        handler();
+        handler(regs);
     }
+    if (level) {
+        lapic_eoi();
+    }
+    
+    // Run the work the handler deferred before returning to anything else
+    softirq_interrupt_exit();
 }
 
 /* Port I/O functions */
@@ -20,8 +20,16 @@ struct idt_ptr_struct {
 } __attribute__((packed));
 typedef struct idt_ptr_struct idt_ptr_t;
 
+/* Registers saved by the interrupt stubs, in stack order */
+typedef struct registers {
+    uint32_t ds;                                      // Data segment selector
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // Pushed by pusha
+    uint32_t int_no, err_code;                        // Pushed by the stub
+    uint32_t eip, cs, eflags, useresp, ss;            // Pushed by the CPU
+} registers_t;
+
 /* Interrupt handler function type */
-typedef void (*isr_t)(void);
+typedef void (*isr_t)(registers_t*);
 
 /* Interrupt handler registration function */
 void register_interrupt_handler(uint8_t n, isr_t handler);
@@ -29,12 +37,43 @@ void register_interrupt_handler(uint8_t n, isr_t handler);
 /* Initialize interrupts */
 void interrupts_init(void);
 
+/* Load the IDT on the executing CPU (application processors) */
+void idt_load(void);
+
+/* Port I/O */
+void outb(uint16_t port, uint8_t value);
+uint8_t inb(uint16_t port);
+uint16_t inw(uint16_t port);
+
 /* Enable interrupts */
 void interrupts_enable(void);
 
 /* Disable interrupts */
 void interrupts_disable(void);
 
+/* Stop delivering the PIC's device interrupts and route them through the
+ * I/O APIC to the boot CPU; returns -1 (PIC kept) without one */
+int irq_use_ioapic(void);
+
+/* Mask or unmask an ISA interrupt line (0-15). A line is unmasked when a
+ * handler is registered for its vector */
+void irq_mask(uint32_t irq);
+void irq_unmask(uint32_t irq);
+
+/* Deliver an ISA interrupt line to one CPU (I/O APIC only); returns -1 if
+ * it cannot be moved */
+int irq_set_affinity(uint32_t irq, uint32_t cpu);
+
+/* Allocate an MSI vector delivered to one CPU and get the address and data
+ * a device's MSI capability is programmed with; returns the vector or -1 */
+int msi_alloc(isr_t handler, uint32_t cpu, uint32_t *address, uint32_t *data);
+
+/* Get the number of interrupts a CPU took on a vector */
+uint32_t interrupt_count(uint32_t cpu, uint32_t vector);
+
+/* Get a short name for what raises a vector */
+const char *interrupt_name(uint32_t vector);
+
 /* ISR handlers */
 extern void isr0(void);
 extern void isr1(void);
@@ -68,6 +107,14 @@ extern void isr28(void);
 extern void isr29(void);
 extern void isr30(void);
 extern void isr31(void);
+extern void isr64(void);
+extern void isr65(void);
+extern void isr66(void);
+extern void isr128(void);
+extern void isr255(void);
+
+/* Restore a registers_t frame on the stack and iret */
+extern void interrupt_return(void);
 
 /* IRQ handlers */
 extern void irq0(void);
@@ -87,6 +134,24 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+/* MSI stubs, one per vector from MSI_VECTOR_BASE */
+extern void msi0(void);
+extern void msi1(void);
+extern void msi2(void);
+extern void msi3(void);
+extern void msi4(void);
+extern void msi5(void);
+extern void msi6(void);
+extern void msi7(void);
+extern void msi8(void);
+extern void msi9(void);
+extern void msi10(void);
+extern void msi11(void);
+extern void msi12(void);
+extern void msi13(void);
+extern void msi14(void);
+extern void msi15(void);
+
 /* IRQ numbers */
 #define IRQ0  32 // Timer
 #define IRQ1  33 // Keyboard
@@ -105,4 +170,21 @@ extern void irq15(void);
 #define IRQ14 46 // Primary ATA hard disk
 #define IRQ15 47 // Secondary ATA hard disk
 
+/* Exception and software interrupt numbers */
+#define ISR_PAGE_FAULT 14
+#define ISR_SYSCALL    0x80
+
+/* Local APIC vectors (see apic.h) */
+#define ISR_LAPIC_TIMER 0x40
+#define ISR_IPI_TLB     0x41
+#define ISR_IPI_RESCHED 0x42
+#define ISR_SPURIOUS    0xFF
+
+/* Vectors handed out to message signalled interrupts */
+#define MSI_VECTOR_BASE 0x50
+#define MSI_VECTORS     16
+
+/* MSI address: fixed delivery to the physical APIC ID in bits 12-19 */
+#define MSI_ADDRESS_BASE 0xFEE00000
+
 #endif /* INTERRUPT_H */
@@ -30,6 +30,30 @@ irq%1:
     jmp irq_common_stub     ; Jump to common handler
 %endmacro
 
+; Macro to create an MSI handler; MSIs take the IRQ path
+%macro MSI 2
+global msi%1
+msi%1:
+    cli                     ; Disable interrupts
+    push byte 0             ; Push dummy error code
+    push byte %2            ; Push interrupt number
+    jmp irq_common_stub     ; Jump to common handler
+%endmacro
+
+; Macro to record an interrupt event (trace.h) while tracing is on; the
+; stack holds the saved data segment, then pusha, then the vector
+extern trace_enabled
+extern trace_record
+%macro TRACE_INTERRUPT 1
+    cmp dword [trace_enabled], 0
+    je %%untraced
+    push dword [esp + 36]   ; Vector
+    push dword %1           ; Event type
+    call trace_record
+    add esp, 8
+%%untraced:
+%endmacro
+
 ; Define ISRs for CPU exceptions
 ISR_NOERRCODE 0    ; Division by zero
 ISR_NOERRCODE 1    ; Debug
@@ -64,6 +88,24 @@ ISR_NOERRCODE 29   ; Reserved
 ISR_NOERRCODE 30   ; Security exception
 ISR_NOERRCODE 31   ; Reserved
 
+; System call gate (int 0x80); push byte would sign-extend 128
+global isr128
+isr128:
+    cli                     ; Disable interrupts
+    push byte 0             ; Push dummy error code
+    push dword 128          ; Push interrupt number
+    jmp isr_common_stub     ; Jump to common handler
+
+; Local APIC timer and inter-processor interrupts; the handlers send the EOI
+ISR_NOERRCODE 64   ; Local APIC timer
+ISR_NOERRCODE 65   ; TLB shootdown IPI
+ISR_NOERRCODE 66   ; Reschedule IPI
+
+; Spurious local APIC interrupt: nothing to do and no EOI
+global isr255
+isr255:
+    iret
+
 ; Define IRQs
 IRQ 0, 32   ; Timer
 IRQ 1, 33   ; Keyboard
@@ -82,6 +124,24 @@ IRQ 13, 45  ; FPU, coprocessor or inter-processor
 IRQ 14, 46  ; Primary ATA hard disk
 IRQ 15, 47  ; Secondary ATA hard disk
 
+; Message signalled interrupts (MSI_VECTOR_BASE on)
+MSI 0, 80
+MSI 1, 81
+MSI 2, 82
+MSI 3, 83
+MSI 4, 84
+MSI 5, 85
+MSI 6, 86
+MSI 7, 87
+MSI 8, 88
+MSI 9, 89
+MSI 10, 90
+MSI 11, 91
+MSI 12, 92
+MSI 13, 93
+MSI 14, 94
+MSI 15, 95
+
 ; Common ISR stub
 extern isr_handler
 isr_common_stub:
@@ -99,8 +159,14 @@ isr_common_stub:
     mov fs, ax
     mov gs, ax
     
-    ; Call C handler
+    TRACE_INTERRUPT 1       ; TRACE_IRQ_ENTRY
+    
+    ; Call C handler with a pointer to the saved registers
+    push esp
     call isr_handler
+    add esp, 4
+    
+    TRACE_INTERRUPT 2       ; TRACE_IRQ_EXIT
     
     ; Restore data segment
     pop eax
@@ -135,9 +201,18 @@ irq_common_stub:
     mov fs, ax
     mov gs, ax
     
-    ; Call C handler
+    TRACE_INTERRUPT 1       ; TRACE_IRQ_ENTRY
+    
+    ; Call C handler with a pointer to the saved registers
+    push esp
     call irq_handler
+    add esp, 4
+    
+    TRACE_INTERRUPT 2       ; TRACE_IRQ_EXIT
     
+; Return through a saved registers_t frame (also used by forked children)
+global interrupt_return
+interrupt_return:
     ; Restore data segment
     pop eax
     mov ds, ax
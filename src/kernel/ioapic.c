@@ -0,0 +1,94 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "memory.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* A mapped I/O APIC and the interrupts it handles */
+typedef struct {
+    volatile uint8_t *base;
+    uint32_t gsi_base;
+    uint32_t count;              // Redirection entries
+} ioapic_t;
+
+static ioapic_t ioapics[MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+/* IOREGSEL and IOWIN are used in pairs */
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+/* Read an I/O APIC register */
+static uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg) {
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic->base + IOAPIC_WINDOW);
+}
+
+/* Write an I/O APIC register */
+static void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_WINDOW) = value;
+}
+
+/* Find the I/O APIC an interrupt arrives at */
+static ioapic_t *ioapic_find(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].count) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+/* Map the I/O APICs listed in the MADT and mask all their inputs */
+int ioapic_init() {
+    const acpi_madt_info_t *madt = acpi_get_madt();
+
+    for (uint32_t i = 0; i < madt->nioapics && ioapic_count < MAX_IOAPICS; i++) {
+        ioapic_t *ioapic = &ioapics[ioapic_count];
+        ioapic->base = (volatile uint8_t*)mmio_map(madt->ioapics[i].addr, PAGE_SIZE);
+        if (!ioapic->base) {
+            continue;
+        }
+
+        ioapic->gsi_base = madt->ioapics[i].gsi_base;
+        ioapic->count = ((ioapic_read(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        for (uint32_t n = 0; n < ioapic->count; n++) {
+            ioapic_write(ioapic, IOAPIC_REDIR + 2 * n, IOAPIC_MASKED);
+        }
+        ioapic_count++;
+    }
+
+    return ioapic_count ? 0 : -1;
+}
+
+/* Deliver an interrupt to a vector on one CPU */
+int ioapic_route(uint32_t gsi, uint32_t vector, uint32_t apic_id, uint32_t flags) {
+    ioapic_t *ioapic = ioapic_find(gsi);
+    if (!ioapic) {
+        return -1;
+    }
+
+    // Masked while the high word changes, so no half-written entry fires
+    uint32_t reg = IOAPIC_REDIR + 2 * (gsi - ioapic->gsi_base);
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(ioapic, reg, IOAPIC_MASKED);
+    ioapic_write(ioapic, reg + 1, apic_id << 24);
+    ioapic_write(ioapic, reg, (vector & 0xFF) | flags);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return 0;
+}
+
+/* Mask or unmask an interrupt, keeping its route */
+void ioapic_set_masked(uint32_t gsi, int masked) {
+    ioapic_t *ioapic = ioapic_find(gsi);
+    if (!ioapic) {
+        return;
+    }
+
+    uint32_t reg = IOAPIC_REDIR + 2 * (gsi - ioapic->gsi_base);
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(ioapic, reg);
+    ioapic_write(ioapic, reg, masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED));
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+}
@@ -0,0 +1,28 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+
+/* I/O APIC registers, reached through IOREGSEL and IOWIN */
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VERSION  0x01  // Highest redirection entry in bits 16-23
+#define IOAPIC_REDIR    0x10  // Entry n is registers 0x10 + 2n (low) and 0x11 + 2n (high)
+
+/* Redirection entry bits (low word); fixed delivery to a physical APIC ID */
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL      0x8000
+#define IOAPIC_MASKED     0x10000
+
+/* Map the I/O APICs listed in the MADT and mask all their inputs;
+ * returns -1 if there are none */
+int ioapic_init(void);
+
+/* Deliver an interrupt to a vector on one CPU; flags are IOAPIC_* bits.
+ * Returns -1 if no I/O APIC handles the interrupt */
+int ioapic_route(uint32_t gsi, uint32_t vector, uint32_t apic_id, uint32_t flags);
+
+/* Mask or unmask an interrupt, keeping its route */
+void ioapic_set_masked(uint32_t gsi, int masked);
+
+#endif /* IOAPIC_H */
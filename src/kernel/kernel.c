@@ -1,9 +1,20 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "../boot/bootloader.h"
+#include "../boot/init.h"
+#include "../boot/bootlog.h"
+#include "zpool.h"
+#include "spinlock.h"
+
+/* Magic value passed in EAX by a multiboot-compliant bootloader */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
 
 /* Kernel main function - entry point from assembly */
-void kernel_main(void) {
+void kernel_main(uint32_t magic, multiboot_info_t* mbi) {
+    /* Boot stage timing starts here */
+    bootlog_mark("kernel_main");
+    
     /* Initialize terminal interface */
     terminal_initialize();
     
@@ -12,16 +23,23 @@ void kernel_main(void) {
     terminal_writestring("A minimalistic, secure, and fast operating system\n");
     terminal_writestring("Version 0.1.0 - Initial Development Build\n\n");
     
+    /* Record what the bootloader told us (memory map, modules) */
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        boot_init(mbi);
+    } else {
+        terminal_writestring("Not booted by a multiboot loader, assuming 16MB\n");
+    }
+    bootlog_mark("boot_init");
+    
     /* Initialize kernel subsystems */
-    // memory_init();      // To be implemented
-    // interrupts_init();  // To be implemented
-    // timer_init();       // To be implemented
-    // process_init();     // To be implemented
+    init_system();
     
     /* Kernel main loop */
     while (1) {
-        /* Halt the CPU until the next interrupt */
-        __asm__ volatile("hlt");
+        /* Pre-zero frames while idle; halt once the pool is full */
+        if (zpool_refill(ZPOOL_BATCH) == 0) {
+            __asm__ volatile("hlt");
+        }
     }
 }
 
@@ -53,6 +71,9 @@ enum vga_color {
 static size_t terminal_row;
 static size_t terminal_column;
 static uint8_t terminal_color;
+
+/* Keeps strings written from several CPUs at once apart */
+static spinlock_t terminal_lock = SPINLOCK_INIT;
 static uint16_t* terminal_buffer;
 
 /* VGA text mode functions */
@@ -129,14 +150,47 @@ void terminal_putchar(char c) {
 
 /* Write a string to the terminal */
 void terminal_write(const char* data, size_t size) {
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
     for (size_t i = 0; i < size; i++) {
         terminal_putchar(data[i]);
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 
 /* Write a null-terminated string to the terminal */
 void terminal_writestring(const char* data) {
+    uint32_t flags = spin_lock_irqsave(&terminal_lock);
     for (size_t i = 0; data[i] != '\0'; i++) {
         terminal_putchar(data[i]);
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
+}
+
+/* Write an unsigned decimal number to the terminal */
+void terminal_writedec(uint32_t value) {
+    char buffer[11];
+    int i = 10;
+    
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    
+    terminal_writestring(&buffer[i]);
+}
+
+/* Write a 32-bit hexadecimal number to the terminal */
+void terminal_writehex(uint32_t value) {
+    static const char digits[] = "0123456789ABCDEF";
+    char buffer[11];
+    
+    buffer[0] = '0';
+    buffer[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        buffer[2 + i] = digits[(value >> (28 - i * 4)) & 0xF];
+    }
+    buffer[10] = '\0';
+    
+    terminal_writestring(buffer);
 }
@@ -13,6 +13,8 @@ void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
 void terminal_newline(void);
+void terminal_writedec(uint32_t value);
+void terminal_writehex(uint32_t value);
 
 /* Hardware text mode color constants */
 enum vga_color {
@@ -0,0 +1,197 @@
+#include "kmem.h"
+#include "memory.h"
+#include "kernel.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Object caches in the style of Bonwick's magazines. Each CPU keeps two
+ * magazines of free objects and allocates and frees against them with
+ * only interrupts disabled. When both are empty (or both full) the CPU
+ * trades a whole magazine with the depot under the depot lock, so the
+ * lock is taken at most once per KMEM_MAGAZINE_SIZE operations. The heap
+ * is only reached when the depot has nothing to give, or when the depot
+ * already holds KMEM_DEPOT_MAX full magazines and a CPU frees more; those
+ * objects go back to the heap so a burst does not pin memory in one cache.
+ */
+
+/* All caches, for statistics */
+static kmem_cache_t *cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+/* Allocate an empty magazine */
+static kmem_magazine_t *magazine_alloc() {
+    kmem_magazine_t *mag = (kmem_magazine_t*)kmalloc(sizeof(kmem_magazine_t));
+    if (mag) {
+        mag->rounds = 0;
+        mag->next = NULL;
+    }
+    return mag;
+}
+
+/* Create a cache for objects of a fixed size */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size) {
+    kmem_cache_t *cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(kmem_cache_t));
+    
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    cache->size = size;
+    spin_init(&cache->depot_lock);
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cache->cpu[i].loaded = magazine_alloc();
+        cache->cpu[i].previous = magazine_alloc();
+        if (!cache->cpu[i].loaded || !cache->cpu[i].previous) {
+            terminal_writestring("PANIC: Out of memory creating object cache!\n");
+            for(;;);
+        }
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+    
+    return cache;
+}
+
+/* Allocate an object from a cache */
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint32_t flags = irq_save();
+    kmem_cpu_cache_t *cc = &cache->cpu[cpu_id()];
+    
+    if (cc->loaded->rounds == 0 && cc->previous->rounds > 0) {
+        kmem_magazine_t *tmp = cc->loaded;
+        cc->loaded = cc->previous;
+        cc->previous = tmp;
+    }
+    
+    if (cc->loaded->rounds > 0) {
+        void *obj = cc->loaded->objects[--cc->loaded->rounds];
+        cc->hits++;
+        irq_restore(flags);
+        return obj;
+    }
+    
+    cc->misses++;
+    
+    // Both magazines are empty: trade one for a full magazine
+    spin_lock(&cache->depot_lock);
+    kmem_magazine_t *full = cache->full;
+    if (full) {
+        cache->full = full->next;
+        cache->nfull--;
+        cc->previous->next = cache->empty;
+        cache->empty = cc->previous;
+        cc->previous = cc->loaded;
+        cc->loaded = full;
+    }
+    spin_unlock(&cache->depot_lock);
+    
+    if (full) {
+        void *obj = cc->loaded->objects[--cc->loaded->rounds];
+        irq_restore(flags);
+        return obj;
+    }
+    
+    irq_restore(flags);
+    return kmalloc_from(cache->size, __builtin_return_address(0));
+}
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    kmem_cpu_cache_t *cc = &cache->cpu[cpu_id()];
+    
+    if (cc->loaded->rounds == KMEM_MAGAZINE_SIZE && cc->previous->rounds == 0) {
+        kmem_magazine_t *tmp = cc->loaded;
+        cc->loaded = cc->previous;
+        cc->previous = tmp;
+    }
+    
+    if (cc->loaded->rounds < KMEM_MAGAZINE_SIZE) {
+        cc->loaded->objects[cc->loaded->rounds++] = obj;
+        cc->hits++;
+        irq_restore(flags);
+        return;
+    }
+    
+    cc->misses++;
+    
+    // Both magazines are full and so is the depot: empty the spare into
+    // the heap, where kmalloc and the other caches can use the memory
+    spin_lock(&cache->depot_lock);
+    int spill = cache->nfull >= KMEM_DEPOT_MAX;
+    spin_unlock(&cache->depot_lock);
+    
+    if (spill) {
+        kmem_magazine_t *mag = cc->previous;
+        void *objects[KMEM_MAGAZINE_SIZE];
+        uint32_t count = mag->rounds;
+        memcpy(objects, mag->objects, count * sizeof(void*));
+        mag->rounds = 0;
+        
+        cc->previous = cc->loaded;
+        cc->loaded = mag;
+        cc->loaded->objects[cc->loaded->rounds++] = obj;
+        irq_restore(flags);
+        
+        for (uint32_t i = 0; i < count; i++) {
+            kfree(objects[i]);
+        }
+        return;
+    }
+    
+    // Otherwise trade one for an empty magazine
+    spin_lock(&cache->depot_lock);
+    kmem_magazine_t *empty = cache->empty;
+    if (empty) {
+        cache->empty = empty->next;
+    }
+    spin_unlock(&cache->depot_lock);
+    
+    if (!empty) {
+        empty = magazine_alloc();
+        if (!empty) {
+            irq_restore(flags);
+            kfree(obj);
+            return;
+        }
+    }
+    
+    spin_lock(&cache->depot_lock);
+    cc->previous->next = cache->full;
+    cache->full = cc->previous;
+    cache->nfull++;
+    spin_unlock(&cache->depot_lock);
+    
+    cc->previous = cc->loaded;
+    cc->loaded = empty;
+    cc->loaded->objects[cc->loaded->rounds++] = obj;
+    
+    irq_restore(flags);
+}
+
+/* Sum a cache's hit and miss counters over all CPUs */
+void kmem_cache_get_stats(kmem_cache_t *cache, uint32_t *hits, uint32_t *misses) {
+    *hits = 0;
+    *misses = 0;
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        *hits += cache->cpu[i].hits;
+        *misses += cache->cpu[i].misses;
+    }
+}
+
+/* Get the first cache in the global list */
+kmem_cache_t *kmem_cache_list() {
+    return cache_list;
+}
@@ -0,0 +1,60 @@
+#ifndef KMEM_H
+#define KMEM_H
+
+#include "cpu.h"
+#include "spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Objects held by one magazine */
+#define KMEM_MAGAZINE_SIZE 16
+
+/* Full magazines a depot keeps; objects freed past that go back to the heap */
+#define KMEM_DEPOT_MAX     8
+
+/* Maximum cache name length */
+#define KMEM_NAME_LEN 24
+
+/* A stack of free objects that moves between a CPU and the depot */
+typedef struct kmem_magazine {
+    uint32_t rounds;                        // Objects currently held
+    struct kmem_magazine *next;             // Next magazine in the depot
+    void *objects[KMEM_MAGAZINE_SIZE];
+} kmem_magazine_t;
+
+/* Per-CPU layer: only touched by its own CPU with interrupts off */
+typedef struct {
+    kmem_magazine_t *loaded;                // Magazine in use
+    kmem_magazine_t *previous;              // Spare, swapped in before going to the depot
+    uint32_t hits;                          // Served by a CPU magazine
+    uint32_t misses;                        // Needed the depot or the heap
+} kmem_cpu_cache_t;
+
+/* Object cache for one fixed-size type */
+typedef struct kmem_cache {
+    char name[KMEM_NAME_LEN];
+    size_t size;                            // Object size
+    kmem_cpu_cache_t cpu[MAX_CPUS];
+    spinlock_t depot_lock;                  // Protects the depot lists
+    kmem_magazine_t *full;                  // Depot: full magazines
+    uint32_t nfull;                         // Magazines on the full list
+    kmem_magazine_t *empty;                 // Depot: empty magazines
+    struct kmem_cache *next;                // Next cache in the global list
+} kmem_cache_t;
+
+/* Create a cache for objects of a fixed size */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size);
+
+/* Allocate an object from a cache */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* Sum a cache's hit and miss counters over all CPUs */
+void kmem_cache_get_stats(kmem_cache_t *cache, uint32_t *hits, uint32_t *misses);
+
+/* Get the first cache in the global list */
+kmem_cache_t *kmem_cache_list(void);
+
+#endif /* KMEM_H */
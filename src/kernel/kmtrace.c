@@ -0,0 +1,215 @@
+#include "kmtrace.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef CONFIG_KMALLOC_TRACE
+
+/*
+ * Live allocations are kept in a chained hash table keyed by pointer, with
+ * records taken from a fixed pool so tracing never allocates. Call sites
+ * live in an open-addressed table that only grows.
+ */
+
+/* Per call site totals */
+typedef struct {
+    uint32_t site;          // Return address of the kmalloc call
+    uint32_t allocs;        // Allocations made
+    uint32_t frees;         // Allocations freed
+    uint32_t live_bytes;    // Bytes still allocated
+    uint32_t total_bytes;   // Bytes ever allocated
+    uint64_t lifetime;      // Summed cycles between alloc and free
+} kmtrace_site_t;
+
+/* One live allocation */
+typedef struct {
+    uint32_t ptr;
+    uint32_t size;
+    uint64_t start;         // rdtsc at allocation
+    uint16_t site;          // Index into sites[]
+    uint16_t next;          // Next record in the bucket or free list
+} kmtrace_live_t;
+
+#define LIVE_NONE      0xFFFF
+#define LIVE_BUCKETS   4096
+
+static kmtrace_site_t sites[KMTRACE_MAX_SITES];
+static kmtrace_live_t live[KMTRACE_MAX_LIVE];
+static uint16_t buckets[LIVE_BUCKETS];
+static uint16_t live_free = LIVE_NONE;
+static uint32_t live_unused = 0;      // Records never handed out yet
+static uint32_t dropped = 0;          // Allocations not recorded
+static int tracing_ready = 0;
+static spinlock_t trace_lock = SPINLOCK_INIT;
+
+/* Hash a pointer to a bucket */
+static uint32_t ptr_hash(uint32_t ptr) {
+    return ((ptr >> 4) * 2654435761u) >> 20; // Top 12 bits
+}
+
+/* Set up the tables on first use */
+static void kmtrace_setup() {
+    for (uint32_t i = 0; i < LIVE_BUCKETS; i++) {
+        buckets[i] = LIVE_NONE;
+    }
+    tracing_ready = 1;
+}
+
+/* Find or add the slot for a call site */
+static int site_index(uint32_t site) {
+    uint32_t idx = (site * 2654435761u) % KMTRACE_MAX_SITES;
+    
+    for (uint32_t probe = 0; probe < KMTRACE_MAX_SITES; probe++) {
+        if (sites[idx].site == site) {
+            return idx;
+        }
+        if (sites[idx].site == 0) {
+            sites[idx].site = site;
+            return idx;
+        }
+        idx = (idx + 1) % KMTRACE_MAX_SITES;
+    }
+    
+    return -1; // Table full
+}
+
+/* Record an allocation made from a call site */
+void kmtrace_alloc(void *ptr, size_t size, void *site) {
+    if (!ptr) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&trace_lock);
+    
+    if (!tracing_ready) {
+        kmtrace_setup();
+    }
+    
+    int s = site_index((uint32_t)site);
+    uint16_t rec = live_free;
+    if (rec != LIVE_NONE) {
+        live_free = live[rec].next;
+    } else if (live_unused < KMTRACE_MAX_LIVE) {
+        rec = live_unused++;
+    }
+    
+    if (s < 0 || rec == LIVE_NONE) {
+        if (rec != LIVE_NONE) {
+            live[rec].next = live_free;
+            live_free = rec;
+        }
+        dropped++;
+        spin_unlock_irqrestore(&trace_lock, flags);
+        return;
+    }
+    
+    sites[s].allocs++;
+    sites[s].live_bytes += size;
+    sites[s].total_bytes += size;
+    
+    uint32_t bucket = ptr_hash((uint32_t)ptr);
+    live[rec].ptr = (uint32_t)ptr;
+    live[rec].size = size;
+    live[rec].start = rdtsc();
+    live[rec].site = s;
+    live[rec].next = buckets[bucket];
+    buckets[bucket] = rec;
+    
+    spin_unlock_irqrestore(&trace_lock, flags);
+}
+
+/* Record a free */
+void kmtrace_free(void *ptr) {
+    if (!ptr || !tracing_ready) {
+        return;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&trace_lock);
+    
+    uint16_t *link = &buckets[ptr_hash((uint32_t)ptr)];
+    while (*link != LIVE_NONE && live[*link].ptr != (uint32_t)ptr) {
+        link = &live[*link].next;
+    }
+    
+    if (*link != LIVE_NONE) {
+        uint16_t rec = *link;
+        kmtrace_site_t *site = &sites[live[rec].site];
+        
+        site->frees++;
+        site->live_bytes -= live[rec].size;
+        site->lifetime += rdtsc() - live[rec].start;
+        
+        *link = live[rec].next;
+        live[rec].next = live_free;
+        live_free = rec;
+    }
+    
+    spin_unlock_irqrestore(&trace_lock, flags);
+}
+
+/* Sort key of a site */
+static uint32_t site_key(kmtrace_site_t *site, int order) {
+    return order == KMTRACE_BY_COUNT ? site->allocs : site->live_bytes;
+}
+
+/* Print the top call sites by live bytes or by allocation count */
+void kmtrace_dump(uint32_t count, int order) {
+    uint8_t shown[KMTRACE_MAX_SITES] = {0};
+    
+    terminal_writestring(order == KMTRACE_BY_COUNT ? "Top allocation sites by count:\n"
+                                                   : "Top allocation sites by live bytes:\n");
+    terminal_writestring("  SITE        LIVE BYTES  LIVE  ALLOCS  TOTAL BYTES  AVG LIFE (kcycles)\n");
+    
+    for (uint32_t n = 0; n < count; n++) {
+        // Selection: the largest site not yet shown
+        int best = -1;
+        for (int i = 0; i < KMTRACE_MAX_SITES; i++) {
+            if (sites[i].site && !shown[i] &&
+                (best < 0 || site_key(&sites[i], order) > site_key(&sites[best], order))) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = 1;
+        
+        kmtrace_site_t *site = &sites[best];
+        terminal_writestring("  ");
+        terminal_writehex(site->site);
+        terminal_writestring("  ");
+        terminal_writedec(site->live_bytes);
+        terminal_writestring("  ");
+        terminal_writedec(site->allocs - site->frees);
+        terminal_writestring("  ");
+        terminal_writedec(site->allocs);
+        terminal_writestring("  ");
+        terminal_writedec(site->total_bytes);
+        terminal_writestring("  ");
+        if (site->frees) {
+            terminal_writedec((uint32_t)(site->lifetime / site->frees / 1000));
+        } else {
+            terminal_writestring("-");
+        }
+        terminal_writestring("\n");
+    }
+    
+    if (dropped) {
+        terminal_writestring("  (");
+        terminal_writedec(dropped);
+        terminal_writestring(" allocations not recorded: tables full)\n");
+    }
+}
+
+#else
+
+/* Tracing is compiled out */
+void kmtrace_dump(uint32_t count, int order) {
+    (void)count;
+    (void)order;
+    terminal_writestring("kmalloc tracing is not compiled in (build with -DCONFIG_KMALLOC_TRACE)\n");
+}
+
+#endif /* CONFIG_KMALLOC_TRACE */
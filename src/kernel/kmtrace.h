@@ -0,0 +1,35 @@
+#ifndef KMTRACE_H
+#define KMTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation profiler. Build with -DCONFIG_KMALLOC_TRACE (see Makefile)
+ * to record the call site, size and lifetime of every kmalloc; without
+ * it the hooks compile to nothing.
+ */
+
+/* Call sites tracked, and live allocations tracked at once */
+#define KMTRACE_MAX_SITES  256
+#define KMTRACE_MAX_LIVE   16384
+
+/* Sort orders for kmtrace_dump() */
+#define KMTRACE_BY_BYTES   0
+#define KMTRACE_BY_COUNT   1
+
+#ifdef CONFIG_KMALLOC_TRACE
+/* Record an allocation made from a call site */
+void kmtrace_alloc(void *ptr, size_t size, void *site);
+
+/* Record a free */
+void kmtrace_free(void *ptr);
+#else
+#define kmtrace_alloc(ptr, size, site) do { (void)(site); } while (0)
+#define kmtrace_free(ptr) do { } while (0)
+#endif
+
+/* Print the top call sites by live bytes or by allocation count */
+void kmtrace_dump(uint32_t count, int order);
+
+#endif /* KMTRACE_H */
@@ -1,90 +1,88 @@
 #include "memory.h"
+#include "heap.h"
+#include "frame.h"
 #include "kernel.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "process.h"
+#include "vm.h"
+#include "kmtrace.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "trace.h"
+#include "../boot/bootloader.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+
+/* End of the kernel image, defined in linker.ld */
+extern uint8_t kernel_end[];
 
 /* Memory management globals */
-static uint32_t *frames;          // Bitmap of frames
-static uint32_t nframes;          // Number of frames
 static page_directory_t *kernel_directory = 0;
-static page_directory_t *current_directory = 0;
+static page_directory_t *current_directory[MAX_CPUS];
 
 /* Memory allocation tracking */
-static uint32_t placement_address = 0x100000; // Start at 1MB
+static uint32_t placement_address = 0;
+static uint32_t placement_limit = 0;  // End of the identity-mapped early region
+static uint32_t image_end = 0;        // End of the kernel image
+static uint32_t early_start = 0;      // Start of the early allocations
+static uint32_t physmap_end = 0;      // End of the physmap alias
 static uint8_t kmalloc_initialized = 0;
 
-/* Frame management macros */
-#define INDEX_FROM_BIT(a) (a/(8*4))
-#define OFFSET_FROM_BIT(a) (a%(8*4))
-
-/* Set a bit in the frames bitmap */
-static void set_frame(uint32_t frame_addr) {
-    uint32_t frame = frame_addr / PAGE_SIZE;
-    uint32_t idx = INDEX_FROM_BIT(frame);
-    uint32_t off = OFFSET_FROM_BIT(frame);
-    frames[idx] |= (0x1 << off);
-}
-
-/* Clear a bit in the frames bitmap */
-static void clear_frame(uint32_t frame_addr) {
-    uint32_t frame = frame_addr / PAGE_SIZE;
-    uint32_t idx = INDEX_FROM_BIT(frame);
-    uint32_t off = OFFSET_FROM_BIT(frame);
-    frames[idx] &= ~(0x1 << off);
-}
-
-/* Test if a bit is set */
-static uint32_t test_frame(uint32_t frame_addr) {
-    uint32_t frame = frame_addr / PAGE_SIZE;
-    uint32_t idx = INDEX_FROM_BIT(frame);
-    uint32_t off = OFFSET_FROM_BIT(frame);
-    return (frames[idx] & (0x1 << off));
-}
-
-/* Find the first free frame */
-static uint32_t first_frame() {
-    uint32_t i, j;
-    for (i = 0; i < INDEX_FROM_BIT(nframes); i++) {
-        if (frames[i] != 0xFFFFFFFF) { // if not all frames are used
-            for (j = 0; j < 32; j++) {
-                uint32_t toTest = 0x1 << j;
-                if (!(frames[i] & toTest)) {
-                    return i*32 + j;
-                }
-            }
-        }
-    }
-    return 0; // No free frames!
-}
+/* Highest usable physical address */
+static uint32_t mem_end = 0;
+
+/* Whether the early region is mapped with 4MB pages */
+static uint8_t large_pages = 0;
+
+/* Temporary mapping slots in use (one bit per slot) */
+static uint32_t kmap_used = 0;
+static spinlock_t kmap_lock = SPINLOCK_INIT;
+
+/* Next free page of the MMIO window */
+static uint32_t mmio_next = MMIO_BASE;
+static spinlock_t mmio_lock = SPINLOCK_INIT;
+
+/* Next free address of the boot module window */
+static uint32_t module_next = MODULE_BASE;
+static spinlock_t module_lock = SPINLOCK_INIT;
 
 /* Allocate a frame */
 void alloc_frame(page_t *page, int is_kernel, int is_writeable) {
-    if (page->frame != 0) {
+    if (page->present) {
         return; // Frame was already allocated
     }
     
-    uint32_t idx = first_frame();
-    if (idx == 0) {
+    uint32_t idx = frame_alloc();
+    if (idx == FRAME_NONE) {
         // PANIC! No free frames!
         terminal_writestring("PANIC: No free frames!\n");
         for(;;);
     }
     
-    set_frame(idx * PAGE_SIZE);
     page->present = 1;
     page->rw = (is_writeable) ? 1 : 0;
     page->user = (is_kernel) ? 0 : 1;
     page->frame = idx;
 }
 
+/* Map a page to a specific, already reserved frame */
+void map_frame(page_t *page, uint32_t frame, int is_kernel, int is_writeable) {
+    page->present = 1;
+    page->rw = (is_writeable) ? 1 : 0;
+    page->user = (is_kernel) ? 0 : 1;
+    page->frame = frame;
+}
+
 /* Free a frame */
 void free_frame(page_t *page) {
-    uint32_t frame;
-    if (!(frame = page->frame)) {
+    if (!page->present) {
         return; // The page didn't have an allocated frame
     }
     
-    clear_frame(frame * PAGE_SIZE);
+    frame_free(page->frame);
+    page->present = 0;
     page->frame = 0;
 }
 
@@ -95,19 +93,18 @@ page_t *get_page(uint32_t address, int make, page_directory_t *dir) {
     // Find the page table containing this address
     uint32_t table_idx = address / 1024;
     
+    // 4MB mappings have no page table to hand out
+    if (dir->tables_physical[table_idx] & PDE_LARGE) {
+        return 0;
+    }
+    
     // If this page table is already assigned
     if (dir->tables[table_idx]) {
         return &dir->tables[table_idx]->pages[address % 1024];
     } else if (make) {
         uint32_t tmp;
-        dir->tables[table_idx] = (page_table_t*)kmalloc_aligned_physical(sizeof(page_table_t), &tmp);
-        // Clear the newly allocated page table
-        for (int i = 0; i < 1024; i++) {
-            dir->tables[table_idx]->pages[i].present = 0;
-            dir->tables[table_idx]->pages[i].rw = 0;
-            dir->tables[table_idx]->pages[i].user = 0;
-            dir->tables[table_idx]->pages[i].frame = 0;
-        }
+        // New tables are backed by a pre-zeroed frame
+        dir->tables[table_idx] = (page_table_t*)kmalloc_aligned_zeroed(sizeof(page_table_t), &tmp);
         dir->tables_physical[table_idx] = tmp | 0x7; // Present, RW, User
         return &dir->tables[table_idx]->pages[address % 1024];
     } else {
@@ -115,21 +112,108 @@ page_t *get_page(uint32_t address, int make, page_directory_t *dir) {
     }
 }
 
-/* Initialize paging */
-void paging_init() {
-    // Size of physical memory
-    uint32_t mem_end_page = 0x1000000; // Assume 16MB of physical RAM
+/* Round an address up to a power-of-two boundary */
+#define ALIGN_UP(addr, align) (((addr) + (align) - 1) & ~((align) - 1))
+
+/* Clip a memory map entry to the 32-bit physical address space */
+static int mmap_entry_range(mmap_entry_t *entry, uint32_t *start, uint32_t *end) {
+    if (entry->addr >= 0x100000000ULL) {
+        return 0;
+    }
+    
+    uint64_t top = entry->addr + entry->len;
+    if (top > 0x100000000ULL) {
+        top = 0x100000000ULL;
+    }
+    
+    *start = (uint32_t)entry->addr;
+    *end = (uint32_t)(top & 0xFFFFF000); // Whole frames only
+    return *end > *start;
+}
+
+/* Find the end of usable RAM from the multiboot information */
+static uint32_t memory_detect() {
+    uint32_t count;
+    uint32_t top = 0;
+    mmap_entry_t *entry = boot_get_memory_map(&count);
     
-    nframes = mem_end_page / PAGE_SIZE;
-    frames = (uint32_t*)kmalloc(INDEX_FROM_BIT(nframes));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t start, end;
+        if (entry->type == MMAP_TYPE_AVAILABLE && mmap_entry_range(entry, &start, &end) && end > top) {
+            top = end;
+        }
+        entry = (mmap_entry_t*)((uint32_t)entry + entry->size + sizeof(entry->size));
+    }
     
-    // Clear the frame bitmap
-    for (uint32_t i = 0; i < INDEX_FROM_BIT(nframes); i++) {
-        frames[i] = 0;
+    if (top) {
+        return top;
     }
     
-    // Create a page directory
+    // No memory map: fall back to the upper memory size (KB above 1MB)
+    uint32_t mem_lower, mem_upper;
+    boot_get_memory_info(&mem_lower, &mem_upper);
+    if (mem_upper) {
+        return 0x100000 + (mem_upper & ~3) * 1024;
+    }
+    
+    return 0x1000000; // Assume 16MB if the bootloader told us nothing
+}
+
+/* Hand usable RAM to the frame allocator, keeping reserved regions out */
+static void memory_setup_frames() {
+    uint32_t count;
+    mmap_entry_t *entry = boot_get_memory_map(&count);
+    
+    frame_init(mem_end / PAGE_SIZE);
+    
+    if (count) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t start, end;
+            if (entry->type == MMAP_TYPE_AVAILABLE && mmap_entry_range(entry, &start, &end)) {
+                frame_free_range(start, end);
+            }
+            entry = (mmap_entry_t*)((uint32_t)entry + entry->size + sizeof(entry->size));
+        }
+    } else {
+        frame_free_range(0x100000, mem_end);
+    }
+    
+    // The early region holds the BIOS data, the kernel image and every
+    // early allocation
+    frame_reserve_range(0, image_end);
+    frame_reserve_range(early_start, placement_limit);
+    
+    // Boot modules stay where the bootloader put them
+    multiboot_module_t *mods = boot_get_modules(&count);
+    for (uint32_t i = 0; i < count; i++) {
+        frame_reserve_range(mods[i].mod_start, mods[i].mod_end);
+    }
+}
+
+/* Map physical memory from start to end at a virtual base with 4MB or 4KB
+ * pages, in whole 4MB slots */
+static void paging_map_early(uint32_t virt_base, uint32_t start, uint32_t end) {
+    for (uint32_t phys = start & ~(LARGE_PAGE_SIZE - 1); phys < end; phys += LARGE_PAGE_SIZE) {
+        uint32_t table_idx = (virt_base + phys) / LARGE_PAGE_SIZE;
+        
+        if (large_pages) {
+            kernel_directory->tables[table_idx] = 0;
+            kernel_directory->tables_physical[table_idx] = phys | PDE_LARGE | PDE_RW | PDE_PRESENT;
+            continue;
+        }
+        
+        for (uint32_t off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE) {
+            page_t *page = get_page(virt_base + phys + off, 1, kernel_directory);
+            map_frame(page, (phys + off) / PAGE_SIZE, 1, 1);
+        }
+    }
+}
+
+/* Initialize paging */
+void paging_init() {
     uint32_t phys;
+    
+    // Create a page directory
     kernel_directory = (page_directory_t*)kmalloc_aligned_physical(sizeof(page_directory_t), &phys);
     
     // Clear the page directory
@@ -138,42 +222,370 @@ void paging_init() {
         kernel_directory->tables_physical[i] = 0;
     }
     
-    kernel_directory->physical_addr = phys;
+    // CR3 must point at the tables_physical array, not the structure start
+    kernel_directory->physical_addr = phys + offsetof(page_directory_t, tables_physical);
     
-    // Identity map the first 4MB
-    for (uint32_t i = 0; i < 0x400000; i += PAGE_SIZE) {
-        page_t *page = get_page(i, 1, kernel_directory);
-        alloc_frame(page, 0, 0);
-    }
+    // Size the frame allocator from the memory map
+    memory_setup_frames();
     
-    // Map some pages in the kernel heap area
-    for (uint32_t i = KERNEL_VIRTUAL_BASE; i < KERNEL_VIRTUAL_BASE + 0x400000; i += PAGE_SIZE) {
-        page_t *page = get_page(i, 1, kernel_directory);
-        alloc_frame(page, 0, 0);
+    // Use 4MB pages for the kernel unless the CPU lacks PSE or the
+    // kernel command line asks for 4KB pages with "nopse"
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    large_pages = (edx & CPUID_EDX_PSE) && !boot_has_option("nopse");
+    if (large_pages) {
+        write_cr4(read_cr4() | CR4_PSE);
     }
     
-    // Register page fault handler (to be implemented)
+    // Identity map the early region (kernel text, data and early
+    // allocations), and alias its low part at KERNEL_VIRTUAL_BASE as the
+    // physmap. Boot modules between the two parts are left to module_map()
+    paging_map_early(0, 0, image_end);
+    paging_map_early(0, early_start, placement_limit);
+    paging_map_early(KERNEL_VIRTUAL_BASE, 0, physmap_end);
+    
+    // Create the temporary mapping and MMIO tables now so every address
+    // space shares them
+    get_page(KMAP_BASE, 1, kernel_directory);
+    get_page(MMIO_BASE, 1, kernel_directory);
+    
+    // Register page fault handler
+    register_interrupt_handler(ISR_PAGE_FAULT, page_fault_handler);
     
-    // Enable paging
-    current_directory = kernel_directory;
+    // Load the kernel page directory
+    switch_page_directory(kernel_directory);
     
-    // Enable paging by setting CR0 bit 31
+    // Enable paging by setting CR0 bit 31, and make read-only pages
+    // read-only for the kernel too (CR0.WP) so copy-on-write holds
     uint32_t cr0;
     asm volatile("mov %%cr0, %0": "=r"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80010000;
     asm volatile("mov %0, %%cr0":: "r"(cr0));
     
-    terminal_writestring("Paging initialized\n");
+    terminal_writestring(large_pages ? "Paging initialized (4MB kernel pages)\n" : "Paging initialized (4KB kernel pages)\n");
+}
+
+/* Check whether the kernel is mapped with 4MB pages */
+int paging_large_pages_enabled() {
+    return large_pages;
+}
+
+/* Load a page directory into CR3 */
+void switch_page_directory(page_directory_t *dir) {
+    current_directory[cpu_id()] = dir;
+    asm volatile("mov %0, %%cr3":: "r"(dir->physical_addr));
+}
+
+/* Get the page directory loaded on this CPU */
+page_directory_t *paging_current_directory() {
+    return current_directory[cpu_id()];
+}
+
+/* Get the kernel page directory */
+page_directory_t *paging_kernel_directory() {
+    return kernel_directory;
+}
+
+/* Translate a mapped kernel virtual address to its physical address */
+uint32_t virt_to_phys(uint32_t address) {
+    page_directory_t *dir = paging_current_directory();
+    uint32_t pde = dir->tables_physical[address / LARGE_PAGE_SIZE];
+    if (pde & PDE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) + (address & (LARGE_PAGE_SIZE - 1));
+    }
+    
+    page_t *page = get_page(address, 0, dir);
+    if (!page || !page->present) {
+        return 0;
+    }
+    return (page->frame * PAGE_SIZE) + (address & (PAGE_SIZE - 1));
+}
+
+/* Check whether a directory entry is shared with the kernel directory */
+static int is_kernel_table(page_directory_t *dir, uint32_t idx) {
+    return dir->tables_physical[idx] == kernel_directory->tables_physical[idx];
+}
+
+/* Copy a user page table, sharing every frame copy-on-write */
+static page_table_t *clone_table(page_table_t *src, uint32_t *physical) {
+    page_table_t *table = (page_table_t*)kmalloc_aligned_physical(sizeof(page_table_t), physical);
+    
+    for (int i = 0; i < 1024; i++) {
+        page_t *page = &src->pages[i];
+        
+        // Pages shared with the kernel (system call rings) stay with
+        // the process that set them up
+        if (!page->present || page->dontfork) {
+            memset(&table->pages[i], 0, sizeof(page_t));
+            continue;
+        }
+        
+        // Writable pages become read-only in both spaces until written,
+        // except shared mappings, whose writes both spaces must see
+        if (!page->shared && (page->rw || page->cow)) {
+            page->rw = 0;
+            page->cow = 1;
+        }
+        
+        table->pages[i] = *page;
+        frame_ref(page->frame);
+    }
+    
+    return table;
+}
+
+/* Clone an address space: kernel tables are shared, user pages are COW */
+page_directory_t *clone_directory(page_directory_t *src) {
+    uint32_t phys;
+    page_directory_t *dir = (page_directory_t*)kmalloc_aligned_physical(sizeof(page_directory_t), &phys);
+    if (!dir) {
+        return 0;
+    }
+    
+    dir->physical_addr = virt_to_phys((uint32_t)dir->tables_physical);
+    
+    for (int i = 0; i < 1024; i++) {
+        if (!src->tables_physical[i] || is_kernel_table(src, i)) {
+            dir->tables[i] = src->tables[i];
+            dir->tables_physical[i] = src->tables_physical[i];
+        } else {
+            dir->tables[i] = clone_table(src->tables[i], &phys);
+            dir->tables_physical[i] = phys | PDE_USER | PDE_RW | PDE_PRESENT;
+        }
+    }
+    
+    // The source lost write access to its user pages; drop stale TLB entries
+    if (src == paging_current_directory()) {
+        switch_page_directory(src);
+    }
+    
+    return dir;
+}
+
+/* Free an address space and drop its references to user frames */
+void free_directory(page_directory_t *dir) {
+    if (dir == kernel_directory || dir == paging_current_directory()) {
+        return;
+    }
+    
+    for (int i = 0; i < 1024; i++) {
+        if (!dir->tables_physical[i] || is_kernel_table(dir, i)) {
+            continue;
+        }
+        
+        for (int j = 0; j < 1024; j++) {
+            free_frame(&dir->tables[i]->pages[j]);
+        }
+        kfree(dir->tables[i]);
+    }
+    
+    kfree(dir);
+}
+
+/* Map a frame into a temporary kernel slot */
+void *kmap_frame(uint32_t frame) {
+    uint32_t flags = spin_lock_irqsave(&kmap_lock);
+    
+    if (kmap_used == (1u << KMAP_SLOTS) - 1) {
+        terminal_writestring("PANIC: Out of kmap slots!\n");
+        for(;;);
+    }
+    
+    uint32_t slot = __builtin_ctz(~kmap_used);
+    kmap_used |= 1u << slot;
+    spin_unlock_irqrestore(&kmap_lock, flags);
+    
+    uint32_t addr = KMAP_BASE + slot * PAGE_SIZE;
+    map_frame(get_page(addr, 0, kernel_directory), frame, 1, 1);
+    invlpg(addr);
+    
+    return (void*)addr;
+}
+
+/* Release a temporary kernel slot */
+void kunmap_frame(void *addr) {
+    uint32_t slot = ((uint32_t)addr - KMAP_BASE) / PAGE_SIZE;
+    
+    get_page((uint32_t)addr, 0, kernel_directory)->present = 0;
+    invlpg((uint32_t)addr);
+    
+    uint32_t flags = spin_lock_irqsave(&kmap_lock);
+    kmap_used &= ~(1u << slot);
+    spin_unlock_irqrestore(&kmap_lock, flags);
+}
+
+/* Map device memory or firmware tables uncached into the MMIO window.
+ * Mappings are permanent; the window is only used during bring-up. */
+void *mmio_map(uint32_t phys, uint32_t size) {
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t npages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    
+    uint32_t flags = spin_lock_irqsave(&mmio_lock);
+    if (mmio_next + npages * PAGE_SIZE > MMIO_BASE + MMIO_SIZE) {
+        spin_unlock_irqrestore(&mmio_lock, flags);
+        return 0;
+    }
+    uint32_t virt = mmio_next;
+    mmio_next += npages * PAGE_SIZE;
+    spin_unlock_irqrestore(&mmio_lock, flags);
+    
+    for (uint32_t i = 0; i < npages; i++) {
+        page_t *page = get_page(virt + i * PAGE_SIZE, 0, kernel_directory);
+        map_frame(page, (phys / PAGE_SIZE) + i, 1, 1);
+        page->pcd = 1;
+        page->pwt = 1;
+        invlpg(virt + i * PAGE_SIZE);
+    }
+    
+    return (void*)(virt + offset);
+}
+
+/* Copy a module window entry into an address space cloned before the
+ * module was mapped; returns -1 if the kernel directory has none either */
+static int module_window_sync(uint32_t address) {
+    page_directory_t *dir = paging_current_directory();
+    uint32_t table_idx = address / LARGE_PAGE_SIZE;
+    
+    if (address < MODULE_BASE || address - MODULE_BASE >= MODULE_SIZE || dir == kernel_directory) {
+        return -1;
+    }
+    if (dir->tables_physical[table_idx] || !kernel_directory->tables_physical[table_idx]) {
+        return -1;
+    }
+    
+    // Shared with the kernel directory from now on, like the tables
+    // clone_directory() copies
+    dir->tables[table_idx] = kernel_directory->tables[table_idx];
+    dir->tables_physical[table_idx] = kernel_directory->tables_physical[table_idx];
+    return 0;
+}
+
+/* Map a boot module read-only into the module window without copying it.
+ * Only the kernel directory gets the entries; other address spaces pick
+ * them up on their first fault there */
+void *module_map(uint32_t phys, uint32_t size) {
+    // Whole 4MB slots, so a large module takes one directory entry per 4MB
+    uint32_t first = phys & ~(LARGE_PAGE_SIZE - 1);
+    uint32_t span = ALIGN_UP(phys - first + size, LARGE_PAGE_SIZE);
+    
+    uint32_t flags = spin_lock_irqsave(&module_lock);
+    if (size == 0 || span > MODULE_BASE + MODULE_SIZE - module_next) {
+        spin_unlock_irqrestore(&module_lock, flags);
+        return 0;
+    }
+    uint32_t virt = module_next;
+    module_next += span;
+    spin_unlock_irqrestore(&module_lock, flags);
+    
+    // The window was never mapped, so no TLB holds stale entries for it
+    for (uint32_t off = 0; off < span; off += LARGE_PAGE_SIZE) {
+        uint32_t table_idx = (virt + off) / LARGE_PAGE_SIZE;
+        
+        if (large_pages) {
+            kernel_directory->tables[table_idx] = 0;
+            kernel_directory->tables_physical[table_idx] = (first + off) | PDE_LARGE | PDE_PRESENT;
+            continue;
+        }
+        
+        for (uint32_t p = 0; p < LARGE_PAGE_SIZE; p += PAGE_SIZE) {
+            page_t *page = get_page(virt + off + p, 1, kernel_directory);
+            map_frame(page, (first + off + p) / PAGE_SIZE, 1, 0);
+        }
+    }
+    
+    return (void*)(virt + phys - first);
+}
+
+/* Give a faulting copy-on-write page its own writable frame */
+static void cow_break(page_t *page, uint32_t address) {
+    uint32_t page_addr = address & ~(PAGE_SIZE - 1);
+    uint32_t old_frame = page->frame;
+    
+    // Last reference: just take the page back
+    if (frame_refcount(old_frame) == 1) {
+        page->rw = 1;
+        page->cow = 0;
+        invlpg(page_addr);
+        return;
+    }
+    
+    uint32_t new_frame = frame_alloc();
+    if (new_frame == FRAME_NONE) {
+        terminal_writestring("PANIC: No free frames for copy-on-write!\n");
+        for(;;);
+    }
+    
+    void *copy = kmap_frame(new_frame);
+    memcpy(copy, (void*)page_addr, PAGE_SIZE);
+    kunmap_frame(copy);
+    
+    page->frame = new_frame;
+    page->rw = 1;
+    page->cow = 0;
+    invlpg(page_addr);
+    frame_free(old_frame);
+}
+
+/* Page fault handler */
+void page_fault_handler(registers_t *regs) {
+    uint32_t address;
+    asm volatile("mov %%cr2, %0" : "=r"(address));
+    trace_event(TRACE_FAULT_ENTRY, address);
+    
+    // Write to a present copy-on-write page
+    if ((regs->err_code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE)) {
+        page_t *page = get_page(address, 0, paging_current_directory());
+        if (page && page->present && page->cow) {
+            cow_break(page, address);
+            if (process_current()) {
+                process_current()->cow_faults++;
+            }
+            trace_event(TRACE_FAULT_EXIT, address);
+            return;
+        }
+    }
+    
+    // Kernel read of a module mapped after this address space was cloned
+    if (!(regs->err_code & (PF_PRESENT | PF_USER)) && module_window_sync(address) == 0) {
+        trace_event(TRACE_FAULT_EXIT, address);
+        return;
+    }
+    
+    // First touch of a reserved page
+    if (vm_handle_fault(address, regs->err_code) == 0) {
+        trace_event(TRACE_FAULT_EXIT, address);
+        return;
+    }
+    
+    terminal_writestring("Page fault at ");
+    terminal_writehex(address);
+    terminal_writestring(" (eip ");
+    terminal_writehex(regs->eip);
+    terminal_writestring((regs->err_code & PF_PRESENT) ? ", protection" : ", not present");
+    terminal_writestring((regs->err_code & PF_WRITE) ? ", write" : ", read");
+    terminal_writestring((regs->err_code & PF_USER) ? ", user)\n" : ", kernel)\n");
+    
+    if (regs->err_code & PF_USER) {
+        process_terminate();
+    }
+    
+    terminal_writestring("PANIC: Kernel page fault!\n");
+    for(;;);
 }
 
 /* Simple physical memory allocator for early boot */
 static void* early_kmalloc(size_t size, int align, uint32_t *phys) {
-    if (align == 1 && (placement_address & 0xFFFFF000)) {
+    if (align == 1 && (placement_address & 0xFFF)) {
         // Align the placement address
         placement_address &= 0xFFFFF000;
         placement_address += PAGE_SIZE;
     }
     
+    if (placement_address + size > placement_limit) {
+        terminal_writestring("PANIC: Early allocation region exhausted!\n");
+        for(;;);
+    }
+    
     if (phys) {
         *phys = placement_address;
     }
@@ -187,50 +599,188 @@ static void* early_kmalloc(size_t size, int align, uint32_t *phys) {
 void memory_init() {
     terminal_writestring("Initializing memory management...\n");
     
-    // Initialize early kmalloc
-    placement_address = 0x100000; // Start at 1MB
+    // Leave room for the page directory, page tables and per-frame
+    // metadata after the kernel image
+    mem_end = memory_detect();
+    image_end = ALIGN_UP((uint32_t)kernel_end, PAGE_SIZE);
+    uint32_t early_size = EARLY_REGION_SIZE + (mem_end / PAGE_SIZE) * 4;
+    
+    // Skip over any boot module in the way. Modules elsewhere are not part
+    // of the early region, so a large initrd doesn't grow it
+    early_start = image_end;
+    uint32_t count;
+    multiboot_module_t *mods = boot_get_modules(&count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (mods[i].mod_start < early_start + early_size && mods[i].mod_end > early_start) {
+            early_start = ALIGN_UP(mods[i].mod_end, PAGE_SIZE);
+            i = (uint32_t)-1; // Moved; check every module again
+        }
+    }
+    
+    // Identity map the early allocations up to the next 4MB boundary
+    placement_address = early_start;
+    placement_limit = ALIGN_UP(early_start + early_size, LARGE_PAGE_SIZE);
+    
+    // The physmap covers the early region while it is contiguous with the
+    // kernel image, or just the image's 4MB slots when a module sits between
+    physmap_end = placement_limit;
+    if ((early_start & ~(LARGE_PAGE_SIZE - 1)) > ALIGN_UP(image_end, LARGE_PAGE_SIZE)) {
+        physmap_end = ALIGN_UP(image_end, LARGE_PAGE_SIZE);
+    }
     
+
     // Initialize paging
     paging_init();
     
-    // Initialize heap (to be implemented)
+    // Initialize heap
+    heap_init();
     
     kmalloc_initialized = 1;
     
+    terminal_writestring("Physical memory: ");
+    terminal_writedec(frame_count_total() / 256);
+    terminal_writestring("MB managed, ");
+    terminal_writedec(frame_count_free() / 256);
+    terminal_writestring("MB free\n");
     terminal_writestring("Memory management initialized\n");
 }
 
+/* Allocate from the early region or the heap on behalf of a call site */
+static void* kmalloc_site(size_t size, int flags, uint32_t *physical, void *site) {
+    void *ptr;
+    
+    if (!kmalloc_initialized) {
+        ptr = early_kmalloc(size, flags & HEAP_ALIGN, physical);
+        if (flags & HEAP_ZERO) {
+            memset(ptr, 0, size);
+        }
+    } else {
+        ptr = heap_alloc(size, flags);
+        if (ptr && physical) {
+            *physical = virt_to_phys((uint32_t)ptr);
+        }
+    }
+    
+    kmtrace_alloc(ptr, size, site);
+    return ptr;
+}
+
 /* Kernel memory allocation */
 void* kmalloc(size_t size) {
-    return kmalloc_physical(size, 0);
+    return kmalloc_site(size, 0, 0, __builtin_return_address(0));
 }
 
 /* Aligned kernel memory allocation */
 void* kmalloc_aligned(size_t size) {
-    return kmalloc_aligned_physical(size, 0);
+    return kmalloc_site(size, HEAP_ALIGN, 0, __builtin_return_address(0));
 }
 
 /* Physical kernel memory allocation */
 void* kmalloc_physical(size_t size, uint32_t *physical) {
-    if (!kmalloc_initialized) {
-        return early_kmalloc(size, 0, physical);
-    }
-    
-    // Heap allocator to be implemented
-    return early_kmalloc(size, 0, physical);
+    return kmalloc_site(size, 0, physical, __builtin_return_address(0));
 }
 
 /* Aligned physical kernel memory allocation */
 void* kmalloc_aligned_physical(size_t size, uint32_t *physical) {
-    if (!kmalloc_initialized) {
-        return early_kmalloc(size, 1, physical);
-    }
-    
-    // Heap allocator to be implemented
-    return early_kmalloc(size, 1, physical);
+    return kmalloc_site(size, HEAP_ALIGN, physical, __builtin_return_address(0));
+}
+
+/* Page-aligned, zero-filled kernel memory allocation */
+void* kmalloc_aligned_zeroed(size_t size, uint32_t *physical) {
+    return kmalloc_site(size, HEAP_ALIGN | HEAP_ZERO, physical, __builtin_return_address(0));
+}
+
+/* Kernel memory allocation charged to another call site */
+void* kmalloc_from(size_t size, void *site) {
+    return kmalloc_site(size, 0, 0, site);
 }
 
 /* Kernel memory free */
 void kfree(void* ptr) {
-    // To be implemented with heap allocator
+    // Early allocations are permanent; only heap memory can be returned
+    if (!kmalloc_initialized || !heap_contains(ptr)) {
+        return;
+    }
+    
+    kmtrace_free(ptr);
+    heap_free(ptr);
+}
+
+/* Touch one cache line in every 4KB page of the physmap window */
+static uint32_t tlb_walk(uint32_t rounds, uint32_t *cycles) {
+    volatile uint8_t *base = (volatile uint8_t*)KERNEL_VIRTUAL_BASE;
+    uint32_t npages = physmap_end / PAGE_SIZE;
+    uint32_t sum = 0;
+    
+    uint64_t start = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t p = 0; p < npages; p++) {
+            // Vary the line offset so the data cache doesn't alias
+            sum += base[p * PAGE_SIZE + ((p * 64) & (PAGE_SIZE - 1))];
+        }
+    }
+    *cycles = (uint32_t)((rdtsc() - start) / ((uint64_t)rounds * npages));
+    
+    return sum;
+}
+
+/* Compare a TLB-heavy loop over the physmap with 4MB and 4KB pages */
+void paging_benchmark(uint32_t rounds) {
+    uint32_t first = KERNEL_VIRTUAL_BASE / LARGE_PAGE_SIZE;
+    uint32_t ntables = physmap_end / LARGE_PAGE_SIZE;
+    uint32_t cycles_large = 0, cycles_small = 0;
+    
+    if (rounds == 0) {
+        return;
+    }
+    
+    terminal_writestring("tlb: ");
+    terminal_writedec(physmap_end / PAGE_SIZE);
+    terminal_writestring(" pages x ");
+    terminal_writedec(rounds);
+    terminal_writestring(" rounds\n");
+    
+    if (!large_pages) {
+        tlb_walk(rounds, &cycles_small);
+        terminal_writestring("  4KB pages: ");
+        terminal_writedec(cycles_small);
+        terminal_writestring(" cycles/access (4MB pages disabled)\n");
+        return;
+    }
+    
+    tlb_walk(rounds, &cycles_large);
+    
+    // Temporarily back the physmap with 4KB page tables. The directory
+    // in use is edited, as the shell runs in a clone of the kernel's.
+    page_directory_t *dir = paging_current_directory();
+    page_table_t *tables[ntables];
+    uint32_t saved[ntables];
+    for (uint32_t t = 0; t < ntables; t++) {
+        uint32_t phys;
+        tables[t] = (page_table_t*)kmalloc_aligned_physical(sizeof(page_table_t), &phys);
+        memset(tables[t], 0, sizeof(page_table_t));
+        for (uint32_t i = 0; i < 1024; i++) {
+            map_frame(&tables[t]->pages[i], t * 1024 + i, 1, 1);
+        }
+        saved[t] = dir->tables_physical[first + t];
+        dir->tables_physical[first + t] = phys | PDE_RW | PDE_PRESENT;
+    }
+    switch_page_directory(dir);
+    
+    tlb_walk(rounds, &cycles_small);
+    
+    // Restore the 4MB mappings
+    for (uint32_t t = 0; t < ntables; t++) {
+        dir->tables_physical[first + t] = saved[t];
+    }
+    switch_page_directory(dir);
+    for (uint32_t t = 0; t < ntables; t++) {
+        kfree(tables[t]);
+    }
+    
+    terminal_writestring("  4MB pages: ");
+    terminal_writedec(cycles_large);
+    terminal_writestring(" cycles/access\n  4KB pages: ");
+    terminal_writedec(cycles_small);
+    terminal_writestring(" cycles/access\n");
 }
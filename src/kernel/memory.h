@@ -8,15 +8,46 @@
 #define PAGE_SIZE 4096
 #define KERNEL_VIRTUAL_BASE 0xC0000000
 #define KERNEL_PAGE_NUMBER (KERNEL_VIRTUAL_BASE >> 22)
+#define EARLY_REGION_SIZE 0x100000  // Early allocations beyond the per-frame metadata
+
+/* Page directory entry flags */
+#define PDE_PRESENT 0x001
+#define PDE_RW      0x002
+#define PDE_USER    0x004
+#define PDE_LARGE   0x080  // 4MB page (requires CR4.PSE)
+#define LARGE_PAGE_SIZE 0x400000
+
+/* Page fault error code bits */
+#define PF_PRESENT  0x1   // Fault on a present page (protection violation)
+#define PF_WRITE    0x2   // Fault caused by a write
+#define PF_USER     0x4   // Fault happened in user mode
+
+/* Temporary kernel mappings for frames outside the physmap */
+#define KMAP_BASE   0xFFC00000
+#define KMAP_SLOTS  16
+
+/* Read-only kernel mappings of boot modules (the initrd), used in place */
+#define MODULE_BASE 0xE0000000
+#define MODULE_SIZE 0x1F800000
+
+/* Uncached kernel mappings of device registers and firmware tables */
+#define MMIO_BASE   0xFF800000
+#define MMIO_SIZE   0x00400000
 
 /* Memory management structures */
 typedef struct page {
     uint32_t present    : 1;   // Page present in memory
     uint32_t rw         : 1;   // Read-only if clear, readwrite if set
     uint32_t user       : 1;   // Supervisor level only if clear
+    uint32_t pwt        : 1;   // Write-through caching
+    uint32_t pcd        : 1;   // Caching disabled
     uint32_t accessed   : 1;   // Has the page been accessed since last refresh?
     uint32_t dirty      : 1;   // Has the page been written to since last refresh?
-    uint32_t unused     : 7;   // Amalgamation of unused and reserved bits
+    uint32_t pat        : 1;   // Page attribute table index
+    uint32_t global     : 1;   // Not flushed on CR3 reload
+    uint32_t cow        : 1;   // Copy-on-write (available to the OS)
+    uint32_t dontfork   : 1;   // Left out of forked copies (available to the OS)
+    uint32_t shared     : 1;   // Shared file mapping, kept shared on fork (available to the OS)
     uint32_t frame      : 20;  // Frame address (shifted right 12 bits)
 } page_t;
 
@@ -43,8 +74,42 @@ void kfree(void* ptr);
 void* kmalloc_aligned(size_t size);
 void* kmalloc_physical(size_t size, uint32_t *physical);
 void* kmalloc_aligned_physical(size_t size, uint32_t *physical);
+void* kmalloc_aligned_zeroed(size_t size, uint32_t *physical);
+
+/* Allocate on behalf of the caller of an allocator built on kmalloc, so
+ * the profiler charges the allocation to that call site */
+void* kmalloc_from(size_t size, void *site);
+
+/* Page and frame management */
+page_t *get_page(uint32_t address, int make, page_directory_t *dir);
+void alloc_frame(page_t *page, int is_kernel, int is_writeable);
+void map_frame(page_t *page, uint32_t frame, int is_kernel, int is_writeable);
+void free_frame(page_t *page);
+void switch_page_directory(page_directory_t *dir);
+page_directory_t *paging_kernel_directory(void);
+uint32_t virt_to_phys(uint32_t address);
+int paging_large_pages_enabled(void);
+
+/* Address spaces */
+page_directory_t *clone_directory(page_directory_t *src);
+void free_directory(page_directory_t *dir);
+page_directory_t *paging_current_directory(void);
+
+/* Map a frame into a temporary kernel slot */
+void *kmap_frame(uint32_t frame);
+void kunmap_frame(void *addr);
+
+/* Map device memory or firmware tables uncached into the MMIO window */
+void *mmio_map(uint32_t phys, uint32_t size);
+
+/* Map a boot module read-only into the module window without copying it */
+void *module_map(uint32_t phys, uint32_t size);
+
+/* Compare a TLB-heavy loop over the physmap with 4MB and 4KB pages */
+void paging_benchmark(uint32_t rounds);
 
 /* Page fault handler */
-void page_fault_handler(void);
+struct registers;
+void page_fault_handler(struct registers *regs);
 
 #endif /* MEMORY_H */
@@ -1,103 +1,494 @@
 #include "process.h"
 #include "memory.h"
+#include "vm.h"
 #include "kernel.h"
+#include "interrupt.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "timer.h"
+#include "vdso.h"
+#include "sysring.h"
+#include "trace.h"
 #include <stdint.h>
 #include <string.h>
 
+/* Per-CPU scheduler state. A process on a run queue always has its
+ * context saved; a preempted or early-woken process is only queued by
+ * process_switch_tail() once it is off its CPU. */
+typedef struct {
+    process_t *current;            // Running process
+    process_t *idle;               // Runs when nothing is ready (APs only)
+    process_t *switch_prev;        // Switched away from, finished off by the next to run
+    runqueue_t rq;                 // Ready processes; the running process is never queued
+    spinlock_t lock;               // Protects rq and the state of processes on this CPU
+    uint32_t steals;               // Processes taken from other CPUs
+} cpu_sched_t;
+
 /* Process management globals */
-static process_t *current_process = NULL;
+static cpu_sched_t sched[MAX_CPUS];
 static process_t *process_list = NULL;
+static spinlock_t process_list_lock = SPINLOCK_INIT;
 static uint32_t next_pid = 1;
 
+/* Scheduler state of the executing CPU (interrupts off) */
+static cpu_sched_t *this_sched() {
+    return &sched[cpu_id()];
+}
+
+/* Queue a ready process behind others of its priority */
+static void rq_enqueue(runqueue_t *rq, process_t *process) {
+    uint32_t level = process->priority;
+    
+    process->run_next = NULL;
+    if (rq->tail[level]) {
+        rq->tail[level]->run_next = process;
+    } else {
+        rq->head[level] = process;
+    }
+    rq->tail[level] = process;
+    rq->bitmap |= 1u << level;
+    rq->nr_ready++;
+}
+
+/* Highest non-empty priority level, or -1 */
+static int rq_highest(runqueue_t *rq) {
+    return rq->bitmap ? __builtin_ctz(rq->bitmap) : -1;
+}
+
+/* Take the first process of a non-empty level */
+static process_t *rq_dequeue(runqueue_t *rq, uint32_t level) {
+    process_t *process = rq->head[level];
+    
+    rq->head[level] = process->run_next;
+    if (!rq->head[level]) {
+        rq->tail[level] = NULL;
+        rq->bitmap &= ~(1u << level);
+    }
+    process->run_next = NULL;
+    rq->nr_ready--;
+    
+    return process;
+}
+
+/* Take the best queued process allowed on a CPU, or NULL */
+static process_t *rq_take_for(runqueue_t *rq, uint32_t cpu) {
+    for (uint32_t levels = rq->bitmap; levels; levels &= levels - 1) {
+        uint32_t level = __builtin_ctz(levels);
+        process_t *prev = NULL;
+        
+        for (process_t *p = rq->head[level]; p; prev = p, p = p->run_next) {
+            if (!(p->cpu_mask & (1u << cpu))) {
+                continue;
+            }
+            if (!prev) {
+                return rq_dequeue(rq, level);
+            }
+            prev->run_next = p->run_next;
+            if (rq->tail[level] == p) {
+                rq->tail[level] = prev;
+            }
+            p->run_next = NULL;
+            rq->nr_ready--;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Clamp a requested priority to a valid level */
+static uint32_t clamp_priority(uint32_t priority) {
+    return priority < PROCESS_PRIORITIES ? priority : PROCESS_PRIORITIES - 1;
+}
+
+/* Pick the CPU a new process is queued on: this one if allowed */
+static uint32_t pick_cpu(uint32_t cpu_mask) {
+    uint32_t allowed = cpu_mask & smp_online_mask();
+    uint32_t self = cpu_id();
+    
+    if (!allowed || (allowed & (1u << self))) {
+        return self;
+    }
+    return __builtin_ctz(allowed);
+}
+
+/* Keep this CPU's timeslice timer armed only while a process is waiting
+ * for the CPU (interrupts off) */
+static void slice_update() {
+    cpu_sched_t *cs = this_sched();
+    timer_slice(cs->rq.nr_ready > 0 && cs->current && cs->current != cs->idle);
+}
+
+/* Let a CPU know a process was queued on it (interrupts off) */
+static void sched_kick(uint32_t cpu) {
+    if (cpu == cpu_id()) {
+        slice_update();
+    } else {
+        smp_send_resched(cpu);
+    }
+}
+
+/* Make a new process runnable on a CPU */
+static void sched_add(process_t *process, uint32_t cpu) {
+    cpu_sched_t *cs = &sched[cpu];
+    
+    uint32_t flags = spin_lock_irqsave(&cs->lock);
+    process->cpu = cpu;
+    rq_enqueue(&cs->rq, process);
+    spin_unlock(&cs->lock);
+    
+    sched_kick(cpu);
+    irq_restore(flags);
+}
+
+/* Add a process to the process list */
+static void process_list_add(process_t *process) {
+    uint32_t flags = spin_lock_irqsave(&process_list_lock);
+    process->pid = next_pid++;
+    process->next = process_list;
+    process_list = process;
+    spin_unlock_irqrestore(&process_list_lock, flags);
+}
+
 /* Initialize process management */
 void process_init() {
     terminal_writestring("Initializing process management...\n");
     
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        memset(&sched[i], 0, sizeof(cpu_sched_t));
+        spin_init(&sched[i].lock);
+    }
+    
     // Create initial kernel process
-    current_process = (process_t*)kmalloc(sizeof(process_t));
-    memset(current_process, 0, sizeof(process_t));
+    process_t *kernel = (process_t*)kmalloc(sizeof(process_t));
+    memset(kernel, 0, sizeof(process_t));
+    
+    kernel->pid = 0;
+    strcpy(kernel->name, "kernel");
+    kernel->state = PROCESS_STATE_RUNNING;
+    kernel->priority = 0;
+    kernel->cpu = cpu_id();
+    kernel->cpu_mask = 1u << cpu_id(); // Stays on the boot CPU and its stack
+    kernel->on_cpu = 1;
+    kernel->next = NULL;
     
-    current_process->pid = 0;
-    strcpy(current_process->name, "kernel");
-    current_process->state = PROCESS_STATE_RUNNING;
-    current_process->priority = 0;
-    current_process->next = NULL;
+    // The kernel process keeps running on the boot stack; its context is
+    // filled in the first time it is switched away from
     
-    // Set up kernel stack
-    current_process->stack = (uint32_t)kmalloc(4096) + 4096; // Stack grows downward
-    current_process->stack_size = 4096;
+    // Move off the boot directory into an address space of our own
+    kernel->page_directory = clone_directory(paging_kernel_directory());
+    kernel->context.cr3 = kernel->page_directory->physical_addr;
+    switch_page_directory(kernel->page_directory);
     
     // Add to process list
-    process_list = current_process;
+    process_list = kernel;
+    this_sched()->current = kernel;
     
     terminal_writestring("Process management initialized\n");
 }
 
+/* Set up the idle process of an application processor, on that CPU */
+void process_init_cpu(uint32_t cpu) {
+    process_t *idle = (process_t*)kmalloc(sizeof(process_t));
+    memset(idle, 0, sizeof(process_t));
+    
+    // The idle process runs on the AP's boot stack in the kernel
+    // directory; it is never queued and never on the process list
+    strcpy(idle->name, "idle/");
+    idle->name[5] = '0' + cpu;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->priority = PROCESS_PRIORITIES - 1;
+    idle->cpu = cpu;
+    idle->cpu_mask = 1u << cpu;
+    idle->on_cpu = 1;
+    idle->page_directory = paging_kernel_directory();
+    idle->context.cr3 = idle->page_directory->physical_addr;
+    switch_page_directory(idle->page_directory);
+    
+    sched[cpu].idle = idle;
+    sched[cpu].current = idle;
+}
+
 /* Create a new process */
 process_t* process_create(const char* name, uint32_t entry_point, uint32_t priority) {
+    return process_create_affinity(name, entry_point, priority, PROCESS_CPU_ALL);
+}
+
+/* Allocate a process control block and a kernel stack that starts at the
+ * entry point with one argument */
+static process_t* process_alloc(const char* name, uint32_t entry_point, uint32_t arg, uint32_t priority, uint32_t cpu_mask) {
     // Allocate process control block
     process_t *process = (process_t*)kmalloc(sizeof(process_t));
     memset(process, 0, sizeof(process_t));
     
     // Set up process information
-    process->pid = next_pid++;
     strncpy(process->name, name, 31);
     process->name[31] = '\0';
     process->state = PROCESS_STATE_READY;
-    process->priority = priority;
+    process->priority = clamp_priority(priority);
+    process->cpu_mask = cpu_mask;
     
     // Allocate stack
-    process->stack_size = 4096;
-    process->stack = (uint32_t)kmalloc(process->stack_size) + process->stack_size;
+    process->stack_size = PROCESS_STACK_SIZE;
+    process->stack = (uint32_t)kmalloc_aligned_zeroed(process->stack_size, 0) + process->stack_size;
     
-    // Set up initial context
+    // Initial switch frame: context_switch() pops edi, esi, ebx, ebp and
+    // returns into process_start, which calls the entry point in ebx with
+    // the argument in esi
+    uint32_t *sp = (uint32_t*)process->stack;
+    *--sp = (uint32_t)process_start;
+    *--sp = 0;              // ebp
+    *--sp = entry_point;    // ebx
+    *--sp = arg;            // esi
+    *--sp = 0;              // edi
     process->context.eip = entry_point;
-    process->context.eflags = 0x202; // Interrupt enabled
-    process->context.esp = process->stack;
+    process->context.esp = (uint32_t)sp;
     
-    // Create page directory (to be implemented)
+    return process;
+}
+
+/* Create a new process restricted to a set of CPUs */
+process_t* process_create_affinity(const char* name, uint32_t entry_point, uint32_t priority, uint32_t cpu_mask) {
+    process_t *process = process_alloc(name, entry_point, 0, priority, cpu_mask);
     
-    // Add to process list
-    process->next = process_list;
-    process_list = process;
+    // Create page directory
+    process->page_directory = clone_directory(paging_kernel_directory());
+    process->context.cr3 = process->page_directory->physical_addr;
+    
+    // Reserve heap and stack; frames are committed on first touch
+    vm_setup_process(process);
+    
+    // Add to process list and make it runnable; idle CPUs steal it
+    // from here if this one stays busy
+    process_list_add(process);
+    vdso_map(process);
+    sched_add(process, pick_cpu(cpu_mask));
     
     return process;
 }
 
+/* Create a kernel thread working in another process's address space */
+process_t* process_create_thread(const char* name, uint32_t entry_point, process_t* owner) {
+    process_t *thread = process_alloc(name, entry_point, 0, owner->priority, PROCESS_CPU_ALL);
+    
+    // Faults in user memory are resolved against the owner's areas; the
+    // thread has no vDSO pages of its own to map
+    thread->page_directory = owner->page_directory;
+    thread->context.cr3 = owner->context.cr3;
+    thread->mm_owner = owner;
+    
+    process_list_add(thread);
+    sched_add(thread, pick_cpu(thread->cpu_mask));
+    
+    return thread;
+}
+
+/* Create a kernel thread running fn(arg) in the kernel's address space */
+process_t* process_create_kernel(const char* name, void (*fn)(void*), void* arg, uint32_t priority, uint32_t cpu_mask) {
+    process_t *thread = process_alloc(name, (uint32_t)fn, (uint32_t)arg, priority, cpu_mask);
+    
+    // No user memory; reaping frees nothing for the kernel directory
+    thread->page_directory = paging_kernel_directory();
+    thread->context.cr3 = thread->page_directory->physical_addr;
+    
+    process_list_add(thread);
+    sched_add(thread, pick_cpu(cpu_mask));
+    
+    return thread;
+}
+
+/* Move the current thread off its owner's address space */
+void process_leave_mm() {
+    uint32_t flags = irq_save();
+    process_t *current = this_sched()->current;
+    
+    // Reaping frees nothing for the kernel directory
+    current->page_directory = paging_kernel_directory();
+    current->context.cr3 = current->page_directory->physical_addr;
+    current->mm_owner = NULL;
+    switch_page_directory(current->page_directory);
+    
+    irq_restore(flags);
+}
+
+/* Duplicate the current process */
+process_t* process_fork() {
+    process_t *parent = process_current();
+    registers_t *frame = parent ? (registers_t*)parent->syscall_frame : NULL;
+    
+    // The child resumes from the parent's trap frame, which only holds
+    // a complete context when the call came from user mode
+    if (!frame || (frame->cs & 3) == 0) {
+        return NULL;
+    }
+    
+    process_t *child = (process_t*)kmalloc(sizeof(process_t));
+    if (!child) {
+        return NULL;
+    }
+    memcpy(child, parent, sizeof(process_t));
+    
+    child->state = PROCESS_STATE_READY;
+    child->on_cpu = 0;
+    child->ring = NULL; // Not inherited (the ring pages are dontfork)
+    
+    // Fresh kernel stack
+    child->stack = (uint32_t)kmalloc_aligned_zeroed(child->stack_size, 0) + child->stack_size;
+    child->syscall_frame = NULL;
+    
+    // Share user memory copy-on-write
+    child->page_directory = clone_directory(parent->page_directory);
+    if (!child->page_directory) {
+        kfree((void*)(child->stack - child->stack_size));
+        kfree(child);
+        return NULL;
+    }
+    child->context.cr3 = child->page_directory->physical_addr;
+    
+    // The child's stack holds a copy of the parent's trap frame with
+    // eax = 0 (fork() returns 0 in the child), under a switch frame that
+    // returns into fork_return and from there out of the interrupt
+    registers_t *child_frame = (registers_t*)(child->stack - sizeof(registers_t));
+    *child_frame = *frame;
+    child_frame->eax = 0;
+    
+    uint32_t *sp = (uint32_t*)child_frame;
+    *--sp = (uint32_t)fork_return;
+    *--sp = 0;              // ebp
+    *--sp = 0;              // ebx
+    *--sp = 0;              // esi
+    *--sp = 0;              // edi
+    child->context.esp = (uint32_t)sp;
+    
+    // Same reservations, fresh fault counters
+    vm_clone_areas(child, parent);
+    child->minor_faults = 0;
+    child->major_faults = 0;
+    child->cow_faults = 0;
+    
+    // Add to process list and make it runnable; the child gets its
+    // own process page in place of the parent's
+    process_list_add(child);
+    vdso_map(child);
+    sched_add(child, pick_cpu(child->cpu_mask));
+    
+    return child;
+}
+
+/* Take a ready process this CPU may run from another CPU's queue */
+static process_t *sched_steal(uint32_t self) {
+    uint32_t online = smp_online_mask();
+    
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        uint32_t cpu = (self + i) % MAX_CPUS;
+        cpu_sched_t *victim = &sched[cpu];
+        
+        // Unlocked peek; a miss just waits for the next idle pass
+        if (!(online & (1u << cpu)) || victim->rq.nr_ready == 0) {
+            continue;
+        }
+        
+        spin_lock(&victim->lock);
+        process_t *process = rq_take_for(&victim->rq, self);
+        spin_unlock(&victim->lock);
+        
+        if (process) {
+            process->cpu = self;
+            sched[self].steals++;
+            return process;
+        }
+    }
+    
+    return NULL;
+}
+
 /* Schedule the next process to run */
 void process_schedule() {
-    if (!current_process) {
+    uint32_t flags = irq_save();
+    cpu_sched_t *cs = this_sched();
+    process_t *current = cs->current;
+    
+    if (!current) {
+        irq_restore(flags);
         return; // No processes to schedule
     }
     
-    // Simple round-robin scheduling
-    process_t *next = current_process->next;
-    if (!next) {
-        next = process_list; // Wrap around to start of list
+    spin_lock(&cs->lock);
+    
+    // Woken before it got off the CPU: just keep running
+    if (current->state == PROCESS_STATE_READY) {
+        current->state = PROCESS_STATE_RUNNING;
+    }
+    int runnable = current->state == PROCESS_STATE_RUNNING && current != cs->idle;
+    
+    // A running process keeps the CPU unless something of equal or
+    // higher priority is waiting; equal priorities take turns
+    process_t *next = NULL;
+    int level = rq_highest(&cs->rq);
+    if (level >= 0 && (!runnable || (uint32_t)level <= current->priority)) {
+        next = rq_dequeue(&cs->rq, level);
     }
     
-    // Skip processes that are not ready
-    while (next != current_process && next->state != PROCESS_STATE_READY) {
-        next = next->next;
-        if (!next) {
-            next = process_list; // Wrap around to start of list
-        }
+    spin_unlock(&cs->lock);
+    
+    // Nothing local and nothing to continue: pull work from busier CPUs
+    if (!next && !runnable) {
+        next = sched_steal(cpu_id());
+    }
+    if (!next && current->state != PROCESS_STATE_RUNNING) {
+        next = cs->idle;
     }
     
-    // If we found a different process that's ready, switch to it
-    if (next != current_process && next->state == PROCESS_STATE_READY) {
+    if (next) {
         process_switch(next);
     }
+    slice_update();
+    irq_restore(flags);
 }
 
-/* Block the current process */
-void process_block() {
-    if (!current_process) {
+/* Block the current process, then drop a lock if one is given */
+static void block_current(spinlock_t *lock) {
+    uint32_t flags = irq_save();
+    cpu_sched_t *cs = this_sched();
+    
+    if (!cs->current) {
+        if (lock) {
+            spin_unlock(lock);
+        }
+        irq_restore(flags);
         return;
     }
     
-    current_process->state = PROCESS_STATE_BLOCKED;
+    process_t *current = cs->current;
+    spin_lock(&cs->lock);
+    current->state = PROCESS_STATE_BLOCKED;
+    spin_unlock(&cs->lock);
+    
+    // A waker that takes the lock after this sees us blocked
+    if (lock) {
+        spin_unlock(lock);
+    }
+    
     process_schedule(); // Find another process to run
+    
+    // Nothing else to run and no idle process to switch to (the boot
+    // CPU): wait here until an interrupt wakes us or queues other work.
+    // sti takes effect after the hlt, so a wakeup cannot slip in between
+    while (current->state == PROCESS_STATE_BLOCKED) {
+        asm volatile("sti; hlt; cli");
+        process_schedule();
+    }
+    irq_restore(flags);
+}
+
+/* Block the current process */
+void process_block() {
+    block_current(NULL);
+}
+
+/* Block the current process and release a lock held with interrupts off */
+void process_block_unlock(spinlock_t *lock) {
+    block_current(lock);
 }
 
 /* Wake up a blocked process */
@@ -106,21 +497,47 @@ void process_wake(process_t* process) {
         return;
     }
     
+    // The process's CPU lock covers its state; one still switching out
+    // is queued by that CPU once its context is saved
+    uint32_t cpu = process->cpu;
+    cpu_sched_t *cs = &sched[cpu];
+    int queued = 0;
+    uint32_t flags = spin_lock_irqsave(&cs->lock);
     if (process->state == PROCESS_STATE_BLOCKED) {
         process->state = PROCESS_STATE_READY;
+        if (!process->on_cpu) {
+            rq_enqueue(&cs->rq, process);
+            queued = 1;
+        }
     }
+    spin_unlock(&cs->lock);
+    
+    if (queued) {
+        sched_kick(cpu);
+    }
+    irq_restore(flags);
 }
 
 /* Terminate the current process */
 void process_terminate() {
-    if (!current_process) {
-        return;
+    process_t *current = process_current();
+    
+    // A ring's polling thread works in our address space: stop it first
+    if (current) {
+        sysring_exit(current);
     }
     
-    // Mark as terminated
-    current_process->state = PROCESS_STATE_TERMINATED;
+    irq_save();
+    cpu_sched_t *cs = this_sched();
+    
+    if (!cs->current) {
+        return;
+    }
     
-    // Free resources (to be implemented)
+    // Mark as terminated; the next process to run frees our resources
+    spin_lock(&cs->lock);
+    cs->current->state = PROCESS_STATE_TERMINATED;
+    spin_unlock(&cs->lock);
     
     // Schedule another process
     process_schedule();
@@ -132,30 +549,272 @@ void process_terminate() {
 
 /* Get the current running process */
 process_t* process_current() {
-    return current_process;
+    uint32_t flags = irq_save();
+    process_t *current = this_sched()->current;
+    irq_restore(flags);
+    return current;
+}
+
+/* Get the head of the process list */
+process_t* process_get_list() {
+    return process_list;
+}
+
+/* Get the number of processes this CPU took from other CPUs' queues */
+uint32_t process_steal_count(uint32_t cpu) {
+    return cpu < MAX_CPUS ? sched[cpu].steals : 0;
+}
+
+/* Free an exited process; it must not be running */
+static void process_reap(process_t* process) {
+    // Unlink from the process list
+    uint32_t flags = spin_lock_irqsave(&process_list_lock);
+    process_t **link = &process_list;
+    while (*link && *link != process) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = process->next;
+    }
+    spin_unlock_irqrestore(&process_list_lock, flags);
+    
+    vm_free_areas(process);
+    free_directory(process->page_directory);
+    sysring_free(process);
+    kfree((void*)(process->stack - process->stack_size));
+    kfree(process);
+}
+
+/* Finish a switch on the new process's stack */
+void process_switch_tail() {
+    cpu_sched_t *cs = this_sched();
+    process_t *prev = cs->switch_prev;
+    cs->switch_prev = NULL;
+    
+    if (!prev) {
+        return;
+    }
+    
+    // prev's context is saved now: it may be queued (preempted, or woken
+    // while it was switching out) and run elsewhere
+    spin_lock(&cs->lock);
+    prev->on_cpu = 0;
+    if (prev->state == PROCESS_STATE_READY && prev != cs->idle) {
+        rq_enqueue(&cs->rq, prev);
+    }
+    spin_unlock(&cs->lock);
+    slice_update();
+    
+    if (prev->state == PROCESS_STATE_TERMINATED && prev->pid != 0) {
+        process_reap(prev);
+    }
 }
 
-/* Switch to a different process */
+/* Switch to a different process, which must not be queued */
 void process_switch(process_t* process) {
-    if (!process || process == current_process) {
+    uint32_t flags = irq_save();
+    cpu_sched_t *cs = this_sched();
+    process_t *old_process = cs->current;
+    
+    if (!process || process == old_process) {
+        irq_restore(flags);
         return;
     }
     
-    // Save current process state
-    if (current_process->state == PROCESS_STATE_RUNNING) {
-        current_process->state = PROCESS_STATE_READY;
+    // A preempted process goes back to the end of its level once
+    // process_switch_tail() has seen its context saved
+    spin_lock(&cs->lock);
+    if (old_process->state == PROCESS_STATE_RUNNING) {
+        old_process->state = PROCESS_STATE_READY;
     }
+    spin_unlock(&cs->lock);
     
     // Update current process
-    process_t *old_process = current_process;
-    current_process = process;
-    current_process->state = PROCESS_STATE_RUNNING;
+    process->state = PROCESS_STATE_RUNNING;
+    process->cpu = cpu_id();
+    process->on_cpu = 1;
+    cs->current = process;
+    
+    // Switch page directory if needed; kernel stacks live in the shared
+    // kernel heap, so both stacks stay mapped
+    if (process->context.cr3 != old_process->context.cr3) {
+        switch_page_directory(process->page_directory);
+    }
+    
+    // Traps and SYSENTER from user mode land on the new kernel stack
+    if (process->stack) {
+        tss_set_kernel_stack(process->stack);
+    }
+    
+    // Switch kernel stacks; this returns when old_process is picked
+    // again, possibly on another CPU
+    cs->switch_prev = old_process;
+    trace_event(TRACE_SWITCH, process->pid);
+    context_switch(&old_process->context.esp, process->context.esp);
+    process_switch_tail();
+    
+    irq_restore(flags);
+}
+
+/* Give up the CPU to the next ready process */
+void process_yield() {
+    uint32_t flags = irq_save();
+    process_schedule();
+    irq_restore(flags);
+}
+
+/* Picks timed by the scheduler benchmark */
+#define SCHED_BENCH_PICKS 10000
+
+/* Keeps the benchmark loops from being optimized away */
+static volatile uint32_t sched_bench_sink;
+
+/* Time picking the next process among many mostly-blocked ones */
+void process_schedule_benchmark(uint32_t nprocs) {
+    if (nprocs < 2) {
+        return;
+    }
+    
+    // Stand-in PCBs on a private queue; nothing here is ever run
+    process_t *procs = (process_t*)kmalloc(nprocs * sizeof(process_t));
+    runqueue_t *rq = (runqueue_t*)kmalloc(sizeof(runqueue_t));
+    if (!procs || !rq) {
+        terminal_writestring("sched: out of memory\n");
+        kfree(procs);
+        kfree(rq);
+        return;
+    }
+    memset(procs, 0, nprocs * sizeof(process_t));
+    memset(rq, 0, sizeof(runqueue_t));
+    
+    // One process in a hundred is ready, at a random priority
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < nprocs; i++) {
+        seed = seed * 1103515245 + 12345;
+        procs[i].pid = i;
+        procs[i].priority = (seed >> 16) % PROCESS_PRIORITIES;
+        procs[i].next = (i + 1 < nprocs) ? &procs[i + 1] : NULL;
+        if ((seed >> 8) % 100 == 0 || i == 0) {
+            procs[i].state = PROCESS_STATE_READY;
+            rq_enqueue(rq, &procs[i]);
+        } else {
+            procs[i].state = PROCESS_STATE_BLOCKED;
+        }
+    }
+    uint32_t ready = rq->nr_ready;
+    
+    uint32_t flags = irq_save();
+    
+    // Bitmap queues: pick the head of the best level and requeue it,
+    // as a timeslice rotation does
+    uint32_t sink = 0;
+    uint64_t start = rdtsc();
+    for (uint32_t r = 0; r < SCHED_BENCH_PICKS; r++) {
+        process_t *next = rq_dequeue(rq, rq_highest(rq));
+        rq_enqueue(rq, next);
+        sink += next->pid;
+    }
+    uint32_t fast = (uint32_t)((rdtsc() - start) / SCHED_BENCH_PICKS);
+    
+    // Reference: the old scan of the process list from the current entry
+    process_t *current = &procs[0];
+    start = rdtsc();
+    for (uint32_t r = 0; r < SCHED_BENCH_PICKS; r++) {
+        process_t *next = current->next ? current->next : procs;
+        while (next != current && next->state != PROCESS_STATE_READY) {
+            next = next->next ? next->next : procs;
+        }
+        current = next;
+        sink += next->pid;
+    }
+    uint32_t scan = (uint32_t)((rdtsc() - start) / SCHED_BENCH_PICKS);
+    
+    irq_restore(flags);
+    
+    terminal_writestring("sched: ");
+    terminal_writedec(nprocs);
+    terminal_writestring(" processes, ");
+    terminal_writedec(ready);
+    terminal_writestring(" ready\n  priority queues: ");
+    terminal_writedec(fast);
+    terminal_writestring(" cycles/pick\n  list scan:       ");
+    terminal_writedec(scan);
+    terminal_writestring(" cycles/pick\n");
+    
+    sched_bench_sink = sink;
+    kfree(rq);
+    kfree(procs);
+}
+
+/* Ping-pong benchmark state */
+static volatile uint32_t pingpong_left;
+static volatile uint32_t pingpong_done;
+static uint64_t pingpong_cycles;
+static process_t *pingpong_waiter;
+static spinlock_t pingpong_lock = SPINLOCK_INIT;
+
+/* Finish one side of the ping-pong; the lock keeps the wakeup from
+ * landing between the waiter's check and its block */
+static void pingpong_exit() {
+    uint32_t flags = spin_lock_irqsave(&pingpong_lock);
+    uint32_t done = ++pingpong_done;
+    spin_unlock(&pingpong_lock);
+    
+    if (done == 2) {
+        process_wake(pingpong_waiter);
+    }
+    irq_restore(flags);
+}
+
+/* Ping side: each pass is one round trip (two switches) */
+static void pingpong_ping() {
+    uint64_t start = rdtsc();
+    while (pingpong_left) {
+        pingpong_left--;
+        process_yield();
+    }
+    pingpong_cycles = rdtsc() - start;
+    pingpong_exit();
+}
+
+/* Pong side: hand the CPU straight back */
+static void pingpong_pong() {
+    while (pingpong_left) {
+        process_yield();
+    }
+    pingpong_exit();
+}
+
+/* Time switches between two processes that yield to each other */
+void process_switch_benchmark(uint32_t rounds) {
+    if (rounds == 0) {
+        return;
+    }
+    
+    terminal_writestring("switch: ");
+    terminal_writedec(rounds);
+    terminal_writestring(" ping-pong round trips\n");
+    
+    pingpong_left = rounds;
+    pingpong_done = 0;
+    pingpong_waiter = process_current();
+    
+    // Both sides stay on this CPU so every yield is a real switch
+    uint32_t mask = 1u << pingpong_waiter->cpu;
+    process_create_affinity("ping", (uint32_t)pingpong_ping, 0, mask);
+    process_create_affinity("pong", (uint32_t)pingpong_pong, 0, mask);
     
-    // Switch page directory if needed
-    if (current_process->context.cr3 != old_process->context.cr3) {
-        // Switch page directory (to be implemented)
+    // Sleep until both sides have exited
+    uint32_t flags = spin_lock_irqsave(&pingpong_lock);
+    while (pingpong_done < 2) {
+        process_block_unlock(&pingpong_lock);
+        spin_lock(&pingpong_lock);
     }
+    spin_unlock_irqrestore(&pingpong_lock, flags);
     
-    // Perform context switch (to be implemented in assembly)
-    // context_switch(&old_process->context, &current_process->context);
+    terminal_writestring("  ");
+    terminal_writedec((uint32_t)(pingpong_cycles / (2 * (uint64_t)rounds)));
+    terminal_writestring(" cycles/switch (");
+    terminal_writedec((uint32_t)(pingpong_cycles / rounds));
+    terminal_writestring(" per round trip)\n");
 }
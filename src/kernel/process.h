@@ -1,8 +1,22 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include "memory.h"
+#include "spinlock.h"
 #include <stdint.h>
 
+/* Kernel stack size of each process */
+#define PROCESS_STACK_SIZE 8192
+
+/* Priority levels; 0 is the highest */
+#define PROCESS_PRIORITIES 32
+
+/* Timer ticks a process runs before it is preempted */
+#define PROCESS_TIMESLICE  2
+
+/* Affinity mask allowing every CPU */
+#define PROCESS_CPU_ALL    0xFFFFFFFF
+
 /* Process states */
 typedef enum {
     PROCESS_STATE_READY,
@@ -11,7 +25,8 @@ typedef enum {
     PROCESS_STATE_TERMINATED
 } process_state_t;
 
-/* Process context structure */
+/* Process context structure. context_switch() keeps the registers on the
+ * kernel stack, so only esp (the saved stack pointer) and cr3 are live. */
 typedef struct {
     uint32_t eax;
     uint32_t ebx;
@@ -31,25 +46,73 @@ typedef struct process {
     uint32_t pid;                  // Process ID
     char name[32];                 // Process name
     process_state_t state;         // Current state
-    uint32_t priority;             // Scheduling priority
+    uint32_t priority;             // Scheduling priority (0 = highest)
     process_context_t context;     // CPU context
     uint32_t stack;                // Kernel stack location
     uint32_t stack_size;           // Stack size
+    page_directory_t *page_directory; // Address space
+    struct vm_area *vm_areas;      // Reserved user memory
+    uint32_t minor_faults;         // Faults resolved without I/O
+    uint32_t major_faults;         // Faults that read backing storage
+    uint32_t cow_faults;           // Copy-on-write faults
+    struct registers *syscall_frame; // Trap frame of the system call in progress
+    uint32_t cpu;                  // CPU it runs or is queued on
+    uint32_t cpu_mask;             // CPUs it may run on
+    volatile uint32_t on_cpu;      // Still on a CPU, context not yet saved
+    uint64_t wake_time;            // timer_now_ns() a sleep ends at
+    volatile uint32_t sleeping;    // On a sleep queue
+    struct process *sleep_next;    // Next sleeper, later deadline
+    struct process *mm_owner;      // Process whose address space a thread works in
+    struct sysring_ctx *ring;      // Batched system call ring, if set up
+    struct process *run_next;      // Next process in the run queue
     struct process *next;          // Next process in queue
 } process_t;
 
+/* Ready processes, one FIFO per priority level */
+typedef struct {
+    uint32_t bitmap;                          // Bit n set when level n is non-empty
+    process_t *head[PROCESS_PRIORITIES];
+    process_t *tail[PROCESS_PRIORITIES];
+    uint32_t nr_ready;                        // Processes queued
+} runqueue_t;
+
 /* Initialize process management */
 void process_init(void);
 
+/* Set up the idle process of an application processor, on that CPU */
+void process_init_cpu(uint32_t cpu);
+
 /* Create a new process */
 process_t* process_create(const char* name, uint32_t entry_point, uint32_t priority);
 
+/* Create a new process restricted to a set of CPUs */
+process_t* process_create_affinity(const char* name, uint32_t entry_point, uint32_t priority, uint32_t cpu_mask);
+
+/* Create a kernel thread working in another process's address space */
+process_t* process_create_thread(const char* name, uint32_t entry_point, process_t* owner);
+
+/* Create a kernel thread running fn(arg) in the kernel's address space */
+process_t* process_create_kernel(const char* name, void (*fn)(void*), void* arg, uint32_t priority, uint32_t cpu_mask);
+
+/* Move the current thread off its owner's address space, which may be
+ * freed once the owner learns the thread is done with it */
+void process_leave_mm(void);
+
+/* Duplicate the current process; the child shares memory copy-on-write */
+process_t* process_fork(void);
+
 /* Schedule the next process to run */
 void process_schedule(void);
 
 /* Block the current process */
 void process_block(void);
 
+/* Block the current process and release a lock taken with
+ * spin_lock_irqsave(); the caller restores interrupts after waking. A
+ * waker that queues work under the lock and calls process_wake() after
+ * dropping it cannot be missed */
+void process_block_unlock(spinlock_t *lock);
+
 /* Wake up a blocked process */
 void process_wake(process_t* process);
 
@@ -59,7 +122,30 @@ void process_terminate(void);
 /* Get the current running process */
 process_t* process_current(void);
 
+/* Get the head of the process list */
+process_t* process_get_list(void);
+
 /* Switch to a different process */
 void process_switch(process_t* process);
 
+/* Give up the CPU to the next ready process */
+void process_yield(void);
+
+/* Finish a switch on the new process's stack (reaps exited processes) */
+void process_switch_tail(void);
+
+/* Get the number of processes this CPU took from other CPUs' queues */
+uint32_t process_steal_count(uint32_t cpu);
+
+/* Time picking the next process among many mostly-blocked ones */
+void process_schedule_benchmark(uint32_t nprocs);
+
+/* Time switches between two processes that yield to each other */
+void process_switch_benchmark(uint32_t rounds);
+
+/* Assembly helpers (switch.s) */
+void context_switch(uint32_t *old_esp, uint32_t new_esp);
+void process_start(void);
+void fork_return(void);
+
 #endif /* PROCESS_H */
@@ -0,0 +1,59 @@
+#include "serial.h"
+#include "interrupt.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <string.h>
+
+/* UART registers, from the port base */
+#define UART_DATA        0  // Divisor low byte while DLAB is set
+#define UART_INT_ENABLE  1  // Divisor high byte while DLAB is set
+#define UART_FIFO        2
+#define UART_LINE_CTRL   3
+#define UART_MODEM_CTRL  4
+#define UART_LINE_STATUS 5
+
+/* Line status: transmit holding register empty */
+#define UART_TX_EMPTY    0x20
+
+/* Set up COM1 for 115200 baud, 8N1, polled */
+void serial_init() {
+    outb(SERIAL_COM1 + UART_INT_ENABLE, 0x00);  // No interrupts
+    outb(SERIAL_COM1 + UART_LINE_CTRL, 0x80);   // DLAB on to set the divisor
+    outb(SERIAL_COM1 + UART_DATA, 0x01);        // 115200 baud
+    outb(SERIAL_COM1 + UART_INT_ENABLE, 0x00);
+    outb(SERIAL_COM1 + UART_LINE_CTRL, 0x03);   // 8 bits, no parity, 1 stop bit
+    outb(SERIAL_COM1 + UART_FIFO, 0xC7);        // FIFOs on and cleared
+    outb(SERIAL_COM1 + UART_MODEM_CTRL, 0x03);  // DTR and RTS
+}
+
+/* Write bytes to COM1; with no UART fitted the status reads 0xFF, so this
+ * never waits forever */
+void serial_write(const void *data, uint32_t size) {
+    const uint8_t *bytes = (const uint8_t*)data;
+
+    for (uint32_t i = 0; i < size; i++) {
+        while (!(inb(SERIAL_COM1 + UART_LINE_STATUS) & UART_TX_EMPTY)) {
+            cpu_relax();
+        }
+        outb(SERIAL_COM1 + UART_DATA, bytes[i]);
+    }
+}
+
+/* Write a string to COM1 */
+void serial_writestring(const char *data) {
+    serial_write(data, strlen(data));
+}
+
+/* Write a decimal number to COM1 */
+void serial_writedec(uint32_t value) {
+    char buffer[11];
+    int i = 10;
+
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    serial_writestring(&buffer[i]);
+}
@@ -0,0 +1,19 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+/* First serial port */
+#define SERIAL_COM1 0x3F8
+
+/* Set up COM1 for 115200 baud, 8N1, polled */
+void serial_init(void);
+
+/* Write bytes to COM1, waiting for room in the transmitter */
+void serial_write(const void *data, uint32_t size);
+
+/* Write a string or a decimal number to COM1 */
+void serial_writestring(const char *data);
+void serial_writedec(uint32_t value);
+
+#endif /* SERIAL_H */
@@ -0,0 +1,307 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "process.h"
+#include "timer.h"
+#include "syscall.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The boot CPU finds the other processors in the ACPI MADT and starts each
+ * one with INIT and startup IPIs. An AP runs trampoline.s, loads the
+ * shared GDT and IDT, becomes the idle process of its own run queue and
+ * from then on takes work from the other CPUs' queues when it has none.
+ */
+
+/* How long to wait for an AP to report in after a startup IPI (us) */
+#define AP_START_TIMEOUT 100000
+
+/* CPUs running (bit n for CPU n); the boot CPU is CPU 0 */
+static volatile uint32_t online_mask = 1;
+static uint32_t cpu_count = 1;
+
+/* Local APIC ID of each CPU */
+static uint32_t apic_ids[MAX_CPUS];
+
+/* TLB shootdown: one at a time, CPUs still to flush in tlb_pending */
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile uint32_t tlb_pending = 0;
+
+/* Flush this CPU's TLB if the shootdown in flight asks for it */
+static void tlb_flush_check() {
+    uint32_t bit = 1u << cpu_id();
+
+    if (tlb_pending & bit) {
+        switch_page_directory(paging_current_directory()); // CR3 reload
+        __sync_fetch_and_and(&tlb_pending, ~bit);
+    }
+}
+
+/* TLB shootdown IPI handler */
+static void tlb_ipi_handler(registers_t *regs) {
+    (void)regs;
+    lapic_eoi();
+    tlb_flush_check();
+}
+
+/* Flush the TLBs of all other CPUs and wait for them */
+void smp_flush_tlb() {
+    uint32_t flags = irq_save();
+    uint32_t others = online_mask & ~(1u << cpu_id());
+
+    if (!others) {
+        irq_restore(flags);
+        return;
+    }
+
+    // Whoever holds the lock waits on us too, so keep answering it
+    while (!spin_trylock(&tlb_lock)) {
+        tlb_flush_check();
+        cpu_relax();
+    }
+
+    tlb_pending = others;
+    lapic_broadcast_ipi(ISR_IPI_TLB);
+    while (tlb_pending) {
+        cpu_relax();
+    }
+
+    spin_unlock(&tlb_lock);
+    irq_restore(flags);
+}
+
+/* Reschedule IPI handler: work was queued here from another CPU, or the
+ * timer mode changed */
+static void resched_ipi_handler(registers_t *regs) {
+    (void)regs;
+    lapic_eoi();
+    timer_reprogram();
+    process_schedule();
+}
+
+/* Make another CPU look at its run queue */
+void smp_send_resched(uint32_t cpu) {
+    if (cpu < MAX_CPUS && (online_mask & (1u << cpu)) && cpu != cpu_id()) {
+        lapic_send_ipi(apic_ids[cpu], ICR_ASSERT | ISR_IPI_RESCHED);
+    }
+}
+
+/* Make every other CPU reprogram its timer and reschedule */
+void smp_resched_all() {
+    if (online_mask & ~(1u << cpu_id())) {
+        lapic_broadcast_ipi(ISR_IPI_RESCHED);
+    }
+}
+
+/* First C code on an application processor */
+static void ap_main(uint32_t cpu) {
+    gdt_load(cpu);
+    idt_load();
+    syscall_init_cpu();
+    lapic_enable();
+    process_init_cpu(cpu);
+
+    __sync_fetch_and_or(&online_mask, 1u << cpu);
+
+    timer_init_local();
+    interrupts_enable();
+
+    // Idle loop: run or steal whatever is ready, else sleep until an
+    // interrupt. Interrupts stay off from the check to the hlt (sti takes
+    // effect after it) so a wakeup queued in between is not slept through
+    for (;;) {
+        interrupts_disable();
+        process_schedule();
+        asm volatile("sti; hlt");
+    }
+}
+
+/* Send INIT and startup IPIs to an AP and wait for it to come online */
+static int ap_start(uint32_t apic_id, uint32_t cpu) {
+    lapic_send_ipi(apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+    timer_udelay(10000);
+
+    // The second startup IPI is only for CPUs that missed the first
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lapic_send_ipi(apic_id, ICR_STARTUP | (TRAMPOLINE_BASE >> 12));
+        for (uint32_t waited = 0; waited < AP_START_TIMEOUT; waited += 100) {
+            if (online_mask & (1u << cpu)) {
+                return 0;
+            }
+            timer_udelay(100);
+        }
+    }
+
+    return -1;
+}
+
+/* Start the application processors listed in the ACPI MADT */
+void smp_init() {
+    terminal_writestring("Starting application processors...\n");
+
+    if (acpi_init() != 0) {
+        terminal_writestring("No ACPI MADT, running on one CPU\n");
+        return;
+    }
+
+    const acpi_madt_info_t *madt = acpi_get_madt();
+    if (lapic_init(madt->lapic_addr) != 0) {
+        terminal_writestring("Cannot map the local APIC, running on one CPU\n");
+        return;
+    }
+    apic_ids[0] = lapic_id();
+    register_interrupt_handler(ISR_IPI_TLB, tlb_ipi_handler);
+    register_interrupt_handler(ISR_IPI_RESCHED, resched_ipi_handler);
+
+    // Delays for the startup sequence and the APs' timers
+    timer_calibrate();
+    lapic_timer_calibrate();
+
+    // The trampoline page sits in identity-mapped low memory, which the
+    // frame allocator never hands out
+    uint32_t size = trampoline_end - trampoline_start;
+    memcpy((void*)TRAMPOLINE_BASE, trampoline_start, size);
+    trampoline_params_t *params = (trampoline_params_t*)(TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+
+    for (uint32_t i = 0; i < madt->ncpus && cpu_count < MAX_CPUS; i++) {
+        if (madt->apic_ids[i] == apic_ids[0]) {
+            continue; // The boot CPU
+        }
+
+        uint32_t cpu = cpu_count;
+        void *stack = kmalloc_aligned_zeroed(PROCESS_STACK_SIZE, 0);
+
+        params->cr3 = paging_kernel_directory()->physical_addr;
+        params->cr4 = read_cr4();
+        params->stack = (uint32_t)stack + PROCESS_STACK_SIZE;
+        params->entry = (uint32_t)ap_main;
+        params->cpu = cpu;
+
+        if (ap_start(madt->apic_ids[i], cpu) != 0) {
+            terminal_writestring("CPU with APIC ID ");
+            terminal_writedec(madt->apic_ids[i]);
+            terminal_writestring(" did not start\n");
+            kfree(stack);
+            continue;
+        }
+
+        apic_ids[cpu] = madt->apic_ids[i];
+        cpu_count++;
+    }
+
+    terminal_writedec(cpu_count);
+    terminal_writestring(cpu_count == 1 ? " CPU online\n" : " CPUs online\n");
+}
+
+/* Get the number of CPUs running */
+uint32_t smp_cpu_count() {
+    return cpu_count;
+}
+
+/* Get the mask of CPUs running */
+uint32_t smp_online_mask() {
+    return online_mask;
+}
+
+/* Get the local APIC ID of a running CPU */
+uint32_t smp_apic_id(uint32_t cpu) {
+    return cpu < cpu_count ? apic_ids[cpu] : apic_ids[0];
+}
+
+/* Workers per benchmark run; more than CPUs so stealing can balance */
+#define SMP_BENCH_WORKERS 16
+
+/* Scaling benchmark state */
+static volatile uint32_t bench_left;
+static uint32_t bench_iterations;
+static process_t *bench_waiter;
+static spinlock_t bench_lock = SPINLOCK_INIT;
+static volatile uint32_t bench_sink;
+
+/* Pure ALU work, no memory traffic to share */
+static void smp_bench_worker() {
+    uint32_t x = 1;
+
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        x = x * 1103515245 + 12345;
+    }
+    bench_sink = x;
+
+    // The waiter checks bench_left under the same lock before blocking,
+    // so the last worker's wakeup cannot slip in between
+    uint32_t flags = spin_lock_irqsave(&bench_lock);
+    uint32_t left = --bench_left;
+    spin_unlock(&bench_lock);
+
+    if (left == 0) {
+        process_wake(bench_waiter);
+    }
+    irq_restore(flags);
+}
+
+/* Run the same CPU-bound work on 1..N CPUs and report the speedup */
+void smp_benchmark(uint32_t work) {
+    uint32_t frequency = timer_get_frequency();
+    uint32_t base = 0;
+
+    bench_iterations = work / SMP_BENCH_WORKERS;
+    if (bench_iterations == 0) {
+        return;
+    }
+
+    terminal_writestring("smp: ");
+    terminal_writedec(SMP_BENCH_WORKERS);
+    terminal_writestring(" workers x ");
+    terminal_writedec(bench_iterations);
+    terminal_writestring(" iterations\n");
+
+    // CPUs are numbered densely from 0, so 1..n is mask (1 << n) - 1
+    for (uint32_t n = 1; n <= cpu_count; n++) {
+        uint32_t mask = (1u << n) - 1;
+
+        bench_left = SMP_BENCH_WORKERS;
+        bench_waiter = process_current();
+
+        uint32_t start = timer_get_ticks();
+        for (uint32_t w = 0; w < SMP_BENCH_WORKERS; w++) {
+            process_create_affinity("smpbench", (uint32_t)smp_bench_worker, 1, mask);
+        }
+
+        // Sleep until the last worker is done
+        uint32_t flags = spin_lock_irqsave(&bench_lock);
+        while (bench_left) {
+            process_block_unlock(&bench_lock);
+            spin_lock(&bench_lock);
+        }
+        spin_unlock_irqrestore(&bench_lock, flags);
+
+        uint32_t ticks = timer_get_ticks() - start;
+        if (ticks == 0) {
+            ticks = 1;
+        }
+        if (n == 1) {
+            base = ticks;
+        }
+
+        uint32_t speedup = (base * 100) / ticks;
+        terminal_writestring("  ");
+        terminal_writedec(n);
+        terminal_writestring(n == 1 ? " CPU:  " : " CPUs: ");
+        terminal_writedec(ticks * 1000 / frequency);
+        terminal_writestring(" ms, ");
+        terminal_writedec(speedup / 100);
+        terminal_writestring(".");
+        terminal_writedec((speedup % 100) / 10);
+        terminal_writedec(speedup % 10);
+        terminal_writestring("x, ");
+        terminal_writedec((uint32_t)((uint64_t)bench_iterations * SMP_BENCH_WORKERS * frequency / ticks / 1000000));
+        terminal_writestring(" M iterations/s\n");
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+/* Physical page the AP startup code is copied to (startup IPI vector 0x08) */
+#define TRAMPOLINE_BASE 0x8000
+
+/* Values the trampoline loads, at trampoline_params in the copy */
+typedef struct {
+    uint32_t cr3;       // Kernel page directory
+    uint32_t cr4;       // Boot CPU's CR4 (PSE)
+    uint32_t stack;     // Top of the AP's boot stack
+    uint32_t entry;     // ap_main
+    uint32_t cpu;       // Index the AP takes
+} trampoline_params_t;
+
+/* Start the application processors listed in the ACPI MADT */
+void smp_init(void);
+
+/* Get the number of CPUs running */
+uint32_t smp_cpu_count(void);
+
+/* Get the mask of CPUs running (bit n for CPU n) */
+uint32_t smp_online_mask(void);
+
+/* Get the local APIC ID of a running CPU (the boot CPU's for others) */
+uint32_t smp_apic_id(uint32_t cpu);
+
+/* Flush the TLBs of all other CPUs and wait for them; must be called
+ * without spinlocks held, since the other CPUs may be waiting on them */
+void smp_flush_tlb(void);
+
+/* Make another CPU look at its run queue */
+void smp_send_resched(uint32_t cpu);
+
+/* Make every other CPU reprogram its timer and reschedule */
+void smp_resched_all(void);
+
+/* Run the same CPU-bound work on 1..N CPUs and report the speedup */
+void smp_benchmark(uint32_t work);
+
+/* Trampoline code (trampoline.s) */
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_end[];
+extern uint8_t trampoline_params[];
+
+#endif /* SMP_H */
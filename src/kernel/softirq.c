@@ -0,0 +1,91 @@
+#include "softirq.h"
+#include "process.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "cpu.h"
+#include "kernel.h"
+#include <stdint.h>
+
+/* Per-CPU softirq state */
+typedef struct {
+    volatile uint32_t pending;   // Raised softirqs (bit n for softirq n)
+    process_t *thread;           // ksoftirqd/N, NULL until softirq_init()
+    uint32_t runs;               // Handlers run
+} softirq_cpu_t;
+
+static softirq_fn_t softirq_handlers[SOFTIRQ_COUNT];
+static softirq_cpu_t softirq_cpus[MAX_CPUS];
+
+/* Set the handler of a softirq */
+void softirq_register(uint32_t nr, softirq_fn_t fn) {
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = fn;
+    }
+}
+
+/* Mark a softirq pending on this CPU and wake its thread */
+void softirq_raise(uint32_t nr) {
+    uint32_t flags = irq_save();
+    softirq_cpu_t *sc = &softirq_cpus[cpu_id()];
+
+    sc->pending |= 1u << nr;
+    process_wake(sc->thread);
+
+    irq_restore(flags);
+}
+
+/* Leave an interrupt: switch to ksoftirqd if the handler raised work */
+void softirq_interrupt_exit() {
+    softirq_cpu_t *sc = &softirq_cpus[cpu_id()];
+
+    if (sc->pending && sc->thread && process_current() != sc->thread) {
+        process_schedule();
+    }
+}
+
+/* Per-CPU softirq thread */
+static void ksoftirqd(void *arg) {
+    softirq_cpu_t *sc = &softirq_cpus[(uint32_t)arg];
+
+    for (;;) {
+        // Interrupts stay off from the check until we are blocked, so a
+        // softirq raised on this CPU in between is not slept through
+        interrupts_disable();
+        uint32_t pending = sc->pending;
+        sc->pending = 0;
+        if (!pending) {
+            process_block();
+            continue;
+        }
+        interrupts_enable();
+
+        while (pending) {
+            uint32_t nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+                sc->runs++;
+            }
+        }
+    }
+}
+
+/* Start a ksoftirqd thread on every CPU running */
+void softirq_init() {
+    uint32_t online = smp_online_mask();
+    char name[16] = "ksoftirqd/";
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(online & (1u << cpu))) {
+            continue;
+        }
+        name[10] = '0' + cpu;
+        name[11] = '\0';
+        softirq_cpus[cpu].thread = process_create_kernel(name, ksoftirqd, (void*)cpu, 0, 1u << cpu);
+    }
+}
+
+/* Get the number of softirq handlers run on a CPU */
+uint32_t softirq_run_count(uint32_t cpu) {
+    return cpu < MAX_CPUS ? softirq_cpus[cpu].runs : 0;
+}
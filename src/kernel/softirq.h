@@ -0,0 +1,39 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+
+/*
+ * Deferred interrupt work. An interrupt handler does only what cannot
+ * wait (acknowledge the device, take the data off it) and raises a
+ * softirq; the rest runs with interrupts on in a per-CPU kernel thread,
+ * ksoftirqd/N. The thread has the highest priority and the interrupt that
+ * raised the softirq switches to it on the way out, so the work still
+ * runs before anything else on that CPU.
+ */
+
+/* Softirq numbers; pending ones run lowest first */
+#define SOFTIRQ_NET_RX  0   // Received packets (network.c)
+#define SOFTIRQ_BENCH   7   // Deferred work benchmark
+#define SOFTIRQ_COUNT   8
+
+/* Softirq handler, run in ksoftirqd with interrupts on */
+typedef void (*softirq_fn_t)(void);
+
+/* Set the handler of a softirq */
+void softirq_register(uint32_t nr, softirq_fn_t fn);
+
+/* Mark a softirq pending on this CPU and wake its thread; callable from
+ * interrupt handlers */
+void softirq_raise(uint32_t nr);
+
+/* Leave an interrupt: switch to ksoftirqd if the handler raised work */
+void softirq_interrupt_exit(void);
+
+/* Start a ksoftirqd thread on every CPU running */
+void softirq_init(void);
+
+/* Get the number of softirq handlers run on a CPU */
+uint32_t softirq_run_count(uint32_t cpu);
+
+#endif /* SOFTIRQ_H */
@@ -0,0 +1,52 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "cpu.h"
+#include <stdint.h>
+
+/* Test-and-set spinlock */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+/* Initialize a spinlock */
+static inline void spin_init(spinlock_t *lock) {
+    lock->locked = 0;
+}
+
+/* Acquire a spinlock */
+static inline void spin_lock(spinlock_t *lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        // Spin on a plain read so the cache line stays shared
+        while (lock->locked) {
+            asm volatile("pause");
+        }
+    }
+}
+
+/* Try to acquire a spinlock without waiting; nonzero on success */
+static inline int spin_trylock(spinlock_t *lock) {
+    return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+/* Release a spinlock */
+static inline void spin_unlock(spinlock_t *lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+/* Disable interrupts and acquire a spinlock */
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+/* Release a spinlock and restore the interrupt state */
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif /* SPINLOCK_H */
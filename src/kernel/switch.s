@@ -0,0 +1,55 @@
+# MinOS context switch
+
+.section .text
+
+# void context_switch(uint32_t *old_esp, uint32_t new_esp)
+#
+# Saves the callee-saved registers on the current kernel stack, stores the
+# stack pointer in *old_esp, then switches to new_esp and restores the
+# registers saved there. The caller-saved registers are already saved by
+# the C calling convention, so this is all a switch needs.
+.global context_switch
+.type context_switch, @function
+context_switch:
+    mov 4(%esp), %eax           # old_esp
+    mov 8(%esp), %edx           # new_esp
+
+    push %ebp
+    push %ebx
+    push %esi
+    push %edi
+
+    mov %esp, (%eax)
+    mov %edx, %esp
+
+    pop %edi
+    pop %esi
+    pop %ebx
+    pop %ebp
+    ret
+.size context_switch, . - context_switch
+
+# First code run by a new kernel process. process_create() leaves the entry
+# point in %ebx and its argument in %esi; the first context_switch() into
+# the process returns here.
+.global process_start
+.type process_start, @function
+process_start:
+    call process_switch_tail    # Finish the switch that brought us here
+    sti
+    push %esi
+    call *%ebx
+    add $4, %esp
+    call process_terminate      # Entry point returned: exit
+1:  hlt
+    jmp 1b
+.size process_start, . - process_start
+
+# First code run by a forked child. Its stack holds a copy of the parent's
+# trap frame, which interrupt_return restores on the way back to user mode.
+.global fork_return
+.type fork_return, @function
+fork_return:
+    call process_switch_tail
+    jmp interrupt_return
+.size fork_return, . - fork_return
@@ -2,41 +2,83 @@
 #include "interrupt.h"
 #include "kernel.h"
 #include "process.h"
+#include "vm.h"
+#include "timer.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "frame.h"
+#include "vdso.h"
+#include "sysring.h"
+#include "trace.h"
+#include "../fs/file.h"
 #include <stdint.h>
+#include <string.h>
 
 /* System call handler function pointers */
 static void* syscall_handlers[256] = {0};
 
+/* SYSENTER/SYSEXIT available on this machine */
+static int sysenter_supported = 0;
+
 /* System call handler */
-void syscall_handler() {
-    // Get the system call number from EAX
-    uint32_t syscall_num;
-    asm volatile("mov %%eax, %0" : "=r" (syscall_num));
-    
-    // Get arguments from other registers
-    uint32_t arg1, arg2, arg3, arg4, arg5;
-    asm volatile("mov %%ebx, %0" : "=r" (arg1));
-    asm volatile("mov %%ecx, %0" : "=r" (arg2));
-    asm volatile("mov %%edx, %0" : "=r" (arg3));
-    asm volatile("mov %%esi, %0" : "=r" (arg4));
-    asm volatile("mov %%edi, %0" : "=r" (arg5));
+void syscall_handler(registers_t* regs) {
+    // The system call number is in EAX, arguments in EBX, ECX, EDX, ESI, EDI, EBP
+    uint32_t syscall_num = regs->eax;
     
     // Check if the system call is valid
     if (syscall_num >= 256 || syscall_handlers[syscall_num] == 0) {
         // Invalid system call
         terminal_writestring("Invalid system call: ");
-        // Print syscall number
+        terminal_writedec(syscall_num);
         terminal_writestring("\n");
+        regs->eax = (uint32_t)-1;
         return;
     }
     
-    // Call the system call handler
-    typedef int (*syscall_fn_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
-    syscall_fn_t handler = (syscall_fn_t)syscall_handlers[syscall_num];
-    int result = handler(arg1, arg2, arg3, arg4, arg5);
+    // Record the trap frame (fork copies it) and call the handler
+    process_t* current = process_current();
+    if (current) {
+        current->syscall_frame = regs;
+    }
+    
+    uint32_t args[6] = { regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi, regs->ebp };
+    trace_event(TRACE_SYSCALL_ENTRY, syscall_num);
+    int result = syscall_dispatch(syscall_num, args);
+    trace_event(TRACE_SYSCALL_EXIT, syscall_num);
+    
+    // Set the return value in the saved EAX
+    regs->eax = result;
+}
+
+/* Run a registered system call; the trap path and the batched rings
+ * (sysring.c) both come through here */
+int syscall_dispatch(uint32_t num, const uint32_t* args) {
+    if (num >= 256 || syscall_handlers[num] == 0) {
+        return -1;
+    }
+    
+    // Handlers taking fewer arguments ignore the extra ones (cdecl)
+    typedef int (*syscall_fn_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+    syscall_fn_t handler = (syscall_fn_t)syscall_handlers[num];
+    return handler(args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+/* SYSENTER entry (sysenter.s): complete the trap frame from the user stack,
+ * which holds the sixth argument and the return address, and dispatch */
+void sysenter_handler(registers_t* regs) {
+    uint32_t user_stack[2];
+    
+    // Nowhere valid to return to: treat it like any other bad user access
+    if (copy_from_user(user_stack, regs->useresp, sizeof(user_stack)) != 0) {
+        terminal_writestring("sysenter: bad user stack, terminating\n");
+        process_terminate();
+    }
+    
+    regs->ebp = user_stack[0];
+    regs->eip = user_stack[1];
+    regs->useresp += 8; // Back where the caller was
     
-    // Set the return value in EAX
-    asm volatile("mov %0, %%eax" : : "r" (result));
+    syscall_handler(regs);
 }
 
 /* Register a system call handler */
@@ -46,6 +88,25 @@ void register_syscall(uint32_t num, void* handler) {
     }
 }
 
+/* Check that a user buffer is mapped in user space, and writable if the
+ * kernel is to write into it, so touching it cannot fault */
+static int user_buffer_ok(uint32_t addr, uint32_t size, int write) {
+    return vm_check_user(addr, size, write) == 0;
+}
+
+/* Check that a user string is mapped up to its terminator, one page at a
+ * time before the bytes on it are read */
+static int user_string_ok(uint32_t addr) {
+    for (uint32_t p = addr; ; p++) {
+        if ((p == addr || (p & (PAGE_SIZE - 1)) == 0) && vm_check_user(p, 1, 0) != 0) {
+            return 0;
+        }
+        if (*(const char*)p == '\0') {
+            return 1;
+        }
+    }
+}
+
 /* System call implementations */
 
 /* Exit system call */
@@ -64,9 +125,21 @@ static int sys_getpid(uint32_t unused1, uint32_t unused2, uint32_t unused3, uint
     return 0;
 }
 
-/* Write system call (simplified) */
+/* Fork system call */
+static int sys_fork(uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4, uint32_t unused5) {
+    process_t* child = process_fork();
+    if (!child) {
+        return -1;
+    }
+    return child->pid;
+}
+
+/* Write system call; fd 1 is the terminal */
 static int sys_write(uint32_t fd, uint32_t buffer, uint32_t size, uint32_t unused1, uint32_t unused2) {
-    // Only support stdout (fd 1) for now
+    if (!user_buffer_ok(buffer, size, 0)) {
+        return -1;
+    }
+    
     if (fd == 1) {
         const char* buf = (const char*)buffer;
         for (uint32_t i = 0; i < size; i++) {
@@ -74,7 +147,80 @@ static int sys_write(uint32_t fd, uint32_t buffer, uint32_t size, uint32_t unuse
         }
         return size;
     }
-    return -1;
+    return file_write((int)fd, (const void*)buffer, size);
+}
+
+/* Read system call */
+static int sys_read(uint32_t fd, uint32_t buffer, uint32_t size, uint32_t unused1, uint32_t unused2) {
+    if (!user_buffer_ok(buffer, size, 1)) {
+        return -1;
+    }
+    return file_read((int)fd, (void*)buffer, size);
+}
+
+/* Open system call */
+static int sys_open(uint32_t path, uint32_t flags, uint32_t unused1, uint32_t unused2, uint32_t unused3) {
+    if (!user_string_ok(path)) {
+        return -1;
+    }
+    return file_open((const char*)path, flags);
+}
+
+/* Close system call */
+static int sys_close(uint32_t fd, uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4) {
+    return file_close((int)fd);
+}
+
+/* Time system call: ticks since boot */
+static int sys_time(uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4, uint32_t unused5) {
+    return (int)timer_get_ticks();
+}
+
+/* Sleep system call: block for a number of milliseconds */
+static int sys_sleep(uint32_t ms, uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4) {
+    // Sleep in chunks timer_usleep() can count in microseconds
+    while (ms > 1000000) {
+        timer_usleep(1000000000);
+        ms -= 1000000;
+    }
+    timer_usleep(ms * 1000);
+    return 0;
+}
+
+/* Map memory system call: the offset is the sixth argument, in EBP */
+static int sys_mmap(uint32_t addr, uint32_t length, uint32_t prot, uint32_t flags, uint32_t fd, uint32_t offset) {
+    fs_node_t* node = NULL;
+    
+    if (!(flags & MAP_ANONYMOUS)) {
+        node = file_get_node((int)fd);
+        if (!node) {
+            return -1;
+        }
+        
+        // Shared writable mappings need a file opened for writing
+        int mode = file_get_flags((int)fd);
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(mode & (O_WRONLY | O_RDWR))) {
+            return -1;
+        }
+    }
+    
+    return (int)vm_map(process_current(), addr, length, prot, flags, node, offset);
+}
+
+/* Unmap memory system call */
+static int sys_munmap(uint32_t addr, uint32_t length, uint32_t unused1, uint32_t unused2, uint32_t unused3) {
+    length = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    return vm_release(process_current(), addr, length);
+}
+
+/* Set up a batched system call ring */
+static int sys_ring_setup(uint32_t flags, uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4) {
+    return sysring_setup(flags);
+}
+
+/* Run the calls queued on the ring */
+static int sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, uint32_t unused1, uint32_t unused2) {
+    return sysring_enter(to_submit, min_complete, flags);
 }
 
 /* Initialize system call interface */
@@ -83,11 +229,195 @@ void syscall_init() {
     
     // Register system call handlers
     register_syscall(SYS_EXIT, sys_exit);
+    register_syscall(SYS_FORK, sys_fork);
     register_syscall(SYS_GETPID, sys_getpid);
+    register_syscall(SYS_READ, sys_read);
     register_syscall(SYS_WRITE, sys_write);
+    register_syscall(SYS_OPEN, sys_open);
+    register_syscall(SYS_CLOSE, sys_close);
+    register_syscall(SYS_SLEEP, sys_sleep);
+    register_syscall(SYS_TIME, sys_time);
+    register_syscall(SYS_MMAP, sys_mmap);
+    register_syscall(SYS_MUNMAP, sys_munmap);
+    register_syscall(SYS_RING_SETUP, sys_ring_setup);
+    register_syscall(SYS_RING_ENTER, sys_ring_enter);
     
     // Register interrupt handler for system calls (using int 0x80)
-    register_interrupt_handler(0x80, syscall_handler);
+    register_interrupt_handler(ISR_SYSCALL, syscall_handler);
+    
+    // The Pentium Pro reports SEP without implementing it
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    sysenter_supported = (edx & CPUID_EDX_SEP) && !(family == 6 && model < 3 && stepping < 3);
+    syscall_init_cpu();
     
     terminal_writestring("System call interface initialized\n");
 }
+
+/* Set up the fast system call entry on this CPU */
+void syscall_init_cpu() {
+    if (!sysenter_supported) {
+        return;
+    }
+    
+    // SYSEXIT derives the user selectors from the kernel code selector
+    // (+16 and +24), which is how the GDT is laid out
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, tss_kernel_stack_slot(cpu_id()));
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+/* Check whether the fast system call entry is in use */
+int syscall_sysenter_supported() {
+    return sysenter_supported;
+}
+
+/* User page the benchmark code runs from: code at the start, the result
+ * block at the end */
+#define USERBENCH_PAGE    USER_HEAP_START
+
+/* Most stack arguments a benchmark takes after the result block */
+#define USERBENCH_ARGS    4
+
+/* How long to wait for a benchmark process (10ms polls) */
+#define USERBENCH_TIMEOUT 3000
+
+/* What the benchmark process is to run */
+static const uint8_t *userbench_code;
+static uint32_t userbench_code_size;
+static uint32_t userbench_result_size;
+static uint32_t userbench_args[USERBENCH_ARGS];
+static uint32_t userbench_nargs;
+static volatile uint32_t userbench_frame;
+
+/* Kernel side of a benchmark process: load the user code and stack, then
+ * drop to ring 3; the user code exits on its own */
+static void userbench_main() {
+    process_t *self = process_current();
+    uint32_t results = USERBENCH_PAGE + PAGE_SIZE - userbench_result_size;
+    
+    // The writes commit the code page and the top of the user stack
+    memcpy((void*)USERBENCH_PAGE, userbench_code, userbench_code_size);
+    memset((void*)results, 0, userbench_result_size);
+    
+    uint32_t *stack = (uint32_t*)USER_STACK_TOP;
+    for (uint32_t i = userbench_nargs; i > 0; i--) {
+        *--stack = userbench_args[i - 1];
+    }
+    *--stack = results;
+    *--stack = 0; // Return address
+    
+    // Keep the page after we exit so the results can be read
+    uint32_t flags = irq_save();
+    page_t *page = get_page(USERBENCH_PAGE, 0, self->page_directory);
+    frame_ref(page->frame);
+    userbench_frame = page->frame;
+    irq_restore(flags);
+    
+    user_enter(USERBENCH_PAGE, (uint32_t)stack);
+}
+
+/* Run position independent ring 3 code in a new process and copy out the
+ * result block it leaves at the end of its page */
+int syscall_run_user(const char* name, const uint8_t* start, const uint8_t* end,
+                     const uint32_t* args, uint32_t nargs, void* results, uint32_t size) {
+    if (nargs > USERBENCH_ARGS || size < sizeof(uint32_t) || size > PAGE_SIZE - (uint32_t)(end - start)) {
+        return -1;
+    }
+    
+    userbench_code = start;
+    userbench_code_size = end - start;
+    userbench_result_size = size;
+    memcpy(userbench_args, args, nargs * sizeof(uint32_t));
+    userbench_nargs = nargs;
+    userbench_frame = 0;
+    
+    process_create(name, (uint32_t)userbench_main, 1);
+    
+    // The user code's last store before it exits is the block's last word
+    uint8_t *block = NULL;
+    volatile uint32_t *done = NULL;
+    void *mapped = NULL;
+    for (uint32_t waited = 0; waited < USERBENCH_TIMEOUT; waited++) {
+        timer_usleep(10000);
+        if (!userbench_frame) {
+            continue;
+        }
+        if (!mapped) {
+            mapped = kmap_frame(userbench_frame);
+            block = (uint8_t*)mapped + PAGE_SIZE - size;
+            done = (volatile uint32_t*)(block + size - sizeof(uint32_t));
+        }
+        if (*done) {
+            break;
+        }
+    }
+    
+    int finished = done && *done;
+    if (finished) {
+        memcpy(results, block, size);
+    }
+    
+    // A process that never got as far as its page has nothing to release
+    if (mapped) {
+        kunmap_frame(mapped);
+        frame_free(userbench_frame);
+    }
+    
+    return finished ? 0 : -1;
+}
+
+/* Results the benchmark's user code leaves; done is the last word */
+typedef struct {
+    uint64_t int80_cycles;
+    uint64_t sysenter_cycles;
+    uint64_t vdso_cycles;
+    volatile uint32_t done;
+} sysbench_result_t;
+
+/* Print one benchmark line */
+static void sysbench_report(const char *method, uint64_t cycles, uint32_t calls) {
+    uint32_t per_call = (uint32_t)(cycles / calls);
+    uint32_t tsc_per_us = timer_tsc_per_us();
+    
+    terminal_writestring(method);
+    if (tsc_per_us) {
+        terminal_writedec((uint32_t)(cycles * 1000 / tsc_per_us / calls));
+        terminal_writestring(" ns/call (");
+        terminal_writedec(per_call);
+        terminal_writestring(" cycles)\n");
+    } else {
+        terminal_writedec(per_call);
+        terminal_writestring(" cycles/call\n");
+    }
+}
+
+/* Time getpid from user mode through int 0x80, through SYSENTER and as a
+ * read of the vDSO process page */
+void syscall_benchmark(uint32_t calls) {
+    if (calls == 0) {
+        return;
+    }
+    
+    terminal_writestring("syscall: ");
+    terminal_writedec(calls);
+    terminal_writestring(" getpid calls per entry method\n");
+    
+    sysbench_result_t result;
+    uint32_t args[2] = { calls, sysenter_supported };
+    if (syscall_run_user("sysbench", sysbench_user_start, sysbench_user_end, args, 2, &result, sizeof(result)) != 0) {
+        terminal_writestring("  benchmark process did not finish\n");
+        return;
+    }
+    
+    sysbench_report("  int 0x80: ", result.int80_cycles, calls);
+    if (sysenter_supported) {
+        sysbench_report("  sysenter: ", result.sysenter_cycles, calls);
+    } else {
+        terminal_writestring("  sysenter: not supported by this CPU\n");
+    }
+    sysbench_report("  vdso:     ", result.vdso_cycles, calls);
+}
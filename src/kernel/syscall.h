@@ -1,6 +1,7 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include "interrupt.h"
 #include <stdint.h>
 
 /* System call numbers */
@@ -24,14 +25,45 @@
 #define SYS_GETCWD     18
 #define SYS_TIME       19
 #define SYS_CHMOD      20
+#define SYS_RING_SETUP 21
+#define SYS_RING_ENTER 22
 
 /* Initialize system call interface */
 void syscall_init(void);
 
 /* System call handler */
-void syscall_handler(void);
+void syscall_handler(registers_t* regs);
 
 /* Register a system call handler */
 void register_syscall(uint32_t num, void* handler);
 
+/* Run a registered system call with six arguments; -1 if there is none */
+int syscall_dispatch(uint32_t num, const uint32_t* args);
+
+/* Set up the fast system call entry on this CPU */
+void syscall_init_cpu(void);
+
+/* Check whether the fast system call entry is in use */
+int syscall_sysenter_supported(void);
+
+/* SYSENTER entry: complete the trap frame and dispatch */
+void sysenter_handler(registers_t* regs);
+
+/* Run position independent ring 3 code in a new process. It is called
+ * with the address of a result block at the end of its page, then the
+ * given arguments, and sets the block's last word when done; the block is
+ * copied out. Returns 0, or -1 if the process did not finish */
+int syscall_run_user(const char* name, const uint8_t* start, const uint8_t* end,
+                     const uint32_t* args, uint32_t nargs, void* results, uint32_t size);
+
+/* Time getpid from user mode through int 0x80, through SYSENTER and as a
+ * read of the vDSO process page */
+void syscall_benchmark(uint32_t calls);
+
+/* Assembly helpers (sysenter.s) */
+void sysenter_entry(void);
+void user_enter(uint32_t eip, uint32_t esp);
+extern uint8_t sysbench_user_start[];
+extern uint8_t sysbench_user_end[];
+
 #endif /* SYSCALL_H */
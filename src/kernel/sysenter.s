@@ -0,0 +1,302 @@
+# MinOS fast system call entry and user mode helpers
+
+.section .text
+
+# Selectors (gdt.h) with RPL 3 and system call numbers (syscall.h)
+.set USER_CODE, 0x1B
+.set USER_DATA, 0x23
+.set KERNEL_DATA, 0x10
+.set SYS_EXIT, 1
+.set SYS_GETPID, 9
+.set VDSO_PROCESS, 0x3FFFF000  # vdso.h; the pid is the first field
+
+# SYSENTER entry point (MSR_SYSENTER_EIP)
+#
+# User convention: eax = number, ebx, ecx, edx, esi, edi = arguments 1-5,
+# and the call is made with
+#
+#     call 1f        # (from the caller)
+# 1:  push %ebp      # sixth argument
+#     mov %esp, %ebp
+#     sysenter
+#
+# so ebp points at the sixth argument with the return address above it.
+# ecx and edx are clobbered (SYSEXIT takes the user esp and eip in them).
+#
+# SYSENTER loads only cs, ss, eip and esp, and clears IF. The stack pointer
+# MSR points at this CPU's TSS esp0 field, so the first load gives the
+# kernel stack of the current process. The stub then builds the same
+# registers_t frame as int 0x80, so handlers, preemption and fork see no
+# difference; sysenter_handler() fills in eip from the user stack.
+.global sysenter_entry
+.type sysenter_entry, @function
+sysenter_entry:
+    mov (%esp), %esp            # Kernel stack from TSS esp0
+    pushl $USER_DATA            # ss
+    pushl %ebp                  # useresp
+    pushfl
+    orl $0x200, (%esp)          # eflags: ring 3 always runs with IF set
+    pushl $USER_CODE            # cs
+    pushl $0                    # eip, from the user stack
+    pushl $0                    # err_code
+    pushl $0x80                 # int_no
+    pusha
+
+    mov %ds, %ax
+    push %eax
+    mov $KERNEL_DATA, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+
+    push %esp
+    call sysenter_handler
+    add $4, %esp
+
+    pop %eax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    popa
+    add $8, %esp                # int_no, err_code
+
+    # SYSEXIT returns to edx with esp = ecx. Interrupts come back on with
+    # sti, whose one-instruction delay covers the sysexit
+    mov (%esp), %edx            # eip
+    mov 12(%esp), %ecx          # useresp
+    add $8, %esp
+    andl $~0x200, (%esp)
+    popfl
+    sti
+    sysexit
+
+# void user_enter(uint32_t eip, uint32_t esp)
+#
+# Leave the kernel for ring 3 at eip on the given user stack. The kernel
+# stack is abandoned; the next trap starts again at TSS esp0.
+.global user_enter
+.type user_enter, @function
+user_enter:
+    mov 4(%esp), %ecx           # eip
+    mov 8(%esp), %edx           # esp
+
+    mov $USER_DATA, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+
+    pushl $USER_DATA            # ss
+    pushl %edx                  # esp
+    pushfl
+    orl $0x200, (%esp)          # eflags with IF
+    pushl $USER_CODE            # cs
+    pushl %ecx                  # eip
+    iret
+
+# Ring 3 side of the system call benchmark (syscall_benchmark()), copied
+# to a user page; position independent.
+#
+# Stack on entry: [esp+4] the result block (sysbench_result_t), [esp+8]
+# calls per method, [esp+12] nonzero to time SYSENTER too. The last loop
+# reads the pid from the vDSO process page instead of asking.
+.global sysbench_user_start
+.global sysbench_user_end
+sysbench_user_start:
+    mov 4(%esp), %esi           # results
+    mov 8(%esp), %edi           # calls
+
+    # int 0x80 preserves everything but eax
+    rdtsc
+    mov %eax, 0(%esi)
+    mov %edx, 4(%esi)
+    mov %edi, %ebx
+1:
+    mov $SYS_GETPID, %eax
+    int $0x80
+    dec %ebx
+    jnz 1b
+    rdtsc
+    sub 0(%esi), %eax
+    sbb 4(%esi), %edx
+    mov %eax, 0(%esi)
+    mov %edx, 4(%esi)
+
+    cmpl $0, 12(%esp)
+    je 3f
+
+    # SYSENTER clobbers ecx and edx
+    rdtsc
+    mov %eax, 8(%esi)
+    mov %edx, 12(%esi)
+    mov %edi, %ebx
+2:
+    mov $SYS_GETPID, %eax
+    call sysbench_sysenter
+    dec %ebx
+    jnz 2b
+    rdtsc
+    sub 8(%esi), %eax
+    sbb 12(%esi), %edx
+    mov %eax, 8(%esi)
+    mov %edx, 12(%esi)
+
+3:
+    rdtsc
+    mov %eax, 16(%esi)
+    mov %edx, 20(%esi)
+    mov %edi, %ebx
+4:
+    mov VDSO_PROCESS, %eax
+    dec %ebx
+    jnz 4b
+    rdtsc
+    sub 16(%esi), %eax
+    sbb 20(%esi), %edx
+    mov %eax, 16(%esi)
+    mov %edx, 20(%esi)
+
+    movl $1, 24(%esi)           # done
+    mov $SYS_EXIT, %eax
+    xor %ebx, %ebx
+    int $0x80
+
+sysbench_sysenter:
+    push %ebp
+    mov %esp, %ebp
+    sysenter
+sysbench_user_end:
+
+# Ring 3 side of the system call ring benchmark (sysring_benchmark()),
+# copied to a user page; position independent.
+#
+# Stack on entry: [esp+4] the result block (ringbench_result_t), [esp+8]
+# writes per method, [esp+12] the file to write to, [esp+16] the flags to
+# set the ring up with. Each write is one byte from the result block.
+.set SYS_WRITE, 4
+.set SYS_RING_SETUP, 21
+.set SYS_RING_ENTER, 22
+.set RING_ENTRIES, 256         # sysring.h
+.set RING_SQ_TAIL, 4           # sysring_t fields
+.set RING_CQ_HEAD, 8
+.set RING_CQ_TAIL, 12
+.set RING_FLAGS, 16
+.set RING_SQ, 64
+.set RING_NEED_WAKEUP, 1
+.set RING_ENTER_WAKEUP, 1
+.set RING_SPINS, 1000          # Polls of the completions before trapping
+
+.global ringbench_user_start
+.global ringbench_user_end
+ringbench_user_start:
+    mov 4(%esp), %esi           # results
+    mov 8(%esp), %edi           # writes
+
+    # One int 0x80 per write; everything but eax survives the call
+    rdtsc
+    mov %eax, 0(%esi)
+    mov %edx, 4(%esi)
+    mov 12(%esp), %ebx          # fd
+    mov %esi, %ecx              # buffer
+    mov $1, %edx                # size
+    mov %edi, %ebp
+1:
+    mov $SYS_WRITE, %eax
+    int $0x80
+    dec %ebp
+    jnz 1b
+    rdtsc
+    sub 0(%esi), %eax
+    sbb 4(%esi), %edx
+    mov %eax, 0(%esi)
+    mov %edx, 4(%esi)
+
+    mov $SYS_RING_SETUP, %eax
+    mov 16(%esp), %ebx
+    int $0x80
+    cmp $-1, %eax
+    je 9f
+    mov %eax, %ebp              # ring
+
+    rdtsc
+    mov %eax, 8(%esi)
+    mov %edx, 12(%esi)
+
+    # Queue a batch of up to RING_ENTRIES writes (ebx of them)
+2:
+    mov %edi, %ebx
+    cmp $RING_ENTRIES, %ebx
+    jbe 3f
+    mov $RING_ENTRIES, %ebx
+3:
+    mov RING_SQ_TAIL(%ebp), %ecx
+    mov %ebx, %edx
+4:
+    mov %ecx, %eax
+    and $(RING_ENTRIES - 1), %eax
+    shl $5, %eax                # sizeof(sysring_sqe_t)
+    lea RING_SQ(%ebp,%eax), %eax
+    movl $SYS_WRITE, 0(%eax)    # num
+    pushl 12(%esp)              # args[0] = fd
+    popl 4(%eax)
+    mov %esi, 8(%eax)           # args[1] = buffer
+    movl $1, 12(%eax)           # args[2] = size
+    mov %ecx, 28(%eax)          # user_data
+    inc %ecx
+    dec %edx
+    jnz 4b
+
+    # Publish the entries, and order that store before the flags load
+    mov %ecx, RING_SQ_TAIL(%ebp)
+    lock orl $0, (%esp)
+
+    cmpl $0, 16(%esp)
+    jne 5f
+
+    # No polling thread: one trap runs the whole batch
+    mov $SYS_RING_ENTER, %eax
+    xor %ecx, %ecx
+    xor %edx, %edx
+    int $0x80
+    jmp 7f
+
+    # Polling thread: watch the completions come in, and only trap if
+    # the thread went to sleep or is slow (sharing this CPU)
+5:
+    mov $RING_SPINS, %edx
+6:
+    mov RING_CQ_TAIL(%ebp), %eax
+    sub RING_CQ_HEAD(%ebp), %eax
+    cmp %ebx, %eax
+    jae 7f
+    testl $RING_NEED_WAKEUP, RING_FLAGS(%ebp)
+    jnz 8f
+    pause
+    dec %edx
+    jnz 6b
+8:
+    mov $SYS_RING_ENTER, %eax
+    mov %ebx, %ecx              # min_complete
+    mov $RING_ENTER_WAKEUP, %edx
+    int $0x80
+
+    # Consume the batch's completions
+7:
+    add %ebx, RING_CQ_HEAD(%ebp)
+    sub %ebx, %edi
+    jnz 2b
+
+    rdtsc
+    sub 8(%esi), %eax
+    sbb 12(%esi), %edx
+    mov %eax, 8(%esi)
+    mov %edx, 12(%esi)
+
+9:
+    movl $1, 16(%esi)           # done
+    mov $SYS_EXIT, %eax
+    xor %ebx, %ebx
+    int $0x80
+ringbench_user_end:
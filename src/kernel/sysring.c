@@ -0,0 +1,302 @@
+#include "sysring.h"
+#include "syscall.h"
+#include "process.h"
+#include "memory.h"
+#include "frame.h"
+#include "timer.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "../fs/vfs.h"
+#include "../fs/file.h"
+#include <stdint.h>
+#include <string.h>
+
+/* How long the polling thread watches an idle ring before it sleeps (ns) */
+#define SYSRING_POLL_IDLE 1000000
+
+/* Kernel side of a process's ring */
+typedef struct sysring_ctx {
+    sysring_t *ring;                // Kernel view of the shared pages
+    process_t *poller;              // Polling thread, or NULL
+    volatile uint32_t stop;         // Owner exiting: the thread should finish
+    volatile uint32_t poller_done;  // The thread is off the owner's address space
+} sysring_ctx_t;
+
+/* Keep the compiler from moving ring accesses across this point; x86
+ * keeps loads in order and stores in order */
+static inline void barrier() {
+    asm volatile("" : : : "memory");
+}
+
+/* Check whether a call may be queued: exit, fork and exec need the trap
+ * frame, mmap and munmap would act on the polling thread, and rings
+ * inside rings are not worth the trouble. On a polled ring the calls run
+ * on the polling thread, so calls about the calling process are refused
+ * there too */
+static int sysring_allowed(uint32_t num, int polled) {
+    switch (num) {
+        case SYS_EXIT:
+        case SYS_FORK:
+        case SYS_EXEC:
+        case SYS_MMAP:
+        case SYS_MUNMAP:
+        case SYS_RING_SETUP:
+        case SYS_RING_ENTER:
+            return 0;
+        case SYS_GETPID:
+        case SYS_SLEEP:
+        case SYS_WAITPID:
+            return !polled;
+        default:
+            return 1;
+    }
+}
+
+/* Run up to max queued calls while the completion ring has room. An entry
+ * stays in the submission ring until its completion is posted, so pending
+ * entries always include the one running */
+static uint32_t sysring_run(sysring_t *ring, uint32_t max, int polled) {
+    uint32_t done = 0;
+
+    while (done < max) {
+        uint32_t head = ring->sq_head;
+        if (head == ring->sq_tail || ring->cq_tail - ring->cq_head >= SYSRING_ENTRIES) {
+            break;
+        }
+        barrier();
+
+        // Copied so the process cannot change the call after the check
+        sysring_sqe_t sqe = ring->sq[head & SYSRING_MASK];
+        int result = sysring_allowed(sqe.num, polled) ? syscall_dispatch(sqe.num, sqe.args) : -1;
+
+        sysring_cqe_t *cqe = &ring->cq[ring->cq_tail & SYSRING_MASK];
+        cqe->user_data = sqe.user_data;
+        cqe->result = result;
+        barrier();
+        ring->cq_tail++;
+        ring->sq_head = head + 1;
+        done++;
+    }
+
+    return done;
+}
+
+/* Polling thread: takes submissions as they come, in the owner's address
+ * space, and sleeps once the ring has been idle for a while */
+static void sysring_poller() {
+    sysring_ctx_t *ctx = process_current()->mm_owner->ring;
+    sysring_t *ring = ctx->ring;
+    uint64_t idle_since = timer_now_ns();
+
+    while (!ctx->stop) {
+        if (sysring_run(ring, SYSRING_ENTRIES, 1)) {
+            idle_since = timer_now_ns();
+            continue;
+        }
+        if (timer_now_ns() - idle_since < SYSRING_POLL_IDLE) {
+            process_yield(); // The owner may be waiting for this CPU
+            continue;
+        }
+
+        // The flag goes up before the last look, so a submission is either
+        // seen here or sees the flag. A wakeup that comes before we block
+        // is lost, but the flag stays up and the next enter repeats it
+        __sync_fetch_and_or(&ring->flags, SYSRING_NEED_WAKEUP);
+        __sync_synchronize();
+        if (ring->sq_head == ring->sq_tail && !ctx->stop) {
+            process_block();
+        }
+        __sync_fetch_and_and(&ring->flags, ~SYSRING_NEED_WAKEUP);
+        idle_since = timer_now_ns();
+    }
+
+    // The owner frees its address space once it sees poller_done
+    process_leave_mm();
+    ctx->poller_done = 1;
+    process_terminate();
+}
+
+/* Set up the current process's ring; returns its user address or -1 */
+int sysring_setup(uint32_t flags) {
+    process_t *current = process_current();
+
+    if (!current || current->ring || current->mm_owner ||
+        current->page_directory == paging_kernel_directory()) {
+        return -1;
+    }
+
+    sysring_ctx_t *ctx = (sysring_ctx_t*)kmalloc(sizeof(sysring_ctx_t));
+    if (!ctx) {
+        return -1;
+    }
+    memset(ctx, 0, sizeof(sysring_ctx_t));
+
+    ctx->ring = (sysring_t*)kmalloc_aligned_zeroed(SYSRING_PAGES * PAGE_SIZE, 0);
+    if (!ctx->ring) {
+        kfree(ctx);
+        return -1;
+    }
+
+    // Each mapping holds a reference on the heap's frame; the directory's
+    // teardown drops it. fork leaves the pages out of the child
+    for (uint32_t i = 0; i < SYSRING_PAGES; i++) {
+        uint32_t frame = virt_to_phys((uint32_t)ctx->ring + i * PAGE_SIZE) / PAGE_SIZE;
+        page_t *page = get_page(SYSRING_BASE + i * PAGE_SIZE, 1, current->page_directory);
+
+        frame_ref(frame);
+        map_frame(page, frame, 0, 1);
+        page->dontfork = 1;
+    }
+
+    current->ring = ctx;
+    if (flags & SYSRING_SETUP_POLL) {
+        ctx->ring->flags = SYSRING_POLLED;
+        ctx->poller = process_create_thread("sqpoll", (uint32_t)sysring_poller, current);
+    }
+
+    return SYSRING_BASE;
+}
+
+/* Run queued calls (SYS_RING_ENTER); a caller waiting on the polling
+ * thread stops waiting once nothing more is pending */
+int sysring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    process_t *current = process_current();
+    sysring_ctx_t *ctx = current ? current->ring : NULL;
+
+    if (!ctx) {
+        return -1;
+    }
+    if (!ctx->poller) {
+        return (int)sysring_run(ctx->ring, to_submit, 0);
+    }
+
+    sysring_t *ring = ctx->ring;
+    if (flags & SYSRING_ENTER_WAKEUP) {
+        process_wake(ctx->poller);
+    }
+
+    // Let the thread have this CPU if it shares it with us
+    while (ring->cq_tail - ring->cq_head < min_complete && ring->sq_head != ring->sq_tail) {
+        if (ring->flags & SYSRING_NEED_WAKEUP) {
+            process_wake(ctx->poller);
+        }
+        process_yield();
+    }
+
+    return 0;
+}
+
+/* Stop a process's polling thread before it exits */
+void sysring_exit(process_t *process) {
+    sysring_ctx_t *ctx = process->ring;
+
+    if (!ctx || !ctx->poller) {
+        return;
+    }
+
+    ctx->stop = 1;
+    while (!ctx->poller_done) {
+        process_wake(ctx->poller);
+        timer_usleep(1000);
+    }
+    ctx->poller = NULL;
+}
+
+/* Free a process's ring once its address space is gone */
+void sysring_free(process_t *process) {
+    sysring_ctx_t *ctx = process->ring;
+
+    if (ctx) {
+        kfree(ctx->ring);
+        kfree(ctx);
+        process->ring = NULL;
+    }
+}
+
+/* Results the benchmark's user code leaves; done is the last word */
+typedef struct {
+    uint64_t syscall_cycles;
+    uint64_t ring_cycles;
+    volatile uint32_t done;
+} ringbench_result_t;
+
+/* Benchmark writes go to memory so only the call path is timed */
+static fs_node_t ringbench_sink;
+
+/* Count what is written to the sink */
+static uint32_t ringbench_sink_write(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+    (void)offset;
+    (void)buffer;
+    node->length += size;
+    return size;
+}
+
+/* Print one benchmark line */
+static void ringbench_report(const char *method, uint64_t cycles, uint32_t writes) {
+    uint32_t per_write = (uint32_t)(cycles / writes);
+    uint32_t tsc_per_us = timer_tsc_per_us();
+
+    terminal_writestring(method);
+    if (tsc_per_us) {
+        terminal_writedec((uint32_t)(cycles * 1000 / tsc_per_us / writes));
+        terminal_writestring(" ns/write (");
+        terminal_writedec(per_write);
+        terminal_writestring(" cycles)\n");
+    } else {
+        terminal_writedec(per_write);
+        terminal_writestring(" cycles/write\n");
+    }
+}
+
+/* Time small file writes made one system call at a time against the same
+ * writes queued on a ring, with and without a polling thread */
+void sysring_benchmark(uint32_t writes) {
+    if (writes == 0) {
+        return;
+    }
+
+    memset(&ringbench_sink, 0, sizeof(fs_node_t));
+    strcpy(ringbench_sink.name, "ringbench");
+    ringbench_sink.flags = VFS_FILE;
+    ringbench_sink.write = ringbench_sink_write;
+
+    int fd = file_open_node(&ringbench_sink, O_WRONLY);
+    if (fd < 0) {
+        terminal_writestring("ring: no free file descriptor\n");
+        return;
+    }
+
+    terminal_writestring("ring: ");
+    terminal_writedec(writes);
+    terminal_writestring(" one-byte writes per method\n");
+
+    // Each run makes the writes once through int 0x80 and once through a
+    // ring; the second run's ring has a polling thread
+    ringbench_result_t trap, poll;
+    uint32_t args[3] = { writes, (uint32_t)fd, 0 };
+    int failed = syscall_run_user("ringbench", ringbench_user_start, ringbench_user_end, args, 3, &trap, sizeof(trap));
+    args[2] = SYSRING_SETUP_POLL;
+    failed |= syscall_run_user("ringbench", ringbench_user_start, ringbench_user_end, args, 3, &poll, sizeof(poll));
+    file_close(fd);
+
+    if (failed) {
+        terminal_writestring("  benchmark process did not finish\n");
+        return;
+    }
+    if (!trap.ring_cycles || !poll.ring_cycles) {
+        terminal_writestring("  ring setup failed\n");
+        return;
+    }
+
+    ringbench_report("  syscalls:    ", trap.syscall_cycles, writes);
+    ringbench_report("  ring:        ", trap.ring_cycles, writes);
+    ringbench_report("  polled ring: ", poll.ring_cycles, writes);
+
+    if (ringbench_sink.length != 4 * writes) {
+        terminal_writestring("  warning: ");
+        terminal_writedec(ringbench_sink.length);
+        terminal_writestring(" bytes arrived, expected ");
+        terminal_writedec(4 * writes);
+        terminal_writestring("\n");
+    }
+}
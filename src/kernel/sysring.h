@@ -0,0 +1,90 @@
+#ifndef SYSRING_H
+#define SYSRING_H
+
+#include <stdint.h>
+
+/*
+ * Batched system calls. A process queues calls in a submission ring shared
+ * with the kernel and collects their results from a completion ring, so
+ * many calls cost one trap, or none when a kernel thread polls the ring.
+ * Most registered system calls can be queued (see sysring_allowed()).
+ * The layout part of this header is shared with the user library
+ * (src/user/sysring.c).
+ */
+
+/* User address of the ring, just below the vDSO pages */
+#define SYSRING_BASE     0x3FFFB000
+
+/* Entries in each ring (a power of two) */
+#define SYSRING_ENTRIES  256
+#define SYSRING_MASK     (SYSRING_ENTRIES - 1)
+
+/* SYS_RING_SETUP flags */
+#define SYSRING_SETUP_POLL   0x1  // A kernel thread takes submissions as they come
+
+/* SYS_RING_ENTER flags */
+#define SYSRING_ENTER_WAKEUP 0x1  // Wake the polling thread
+
+/* Ring flags set by the kernel */
+#define SYSRING_NEED_WAKEUP  0x1  // The polling thread went to sleep
+#define SYSRING_POLLED       0x2  // A polling thread serves the ring
+
+/* Queued call: the number and arguments as for int 0x80 */
+typedef struct {
+    uint32_t num;
+    uint32_t args[6];
+    uint32_t user_data;          // Copied to the completion
+} sysring_sqe_t;
+
+/* Result of a queued call */
+typedef struct {
+    uint32_t user_data;
+    int32_t result;
+} sysring_cqe_t;
+
+/* Shared ring. The process fills sq[sq_tail & SYSRING_MASK] and then
+ * advances sq_tail; the kernel advances sq_head as it takes entries. The
+ * kernel fills cq[cq_tail & SYSRING_MASK] and advances cq_tail; the
+ * process advances cq_head as it consumes them. Calls are taken in order
+ * and only while the completion ring has room. */
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    volatile uint32_t flags;
+    uint32_t reserved[11];       // Keeps the arrays cache line aligned
+    sysring_sqe_t sq[SYSRING_ENTRIES];
+    sysring_cqe_t cq[SYSRING_ENTRIES];
+} sysring_t;
+
+/* Pages the ring takes in user space */
+#define SYSRING_PAGES    ((sizeof(sysring_t) + 0xFFF) / 0x1000)
+
+struct process;
+
+/* Set up the current process's ring; returns its user address or -1 */
+int sysring_setup(uint32_t flags);
+
+/* Run queued calls (SYS_RING_ENTER). Without a polling thread up to
+ * to_submit calls run before this returns the number taken. With one, the
+ * thread is woken if asked and the caller waits for min_complete
+ * completions; while waiting for completions a process should enter again
+ * whenever SYSRING_NEED_WAKEUP is up. Returns -1 without a ring */
+int sysring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+
+/* Stop a process's polling thread before it exits */
+void sysring_exit(struct process *process);
+
+/* Free a process's ring once its address space is gone */
+void sysring_free(struct process *process);
+
+/* Time small file writes made one system call at a time against the same
+ * writes queued on a ring, with and without a polling thread */
+void sysring_benchmark(uint32_t writes);
+
+/* Ring 3 side of the benchmark (sysenter.s) */
+extern uint8_t ringbench_user_start[];
+extern uint8_t ringbench_user_end[];
+
+#endif /* SYSRING_H */
@@ -2,32 +2,236 @@
 #include "interrupt.h"
 #include "kernel.h"
 #include "process.h"
+#include "apic.h"
+#include "smp.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "vdso.h"
 #include <stdint.h>
 
+/*
+ * Each CPU keeps its pending timer events in a min-heap ordered by
+ * deadline. In periodic mode the PIT (boot CPU) and the local APIC timers
+ * (other CPUs) interrupt every tick or timeslice and expired events are
+ * run from there. In tickless mode the PIT is masked and each CPU's local
+ * APIC timer is programmed one-shot for its earliest deadline only, so an
+ * idle CPU is not interrupted at all; the timeslice itself is an event,
+ * armed only while another process is waiting for the CPU.
+ *
+ * Sleeping processes are blocked on a per-CPU queue sorted by deadline,
+ * with a single timer event for the first of them.
+ */
+
+/* PIT ticks the TSC calibration runs for */
+#define CALIBRATE_TICKS 5
+
+/* Per-CPU timer state */
+typedef struct {
+    spinlock_t lock;                       // Protects heap, count and sleepers
+    timer_event_t *heap[TIMER_HEAP_SIZE];  // Pending events, earliest first
+    uint32_t count;
+    timer_event_t slice;                   // End of the running timeslice
+    process_t *sleepers;                   // Sleeping processes, earliest first
+    timer_event_t sleep_event;             // Deadline of the first sleeper
+    volatile uint32_t resched;             // Timeslice over, schedule on the way out
+    uint32_t periodic;                     // Local timer set up for periodic mode
+    volatile uint32_t irqs;                // Timer interrupts taken
+} timer_cpu_t;
+
 /* Timer variables */
-static uint32_t tick = 0;
+static volatile uint32_t tick = 0;
 static uint32_t timer_frequency = 0;
+static uint32_t ns_per_tick = 0;
+static timer_cpu_t timer_cpus[MAX_CPUS];
 
-/* Timer interrupt handler */
-static void timer_callback() {
-    tick++;
+/* One-shot local APIC timers instead of the periodic tick */
+static volatile int tickless = 0;
+
+/* TSC cycles per microsecond, 0 until timer_calibrate() */
+static uint32_t tsc_per_us = 0;
+
+/* TSC value and time at the calibration point */
+static uint64_t tsc_base = 0;
+static uint64_t ns_base = 0;
+
+/* Timer state of the executing CPU (interrupts off) */
+static timer_cpu_t *this_timer() {
+    return &timer_cpus[cpu_id()];
+}
+
+/* Swap two heap slots */
+static void heap_swap(timer_cpu_t *tc, uint32_t a, uint32_t b) {
+    timer_event_t *tmp = tc->heap[a];
+    tc->heap[a] = tc->heap[b];
+    tc->heap[b] = tmp;
+    tc->heap[a]->index = a;
+    tc->heap[b]->index = b;
+}
+
+/* Move an event towards the root while it is earlier than its parent */
+static void heap_up(timer_cpu_t *tc, uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (tc->heap[parent]->deadline <= tc->heap[i]->deadline) {
+            break;
+        }
+        heap_swap(tc, i, parent);
+        i = parent;
+    }
+}
+
+/* Move an event towards the leaves while a child is earlier */
+static void heap_down(timer_cpu_t *tc, uint32_t i) {
+    for (;;) {
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        uint32_t min = i;
+        
+        if (left < tc->count && tc->heap[left]->deadline < tc->heap[min]->deadline) {
+            min = left;
+        }
+        if (right < tc->count && tc->heap[right]->deadline < tc->heap[min]->deadline) {
+            min = right;
+        }
+        if (min == i) {
+            break;
+        }
+        heap_swap(tc, i, min);
+        i = min;
+    }
+}
+
+/* Take an event out of the heap (lock held) */
+static void heap_remove(timer_cpu_t *tc, uint32_t i) {
+    tc->heap[i]->index = -1;
+    tc->count--;
+    if (i == tc->count) {
+        return;
+    }
     
-    // Every 100 ticks (about 100ms at 1000Hz), perform a context switch
-    if (tick % 100 == 0) {
-        // Call the scheduler
+    tc->heap[i] = tc->heap[tc->count];
+    tc->heap[i]->index = i;
+    heap_up(tc, i);
+    heap_down(tc, tc->heap[i]->index);
+}
+
+/* Run this CPU's expired events (interrupts off) */
+static void timer_run_expired() {
+    timer_cpu_t *tc = this_timer();
+    uint64_t now = timer_now_ns();
+    
+    spin_lock(&tc->lock);
+    while (tc->count && tc->heap[0]->deadline <= now) {
+        timer_event_t *event = tc->heap[0];
+        void (*callback)(timer_event_t*) = event->callback;
+        
+        heap_remove(tc, 0);
+        
+        // The callback may re-arm the event or add others
+        spin_unlock(&tc->lock);
+        callback(event);
+        spin_lock(&tc->lock);
+    }
+    spin_unlock(&tc->lock);
+}
+
+/* Leave a timer interrupt: switch if the timeslice ran out */
+static void timer_interrupt_exit(timer_cpu_t *tc) {
+    if (tc->resched) {
+        tc->resched = 0;
         process_schedule();
     }
 }
 
+/* Timeslice event: the running process has had its turn */
+static void slice_expired(timer_event_t *event) {
+    (void)event;
+    this_timer()->resched = 1;
+}
+
+/* Wakes a CPU halted in timer_usleep(); the wait loop checks the time */
+static void halt_expired(timer_event_t *event) {
+    (void)event;
+}
+
+/* Sleep event: wake every sleeper whose deadline has passed */
+static void sleepers_expired(timer_event_t *event) {
+    timer_cpu_t *tc = this_timer();
+    uint64_t now = timer_now_ns();
+    
+    spin_lock(&tc->lock);
+    while (tc->sleepers && tc->sleepers->wake_time <= now) {
+        process_t *process = tc->sleepers;
+        tc->sleepers = process->sleep_next;
+        process->sleep_next = NULL;
+        process->sleeping = 0;
+        
+        spin_unlock(&tc->lock);
+        process_wake(process);
+        spin_lock(&tc->lock);
+    }
+    uint64_t next = tc->sleepers ? tc->sleepers->wake_time : 0;
+    spin_unlock(&tc->lock);
+    
+    if (next) {
+        timer_event_add(event, next);
+    }
+}
+
+/* Timer interrupt handler (PIT, boot CPU, periodic mode) */
+static void timer_callback(registers_t* regs) {
+    (void)regs;
+    timer_cpu_t *tc = this_timer();
+    
+    tick++;
+    tc->irqs++;
+    vdso_update_tick(tick);
+    
+    // Preempt the running process at the end of its timeslice
+    if (tick % PROCESS_TIMESLICE == 0) {
+        tc->resched = 1;
+    }
+    
+    timer_run_expired();
+    timer_interrupt_exit(tc);
+}
+
+/* Local APIC timer handler */
+static void local_timer_callback(registers_t* regs) {
+    (void)regs;
+    timer_cpu_t *tc = this_timer();
+    
+    lapic_eoi();
+    tc->irqs++;
+    
+    // Periodic: each interrupt is one timeslice
+    if (!tickless) {
+        tc->resched = 1;
+    }
+    
+    timer_run_expired();
+    timer_reprogram();
+    timer_interrupt_exit(tc);
+}
+
 /* Initialize the system timer */
 void timer_init(uint32_t frequency) {
     terminal_writestring("Initializing system timer...\n");
     
     // Save the timer frequency
     timer_frequency = frequency;
+    ns_per_tick = 1000000000 / frequency;
     
-    // Register the timer callback
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        spin_init(&timer_cpus[i].lock);
+        timer_event_init(&timer_cpus[i].slice, slice_expired, 0);
+        timer_event_init(&timer_cpus[i].sleep_event, sleepers_expired, 0);
+    }
+    
+    // Register the timer callbacks; the local APIC one is used once
+    // smp_init() has found and calibrated the APIC
     register_interrupt_handler(IRQ0, timer_callback);
+    register_interrupt_handler(ISR_LAPIC_TIMER, local_timer_callback);
     
     // The PIT (Programmable Interval Timer) operates at 1.193182MHz
     uint32_t divisor = 1193180 / frequency;
@@ -46,16 +250,347 @@ void timer_init(uint32_t frequency) {
 
 /* Get the current tick count */
 uint32_t timer_get_ticks() {
-    return tick;
+    // The PIT stops counting in tickless mode; the TSC does not
+    if (!tsc_per_us) {
+        return tick;
+    }
+    return (uint32_t)(timer_now_ns() / ns_per_tick);
+}
+
+/* Get the timer frequency in Hz */
+uint32_t timer_get_frequency() {
+    return timer_frequency;
+}
+
+/* Get the time since boot in nanoseconds (tick resolution until the TSC
+ * is calibrated) */
+uint64_t timer_now_ns() {
+    if (!tsc_per_us) {
+        return (uint64_t)tick * ns_per_tick;
+    }
+    return ns_base + (rdtsc() - tsc_base) * 1000 / tsc_per_us;
 }
 
 /* Sleep for a specified number of ticks */
 void timer_sleep(uint32_t ticks) {
+    timer_usleep(ticks * (ns_per_tick / 1000));
+}
+
+/* Sleep for a number of microseconds. The process blocks on this CPU's
+ * sleep queue and the CPU runs other work until the deadline */
+void timer_usleep(uint32_t us) {
+    uint64_t deadline = timer_now_ns() + (uint64_t)us * 1000;
+    uint32_t flags = irq_save();
+    process_t *current = process_current();
+    timer_cpu_t *tc = this_timer();
+    
+    // Before process management is up there is nothing to block: halt
+    // between interrupts until the deadline. sti only takes effect after
+    // the hlt, so the wakeup cannot slip in between the check and it
+    if (!current) {
+        timer_event_t event;
+        timer_event_init(&event, halt_expired, 0);
+        timer_event_add(&event, deadline);
+        while (timer_now_ns() < deadline) {
+            asm volatile("sti; hlt; cli");
+        }
+        timer_event_cancel(&event);
+        irq_restore(flags);
+        return;
+    }
+    
+    // Sorted insert behind sleepers with the same deadline
+    spin_lock(&tc->lock);
+    process_t **link = &tc->sleepers;
+    while (*link && (*link)->wake_time <= deadline) {
+        link = &(*link)->sleep_next;
+    }
+    current->wake_time = deadline;
+    current->sleeping = 1;
+    current->sleep_next = *link;
+    *link = current;
+    int earliest = tc->sleepers == current;
+    spin_unlock(&tc->lock);
+    
+    // One timer event per CPU, for the earliest sleeper
+    if (earliest) {
+        timer_event_cancel(&tc->sleep_event);
+        timer_event_add(&tc->sleep_event, deadline);
+    }
+    
+    // The queue only changes on this CPU with interrupts off, so the
+    // wakeup cannot come before we are blocked
+    while (current->sleeping) {
+        process_block();
+    }
+    irq_restore(flags);
+}
+
+/* Measure the TSC rate against the PIT (interrupts must be on) */
+void timer_calibrate() {
+    // Start on a tick edge
     uint32_t start = tick;
+    while (tick == start) {
+        asm volatile("hlt");
+    }
     
-    // Wait until enough ticks have passed
-    while (tick - start < ticks) {
-        // Yield to other processes
+    uint64_t tsc = rdtsc();
+    start = tick;
+    while (tick - start < CALIBRATE_TICKS) {
         asm volatile("hlt");
     }
+    uint64_t cycles = rdtsc() - tsc;
+    
+    // Take over timekeeping from the tick count, on a tick edge
+    uint32_t flags = irq_save();
+    tsc_base = rdtsc();
+    ns_base = (uint64_t)tick * ns_per_tick;
+    tsc_per_us = (uint32_t)(cycles / (CALIBRATE_TICKS * (1000000 / timer_frequency)));
+    vdso_update_clock(tsc_per_us, tsc_base, ns_base);
+    irq_restore(flags);
+}
+
+/* Get the measured TSC cycles per microsecond (0 if not calibrated) */
+uint32_t timer_tsc_per_us() {
+    return tsc_per_us;
+}
+
+/* Busy-wait for a number of microseconds */
+void timer_udelay(uint32_t us) {
+    if (!tsc_per_us) {
+        // Not calibrated: round up to whole ticks
+        uint32_t start = tick;
+        uint32_t ticks = (us / (1000000 / timer_frequency)) + 1;
+        while (tick - start <= ticks) {
+            asm volatile("hlt");
+        }
+        return;
+    }
+    
+    uint64_t end = rdtsc() + (uint64_t)us * tsc_per_us;
+    while (rdtsc() < end) {
+        cpu_relax();
+    }
+}
+
+/* Start this CPU's local APIC timer for preemption */
+void timer_init_local() {
+    timer_reprogram();
+}
+
+/* Set up a timer event */
+void timer_event_init(timer_event_t *event, void (*callback)(timer_event_t*), void *data) {
+    event->deadline = 0;
+    event->callback = callback;
+    event->data = data;
+    event->cpu = 0;
+    event->index = -1;
+}
+
+/* Arm an event on this CPU for a timer_now_ns() deadline */
+int timer_event_add(timer_event_t *event, uint64_t deadline) {
+    uint32_t flags = irq_save();
+    timer_cpu_t *tc = this_timer();
+    
+    spin_lock(&tc->lock);
+    if (event->index >= 0 || tc->count == TIMER_HEAP_SIZE) {
+        spin_unlock(&tc->lock);
+        irq_restore(flags);
+        return -1;
+    }
+    
+    event->deadline = deadline;
+    event->cpu = cpu_id();
+    event->index = tc->count;
+    tc->heap[tc->count++] = event;
+    heap_up(tc, event->index);
+    int earliest = tc->heap[0] == event;
+    spin_unlock(&tc->lock);
+    
+    // A new earliest deadline moves the one-shot interrupt forward
+    if (earliest && tickless) {
+        timer_reprogram();
+    }
+    
+    irq_restore(flags);
+    return 0;
+}
+
+/* Disarm an event; its callback may already be running on its CPU */
+void timer_event_cancel(timer_event_t *event) {
+    timer_cpu_t *tc = &timer_cpus[event->cpu];
+    uint32_t flags = spin_lock_irqsave(&tc->lock);
+    
+    // A cancelled earliest event just costs one early interrupt
+    if (event->index >= 0) {
+        heap_remove(tc, event->index);
+    }
+    
+    spin_unlock_irqrestore(&tc->lock, flags);
+}
+
+/* Program this CPU's local APIC timer for the current mode */
+void timer_reprogram() {
+    if (!lapic_present()) {
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    timer_cpu_t *tc = this_timer();
+    
+    if (!tickless) {
+        // The boot CPU keeps the PIT; the others tick once per timeslice
+        if (!tc->periodic) {
+            if (cpu_id() == 0) {
+                lapic_timer_stop();
+            } else {
+                lapic_timer_start(PROCESS_TIMESLICE);
+            }
+            tc->periodic = 1;
+        }
+        irq_restore(flags);
+        return;
+    }
+    tc->periodic = 0;
+    
+    spin_lock(&tc->lock);
+    uint64_t next = tc->count ? tc->heap[0]->deadline : 0;
+    spin_unlock(&tc->lock);
+    
+    if (!next) {
+        lapic_timer_stop(); // Nothing pending: stay asleep
+    } else {
+        uint64_t now = timer_now_ns();
+        lapic_timer_oneshot(next > now ? next - now : 0);
+    }
+    
+    irq_restore(flags);
+}
+
+/* Arm or disarm this CPU's timeslice (scheduler, interrupts off) */
+void timer_slice(int on) {
+    timer_cpu_t *tc = this_timer();
+    
+    // The periodic tick is a timeslice of its own
+    if (!tickless) {
+        return;
+    }
+    
+    if (on && tc->slice.index < 0) {
+        timer_event_add(&tc->slice, timer_now_ns() + (uint64_t)PROCESS_TIMESLICE * ns_per_tick);
+    } else if (!on && tc->slice.index >= 0) {
+        timer_event_cancel(&tc->slice);
+    }
+}
+
+/* Switch between the periodic tick and one-shot timers on all CPUs */
+int timer_set_tickless(int on) {
+    if (on && (!lapic_present() || !tsc_per_us)) {
+        return -1;
+    }
+    
+    uint32_t flags = irq_save();
+    tickless = on;
+    
+    // IRQ0, from the PIC or the I/O APIC, drives the periodic tick
+    if (on) {
+        irq_mask(0);
+    } else {
+        irq_unmask(0);
+    }
+    
+    // Everyone reprograms their local timer and re-arms their timeslice
+    timer_reprogram();
+    smp_resched_all();
+    process_schedule();
+    
+    irq_restore(flags);
+    return 0;
+}
+
+/* Check whether the periodic tick is off */
+int timer_is_tickless() {
+    return tickless;
+}
+
+/* Get the number of timer interrupts a CPU has taken */
+uint32_t timer_irq_count(uint32_t cpu) {
+    return cpu < MAX_CPUS ? timer_cpus[cpu].irqs : 0;
+}
+
+/* Sleeps timed to show the one-shot timer's resolution */
+#define IDLE_BENCH_SLEEPS 20
+#define IDLE_BENCH_SLEEP_US 100
+
+/* Count timer interrupts on an idle system with and without the periodic
+ * tick, then time short sleeps */
+void timer_idle_benchmark(uint32_t seconds) {
+    int was_tickless = tickless;
+    uint32_t ncpus = smp_cpu_count();
+    uint32_t before[MAX_CPUS];
+    
+    if (seconds == 0 || seconds > 60) {
+        seconds = 5;
+    }
+    
+    terminal_writestring("idle: ");
+    terminal_writedec(seconds);
+    terminal_writestring(" s per mode, ");
+    terminal_writedec(ncpus);
+    terminal_writestring(ncpus == 1 ? " CPU\n" : " CPUs\n");
+    
+    for (int mode = 0; mode < 2; mode++) {
+        if (timer_set_tickless(mode) != 0) {
+            terminal_writestring("  tickless: needs a local APIC\n");
+            break;
+        }
+        
+        for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+            before[cpu] = timer_irq_count(cpu);
+        }
+        timer_usleep(seconds * 1000000);
+        
+        uint32_t total = 0;
+        for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+            before[cpu] = timer_irq_count(cpu) - before[cpu];
+            total += before[cpu];
+        }
+        
+        terminal_writestring(mode ? "  tickless: " : "  periodic: ");
+        terminal_writedec(total / seconds);
+        terminal_writestring(" timer interrupts/s (");
+        for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+            terminal_writestring(cpu ? ", cpu" : "cpu");
+            terminal_writedec(cpu);
+            terminal_writestring(" ");
+            terminal_writedec(before[cpu] / seconds);
+        }
+        terminal_writestring(")\n");
+    }
+    
+    // Sleep resolution in the mode the system was in
+    timer_set_tickless(was_tickless);
+    
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    for (int i = 0; i < IDLE_BENCH_SLEEPS; i++) {
+        uint64_t start = timer_now_ns();
+        timer_usleep(IDLE_BENCH_SLEEP_US);
+        uint64_t slept = timer_now_ns() - start;
+        
+        sum += slept;
+        if (slept > max) {
+            max = slept;
+        }
+    }
+    
+    terminal_writestring("  usleep(");
+    terminal_writedec(IDLE_BENCH_SLEEP_US);
+    terminal_writestring("): ");
+    terminal_writedec((uint32_t)(sum / IDLE_BENCH_SLEEPS / 1000));
+    terminal_writestring(" us average, ");
+    terminal_writedec((uint32_t)(max / 1000));
+    terminal_writestring(" us worst (");
+    terminal_writestring(tickless ? "tickless" : "periodic");
+    terminal_writestring(")\n");
 }
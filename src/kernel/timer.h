@@ -3,13 +3,79 @@
 
 #include <stdint.h>
 
+/* Pending events per CPU */
+#define TIMER_HEAP_SIZE 128
+
+/* A callback run at a deadline on the CPU that armed it, in interrupt
+ * context */
+typedef struct timer_event {
+    uint64_t deadline;                       // timer_now_ns() to fire at
+    void (*callback)(struct timer_event*);
+    void *data;                              // For the callback
+    uint32_t cpu;                            // CPU whose heap holds it
+    int32_t index;                           // Heap slot, -1 when not armed
+} timer_event_t;
+
 /* Initialize the system timer */
 void timer_init(uint32_t frequency);
 
 /* Get the current tick count */
 uint32_t timer_get_ticks(void);
 
+/* Get the timer frequency in Hz */
+uint32_t timer_get_frequency(void);
+
+/* Get the time since boot in nanoseconds (tick resolution until the TSC
+ * is calibrated) */
+uint64_t timer_now_ns(void);
+
 /* Sleep for a specified number of ticks */
 void timer_sleep(uint32_t ticks);
 
+/* Sleep for a number of microseconds; the process blocks and the CPU runs
+ * other work until the deadline */
+void timer_usleep(uint32_t us);
+
+/* Measure the TSC rate against the PIT (interrupts must be on) */
+void timer_calibrate(void);
+
+/* Get the measured TSC cycles per microsecond (0 if not calibrated) */
+uint32_t timer_tsc_per_us(void);
+
+/* Busy-wait for a number of microseconds */
+void timer_udelay(uint32_t us);
+
+/* Start this CPU's local APIC timer for preemption */
+void timer_init_local(void);
+
+/* Set up a timer event */
+void timer_event_init(timer_event_t *event, void (*callback)(timer_event_t*), void *data);
+
+/* Arm an event on this CPU for a timer_now_ns() deadline; -1 if it is
+ * already armed or the CPU has TIMER_HEAP_SIZE pending */
+int timer_event_add(timer_event_t *event, uint64_t deadline);
+
+/* Disarm an event; its callback may already be running on its CPU */
+void timer_event_cancel(timer_event_t *event);
+
+/* Program this CPU's local APIC timer for the current mode */
+void timer_reprogram(void);
+
+/* Arm or disarm this CPU's timeslice (scheduler, interrupts off) */
+void timer_slice(int on);
+
+/* Switch between the periodic tick and one-shot timers on all CPUs;
+ * tickless needs a calibrated local APIC and TSC */
+int timer_set_tickless(int on);
+
+/* Check whether the periodic tick is off */
+int timer_is_tickless(void);
+
+/* Get the number of timer interrupts a CPU has taken */
+uint32_t timer_irq_count(uint32_t cpu);
+
+/* Count timer interrupts on an idle system with and without the periodic
+ * tick, then time short sleeps */
+void timer_idle_benchmark(uint32_t seconds);
+
 #endif /* TIMER_H */
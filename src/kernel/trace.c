@@ -0,0 +1,117 @@
+#include "trace.h"
+#include "serial.h"
+#include "process.h"
+#include "timer.h"
+#include "smp.h"
+#include "kernel.h"
+#include "cpu.h"
+#include <stdint.h>
+
+/* A CPU's ring; head counts every event ever recorded, so the newest is
+ * at (head - 1) & TRACE_MASK */
+typedef struct {
+    uint32_t head;
+    trace_entry_t entries[TRACE_ENTRIES];
+} trace_ring_t;
+
+static trace_ring_t trace_rings[MAX_CPUS];
+
+volatile uint32_t trace_enabled = 0;
+
+/* Record an event on the executing CPU */
+void trace_record(uint32_t type, uint32_t arg) {
+    uint32_t flags = irq_save();
+    trace_ring_t *ring = &trace_rings[cpu_id()];
+    process_t *current = process_current();
+    trace_entry_t *entry = &ring->entries[ring->head & TRACE_MASK];
+
+    entry->tsc = rdtsc();
+    entry->arg = arg;
+    entry->type = type;
+    entry->pid = current ? current->pid : 0;
+    ring->head++;
+
+    irq_restore(flags);
+}
+
+/* Start recording */
+void trace_start() {
+    trace_enabled = 1;
+}
+
+/* Stop recording */
+void trace_stop() {
+    trace_enabled = 0;
+}
+
+/* Drop all recorded events */
+void trace_clear() {
+    uint32_t was_enabled = trace_enabled;
+
+    trace_enabled = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_rings[cpu].head = 0;
+    }
+    trace_enabled = was_enabled;
+}
+
+/* Events a ring holds */
+static uint32_t trace_held(trace_ring_t *ring) {
+    return ring->head < TRACE_ENTRIES ? ring->head : TRACE_ENTRIES;
+}
+
+/* Stop recording and write the rings to the serial port. An event another
+ * CPU was recording as tracing stopped may come out torn; the decoder
+ * skips events it does not know */
+uint32_t trace_dump() {
+    uint32_t ncpus = smp_cpu_count();
+    uint32_t total = 0;
+
+    trace_stop();
+
+    trace_header_t header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.ncpus = ncpus;
+    header.tsc_per_us = timer_tsc_per_us();
+    header.entry_size = sizeof(trace_entry_t);
+    serial_write(&header, sizeof(header));
+
+    for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+        trace_ring_t *ring = &trace_rings[cpu];
+        uint32_t count = trace_held(ring);
+
+        trace_cpu_header_t cpu_header;
+        cpu_header.cpu = cpu;
+        cpu_header.count = count;
+        cpu_header.lost = ring->head - count;
+        serial_write(&cpu_header, sizeof(cpu_header));
+
+        // Oldest first: the ring may have wrapped
+        uint32_t first = ring->head - count;
+        for (uint32_t i = 0; i < count; i++) {
+            serial_write(&ring->entries[(first + i) & TRACE_MASK], sizeof(trace_entry_t));
+        }
+        total += count;
+    }
+
+    return total;
+}
+
+/* Print the events held and lost on each CPU */
+void trace_status() {
+    terminal_writestring(trace_enabled ? "trace: recording\n" : "trace: stopped\n");
+
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        trace_ring_t *ring = &trace_rings[cpu];
+        uint32_t held = trace_held(ring);
+
+        terminal_writestring("  CPU ");
+        terminal_writedec(cpu);
+        terminal_writestring(": ");
+        terminal_writedec(held);
+        terminal_writestring(" events, ");
+        terminal_writedec(ring->head - held);
+        terminal_writestring(" overwritten\n");
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Event tracing. Each CPU records timestamped events in its own ring, so
+ * recording takes no lock: only the owning CPU writes a ring, with
+ * interrupts off for the few stores an event takes. When the ring is full
+ * the oldest events are overwritten. The rings are dumped over the serial
+ * port and decoded on the host by tools/trace_decode.py.
+ */
+
+/* Events per CPU (a power of two) */
+#define TRACE_ENTRIES 8192
+#define TRACE_MASK    (TRACE_ENTRIES - 1)
+
+/* Event types; interrupt.s uses the interrupt values directly */
+#define TRACE_IRQ_ENTRY      1  // arg: vector
+#define TRACE_IRQ_EXIT       2  // arg: vector
+#define TRACE_SYSCALL_ENTRY  3  // arg: call number
+#define TRACE_SYSCALL_EXIT   4  // arg: call number
+#define TRACE_SWITCH         5  // arg: PID switched to
+#define TRACE_FAULT_ENTRY    6  // arg: faulting address
+#define TRACE_FAULT_EXIT     7  // arg: faulting address
+
+/* One event (16 bytes, also the dump format) */
+typedef struct {
+    uint64_t tsc;       // rdtsc when recorded
+    uint32_t arg;
+    uint16_t type;      // TRACE_*
+    uint16_t pid;       // Process running when recorded
+} __attribute__((packed)) trace_entry_t;
+
+/* Dump header on the serial port, followed per CPU by a trace_cpu_header_t
+ * and its events, oldest first. All fields are little endian */
+#define TRACE_MAGIC   0x4352544D  // "MTRC"
+#define TRACE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ncpus;
+    uint32_t tsc_per_us;    // 0 if the TSC was never calibrated
+    uint32_t entry_size;
+} __attribute__((packed)) trace_header_t;
+
+typedef struct {
+    uint32_t cpu;
+    uint32_t count;         // Events that follow
+    uint32_t lost;          // Older events overwritten
+} __attribute__((packed)) trace_cpu_header_t;
+
+/* Set while events are being recorded (read by interrupt.s) */
+extern volatile uint32_t trace_enabled;
+
+/* Record an event on the executing CPU */
+void trace_record(uint32_t type, uint32_t arg);
+
+/* Record an event if tracing is on */
+static inline void trace_event(uint32_t type, uint32_t arg) {
+    if (trace_enabled) {
+        trace_record(type, arg);
+    }
+}
+
+/* Start and stop recording */
+void trace_start(void);
+void trace_stop(void);
+
+/* Drop all recorded events */
+void trace_clear(void);
+
+/* Stop recording and write the rings to the serial port; returns the
+ * number of events written */
+uint32_t trace_dump(void);
+
+/* Print the events held and lost on each CPU */
+void trace_status(void);
+
+#endif /* TRACE_H */
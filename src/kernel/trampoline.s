@@ -0,0 +1,79 @@
+# Application processor startup trampoline
+#
+# smp_init() copies this code to TRAMPOLINE_BASE (below 1MB, page aligned)
+# and points the startup IPI at it. The AP starts in real mode, switches to
+# protected mode with a temporary GDT, turns on paging with the kernel page
+# directory and jumps to ap_main(cpu) on the stack smp_init() gave it.
+# Addresses are computed for the copy, not for where this is linked.
+
+.set TRAMPOLINE_BASE, 0x8000
+
+.section .text
+.global trampoline_start
+.global trampoline_end
+.global trampoline_params
+
+.code16
+trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+
+    # Enter protected mode
+    lgdtl (tramp_gdt_desc - trampoline_start + TRAMPOLINE_BASE)
+    mov %cr0, %eax
+    or $1, %eax
+    mov %eax, %cr0
+    ljmpl $0x08, $(tramp_protected - trampoline_start + TRAMPOLINE_BASE)
+
+.code32
+tramp_protected:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    mov %ax, %ss
+
+    # Same paging setup as the boot CPU: CR4 (PSE), kernel directory,
+    # then paging and write protection
+    mov (tramp_cr4 - trampoline_start + TRAMPOLINE_BASE), %eax
+    mov %eax, %cr4
+    mov (tramp_cr3 - trampoline_start + TRAMPOLINE_BASE), %eax
+    mov %eax, %cr3
+    mov %cr0, %eax
+    or $0x80010000, %eax
+    mov %eax, %cr0
+
+    # ap_main(cpu) never returns
+    mov (tramp_stack - trampoline_start + TRAMPOLINE_BASE), %esp
+    pushl (tramp_cpu - trampoline_start + TRAMPOLINE_BASE)
+    pushl $0
+    mov (tramp_entry - trampoline_start + TRAMPOLINE_BASE), %eax
+    jmp *%eax
+
+# Flat code and data segments, only used until ap_main loads the real GDT
+.align 8
+tramp_gdt:
+    .quad 0
+    .quad 0x00CF9A000000FFFF
+    .quad 0x00CF92000000FFFF
+tramp_gdt_desc:
+    .word tramp_gdt_desc - tramp_gdt - 1
+    .long (tramp_gdt - trampoline_start + TRAMPOLINE_BASE)
+
+# Filled in by smp_init() before each startup IPI (trampoline_params_t)
+.align 4
+trampoline_params:
+tramp_cr3:
+    .long 0
+tramp_cr4:
+    .long 0
+tramp_stack:
+    .long 0
+tramp_entry:
+    .long 0
+tramp_cpu:
+    .long 0
+trampoline_end:
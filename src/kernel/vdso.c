@@ -0,0 +1,81 @@
+#include "vdso.h"
+#include "memory.h"
+#include "frame.h"
+#include "process.h"
+#include "timer.h"
+#include "kernel.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Kernel view of the clock page and its frame */
+static vdso_data_t *vdso_data = 0;
+static uint32_t vdso_data_frame = 0;
+
+/* Set up the shared clock page */
+void vdso_init() {
+    uint32_t phys;
+
+    vdso_data = (vdso_data_t*)kmalloc_aligned_zeroed(PAGE_SIZE, &phys);
+    vdso_data_frame = phys / PAGE_SIZE;
+    vdso_data->frequency = timer_get_frequency();
+}
+
+/* Map a frame read-only for user mode, dropping whatever was there */
+static void vdso_map_page(page_directory_t *dir, uint32_t addr, uint32_t frame) {
+    page_t *page = get_page(addr, 1, dir);
+
+    // A forked child starts with its parent's pages, shared
+    if (page->present) {
+        frame_free(page->frame);
+    }
+
+    map_frame(page, frame, 0, 0);
+    page->cow = 0;
+}
+
+/* Map the clock page and a fresh process page into a process, replacing
+ * any copies inherited through fork */
+int vdso_map(process_t *process) {
+    if (!vdso_data) {
+        return -1;
+    }
+
+    uint32_t frame = frame_alloc();
+    if (frame == FRAME_NONE) {
+        return -1;
+    }
+
+    vdso_process_t *info = (vdso_process_t*)kmap_frame(frame);
+    memset(info, 0, PAGE_SIZE);
+    info->pid = process->pid;
+    kunmap_frame(info);
+
+    // Each mapping holds a reference; the directory's teardown drops it
+    frame_ref(vdso_data_frame);
+    vdso_map_page(process->page_directory, VDSO_DATA, vdso_data_frame);
+    vdso_map_page(process->page_directory, VDSO_PROCESS, frame);
+
+    return 0;
+}
+
+/* Publish the calibrated TSC clock */
+void vdso_update_clock(uint32_t tsc_per_us, uint64_t tsc_base, uint64_t ns_base) {
+    if (!vdso_data) {
+        return;
+    }
+
+    vdso_data->seq++;
+    __sync_synchronize();
+    vdso_data->tsc_base = tsc_base;
+    vdso_data->ns_base = ns_base;
+    vdso_data->tsc_per_us = tsc_per_us;
+    __sync_synchronize();
+    vdso_data->seq++;
+}
+
+/* Publish the tick count (periodic tick, before TSC calibration) */
+void vdso_update_tick(uint32_t tick) {
+    if (vdso_data) {
+        vdso_data->tick = tick;
+    }
+}
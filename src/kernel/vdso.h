@@ -0,0 +1,48 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+
+/*
+ * Pages the kernel maps read-only into every process so that the time and
+ * the process ID can be read without a system call. The layout part of
+ * this header is shared with the user library (src/user/vdso.c).
+ */
+
+/* User addresses, just below USER_SPACE_START */
+#define VDSO_DATA    0x3FFFE000  // Clock, shared by all processes
+#define VDSO_PROCESS 0x3FFFF000  // Per-process information
+
+/* Clock page. The kernel bumps seq to an odd value before changing the
+ * clock fields and back to even after; readers retry if seq was odd or
+ * changed under them. */
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t frequency;          // Timer ticks per second
+    volatile uint32_t tick;      // Tick count, used while tsc_per_us is 0
+    uint32_t tsc_per_us;         // TSC cycles per microsecond, 0 if not calibrated
+    uint64_t tsc_base;           // TSC value at ns_base
+    uint64_t ns_base;            // Nanoseconds since boot at tsc_base
+} vdso_data_t;
+
+/* Per-process page */
+typedef struct {
+    uint32_t pid;
+} vdso_process_t;
+
+struct process;
+
+/* Set up the shared clock page */
+void vdso_init(void);
+
+/* Map the clock page and a fresh process page into a process, replacing
+ * any copies inherited through fork */
+int vdso_map(struct process *process);
+
+/* Publish the calibrated TSC clock */
+void vdso_update_clock(uint32_t tsc_per_us, uint64_t tsc_base, uint64_t ns_base);
+
+/* Publish the tick count (periodic tick, before TSC calibration) */
+void vdso_update_tick(uint32_t tick);
+
+#endif /* VDSO_H */
@@ -0,0 +1,588 @@
+#include "vm.h"
+#include "memory.h"
+#include "frame.h"
+#include "process.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "timer.h"
+#include "zpool.h"
+#include "../fs/vfs.h"
+#include "../fs/file.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * User memory is reserved as a list of areas per process. Reserving only
+ * records the range; frames are allocated and zeroed one page at a time
+ * when the page is first touched, from the page fault handler. File-backed
+ * areas map the file's cached frames directly when the file system has a
+ * page cache (fs_node_t map), and read the page in otherwise.
+ */
+
+/* Find the area containing an address */
+vm_area_t *vm_find(process_t *process, uint32_t address) {
+    for (vm_area_t *area = process->vm_areas; area; area = area->next) {
+        if (address < area->start) {
+            break; // List is sorted
+        }
+        if (address < area->end) {
+            return area;
+        }
+    }
+    return NULL;
+}
+
+/* Insert an area, rejecting overlaps */
+static vm_area_t *vm_insert(process_t *process, uint32_t start, uint32_t end, uint32_t flags,
+                            fs_node_t *file, uint32_t offset) {
+    // Find the insertion point
+    vm_area_t **link = &process->vm_areas;
+    while (*link && (*link)->end <= start) {
+        link = &(*link)->next;
+    }
+    if (*link && (*link)->start < end) {
+        return NULL;
+    }
+    
+    vm_area_t *area = (vm_area_t*)kmalloc(sizeof(vm_area_t));
+    if (!area) {
+        return NULL;
+    }
+    
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->file = file;
+    area->offset = offset;
+    area->next = *link;
+    *link = area;
+    
+    // The area keeps the file alive after its descriptor is closed
+    vfs_ref(file);
+    
+    return area;
+}
+
+/* Reserve a virtual range in a process */
+int vm_reserve(process_t *process, uint32_t start, uint32_t size, uint32_t flags) {
+    uint32_t end = start + size;
+    
+    if (!process || size == 0 || (start & (PAGE_SIZE - 1)) || (size & (PAGE_SIZE - 1))) {
+        return -1;
+    }
+    if (start < USER_SPACE_START || end > USER_STACK_TOP || end < start) {
+        return -1;
+    }
+    
+    return vm_insert(process, start, end, flags, NULL, 0) ? 0 : -1;
+}
+
+/* Find the lowest free range for a mapping */
+static uint32_t vm_find_gap(process_t *process, uint32_t size) {
+    uint32_t base = USER_MMAP_START;
+    uint32_t limit = USER_STACK_TOP - USER_STACK_SIZE;
+    
+    for (vm_area_t *area = process->vm_areas; area; area = area->next) {
+        if (area->end <= base) {
+            continue;
+        }
+        if (area->start >= base + size) {
+            break; // Gap before this area is big enough
+        }
+        base = area->end;
+    }
+    
+    if (base + size > limit || base + size < base) {
+        return MAP_FAILED;
+    }
+    return base;
+}
+
+/* Map anonymous memory or a file */
+uint32_t vm_map(process_t *process, uint32_t addr, uint32_t length, uint32_t prot,
+                uint32_t flags, fs_node_t *file, uint32_t offset) {
+    if (!process || length == 0 || (offset & (PAGE_SIZE - 1))) {
+        return MAP_FAILED;
+    }
+    if (!(flags & (MAP_SHARED | MAP_PRIVATE))) {
+        return MAP_FAILED;
+    }
+    
+    length = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t vm_flags = prot & (VM_READ | VM_WRITE);
+    
+    if (flags & MAP_ANONYMOUS) {
+        file = NULL;
+        offset = 0;
+    } else if (!file) {
+        return MAP_FAILED;
+    } else if (flags & MAP_SHARED) {
+        // Shared writable mappings need a page cache to write into, and
+        // a file that can be written
+        if ((vm_flags & VM_WRITE) && (!file->map || !file->write)) {
+            return MAP_FAILED;
+        }
+        vm_flags |= VM_SHARED;
+    }
+    
+    if (flags & MAP_FIXED) {
+        if ((addr & (PAGE_SIZE - 1)) || addr < USER_SPACE_START ||
+            addr + length > USER_STACK_TOP || addr + length < addr) {
+            return MAP_FAILED;
+        }
+        vm_release(process, addr, length);
+    } else {
+        addr = vm_find_gap(process, length);
+        if (addr == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+    }
+    
+    if (!vm_insert(process, addr, addr + length, vm_flags, file, offset)) {
+        return MAP_FAILED;
+    }
+    
+    return addr;
+}
+
+/* Free the frames committed to part of an area */
+static void vm_unmap_range(process_t *process, uint32_t start, uint32_t end) {
+    page_directory_t *dir = process->page_directory;
+    int current = (dir == paging_current_directory());
+    
+    if (!dir) {
+        return;
+    }
+    
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        page_t *page = get_page(addr, 0, dir);
+        if (page && page->present) {
+            free_frame(page);
+            page->cow = 0;
+            page->shared = 0;
+            if (current) {
+                invlpg(addr);
+            }
+        }
+    }
+}
+
+/* Release a virtual range */
+int vm_release(process_t *process, uint32_t start, uint32_t size) {
+    uint32_t end = start + size;
+    
+    if (!process || (start & (PAGE_SIZE - 1)) || (size & (PAGE_SIZE - 1)) || end < start) {
+        return -1;
+    }
+    
+    vm_area_t **link = &process->vm_areas;
+    while (*link) {
+        vm_area_t *area = *link;
+        
+        if (area->end <= start) {
+            link = &area->next;
+            continue;
+        }
+        if (area->start >= end) {
+            break;
+        }
+        
+        uint32_t lo = area->start > start ? area->start : start;
+        uint32_t hi = area->end < end ? area->end : end;
+        vm_unmap_range(process, lo, hi);
+        
+        if (lo == area->start && hi == area->end) {
+            // Whole area
+            *link = area->next;
+            vfs_unref(area->file);
+            kfree(area);
+            continue;
+        }
+        
+        if (lo == area->start) {
+            area->offset += hi - area->start;
+            area->start = hi;
+        } else if (hi == area->end) {
+            area->end = lo;
+        } else {
+            // Hole in the middle: split in two
+            vm_area_t *tail = (vm_area_t*)kmalloc(sizeof(vm_area_t));
+            if (!tail) {
+                return -1;
+            }
+            *tail = *area;
+            vfs_ref(tail->file);
+            tail->offset += hi - area->start;
+            tail->start = hi;
+            area->end = lo;
+            area->next = tail;
+        }
+        link = &area->next;
+    }
+    
+    return 0;
+}
+
+/* Reserve the default heap and stack regions of a new process */
+void vm_setup_process(process_t *process) {
+    vm_reserve(process, USER_HEAP_START, USER_HEAP_SIZE, VM_READ | VM_WRITE);
+    vm_reserve(process, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, VM_READ | VM_WRITE);
+}
+
+/* Copy the area list of one process into another */
+int vm_clone_areas(process_t *dst, process_t *src) {
+    vm_area_t **link = &dst->vm_areas;
+    
+    *link = NULL;
+    for (vm_area_t *area = src->vm_areas; area; area = area->next) {
+        vm_area_t *copy = (vm_area_t*)kmalloc(sizeof(vm_area_t));
+        if (!copy) {
+            vm_free_areas(dst);
+            return -1;
+        }
+        *copy = *area;
+        copy->next = NULL;
+        vfs_ref(copy->file);
+        *link = copy;
+        link = &copy->next;
+    }
+    
+    return 0;
+}
+
+/* Free every area of a process */
+void vm_free_areas(process_t *process) {
+    while (process->vm_areas) {
+        vm_area_t *area = process->vm_areas;
+        process->vm_areas = area->next;
+        vfs_unref(area->file);
+        kfree(area);
+    }
+}
+
+/* Fill a page of a file-backed area */
+static int vm_fault_file(process_t *process, vm_area_t *area, page_t *page, uint32_t page_addr) {
+    uint32_t offset = area->offset + (page_addr - area->start);
+    int writeable = (area->flags & VM_WRITE) != 0;
+    
+    // Page cache hit: share the cached frame. Private writable mappings
+    // get it read-only and copy on the first write.
+    uint32_t frame = vfs_map(area->file, offset);
+    if (frame != VFS_MAP_NONE) {
+        int shared = (area->flags & VM_SHARED) != 0;
+        map_frame(page, frame, 0, writeable && shared);
+        page->cow = writeable && !shared;
+        page->shared = shared;
+        process->minor_faults++;
+        return 0;
+    }
+    
+    // No page cache: read the page into a private frame
+    frame = frame_alloc();
+    if (frame == FRAME_NONE) {
+        return -1;
+    }
+    
+    uint8_t *data = (uint8_t*)kmap_frame(frame);
+    memset(data, 0, PAGE_SIZE); // Past end of file reads as zeroes
+    vfs_read(area->file, offset, PAGE_SIZE, data);
+    kunmap_frame(data);
+    
+    map_frame(page, frame, 0, writeable);
+    process->major_faults++;
+    
+    return 0;
+}
+
+/* Resolve a not-present fault in the current process */
+int vm_handle_fault(uint32_t address, uint32_t error) {
+    process_t *process = process_current();
+    
+    // Threads fault in their owner's memory
+    if (process && process->mm_owner) {
+        process = process->mm_owner;
+    }
+    
+    if (!process || !process->page_directory || (error & PF_PRESENT)) {
+        return -1;
+    }
+    
+    vm_area_t *area = vm_find(process, address);
+    if (!area) {
+        return -1;
+    }
+    if ((error & PF_WRITE) && !(area->flags & VM_WRITE)) {
+        return -1;
+    }
+    
+    page_t *page = get_page(address, 1, process->page_directory);
+    if (!page) {
+        return -1;
+    }
+    
+    if (area->file) {
+        return vm_fault_file(process, area, page, address & ~(PAGE_SIZE - 1));
+    }
+    
+    // Demand-zero: the frame is cleared before it becomes visible
+    uint32_t frame = alloc_zeroed_frame();
+    if (frame == FRAME_NONE) {
+        return -1;
+    }
+    
+    map_frame(page, frame, 0, area->flags & VM_WRITE);
+    process->minor_faults++;
+    
+    return 0;
+}
+
+/* Check a user range the kernel is about to touch for a system call. Each
+ * page must be in an area of the process (a writable one for writes) and
+ * is committed now, so the kernel never takes a not-present fault on it;
+ * writes to copy-on-write pages are still resolved by the fault handler */
+int vm_check_user(uint32_t addr, uint32_t size, int write) {
+    process_t *process = process_current();
+    
+    // Threads (the polled ring's thread) act on their owner's memory
+    if (process && process->mm_owner) {
+        process = process->mm_owner;
+    }
+    
+    if (!process || !process->page_directory) {
+        return -1;
+    }
+    if (addr < USER_SPACE_START || addr > USER_STACK_TOP || size > USER_STACK_TOP - addr) {
+        return -1;
+    }
+    
+    for (uint32_t page_addr = addr & ~(PAGE_SIZE - 1); page_addr < addr + size; page_addr += PAGE_SIZE) {
+        vm_area_t *area = vm_find(process, page_addr);
+        if (!area || (write && !(area->flags & VM_WRITE))) {
+            return -1;
+        }
+        
+        page_t *page = get_page(page_addr, 0, process->page_directory);
+        if (!page || !page->present) {
+            if (vm_handle_fault(page_addr, write ? PF_WRITE : 0) != 0) {
+                return -1;
+            }
+            page = get_page(page_addr, 0, process->page_directory);
+        }
+        if (!page || !page->present || !page->user || (write && !page->rw && !page->cow)) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/* Copy from user memory, or fail without touching an invalid range */
+int copy_from_user(void *dst, uint32_t src, uint32_t size) {
+    if (vm_check_user(src, size, 0) != 0) {
+        return -1;
+    }
+    memcpy(dst, (const void*)src, size);
+    return 0;
+}
+
+/* Copy to user memory, or fail without touching an invalid range */
+int copy_to_user(uint32_t dst, const void *src, uint32_t size) {
+    if (vm_check_user(dst, size, 1) != 0) {
+        return -1;
+    }
+    memcpy((void*)dst, src, size);
+    return 0;
+}
+
+/* Pages reserved by a process */
+uint32_t vm_reserved_pages(process_t *process) {
+    uint32_t pages = 0;
+    
+    for (vm_area_t *area = process->vm_areas; area; area = area->next) {
+        pages += (area->end - area->start) / PAGE_SIZE;
+    }
+    
+    return pages;
+}
+
+/* Frames committed to a process's areas */
+uint32_t vm_committed_pages(process_t *process) {
+    uint32_t pages = 0;
+    
+    if (!process->page_directory) {
+        return 0;
+    }
+    
+    for (vm_area_t *area = process->vm_areas; area; area = area->next) {
+        for (uint32_t addr = area->start; addr < area->end; addr += PAGE_SIZE) {
+            page_t *page = get_page(addr, 0, process->page_directory);
+            if (page && page->present) {
+                pages++;
+            }
+        }
+    }
+    
+    return pages;
+}
+
+/* Benchmark file: its pages live in frames, like a page cache */
+static uint32_t bench_file_read(fs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+    uint32_t *frames = (uint32_t*)node->impl;
+    
+    if (offset >= node->length) {
+        return 0;
+    }
+    if (size > node->length - offset) {
+        size = node->length - offset;
+    }
+    
+    for (uint32_t done = 0; done < size; ) {
+        uint32_t pos = offset + done;
+        uint32_t chunk = PAGE_SIZE - (pos % PAGE_SIZE);
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        
+        uint8_t *data = (uint8_t*)kmap_frame(frames[pos / PAGE_SIZE]);
+        memcpy(buffer + done, data + (pos % PAGE_SIZE), chunk);
+        kunmap_frame(data);
+        done += chunk;
+    }
+    
+    return size;
+}
+
+/* Benchmark file: hand out a reference to a cached frame */
+static uint32_t bench_file_map(fs_node_t *node, uint32_t offset) {
+    if (offset >= node->length) {
+        return VFS_MAP_NONE;
+    }
+    
+    uint32_t frame = ((uint32_t*)node->impl)[offset / PAGE_SIZE];
+    frame_ref(frame);
+    return frame;
+}
+
+/* Sum a buffer a word at a time */
+static uint32_t bench_scan(const uint32_t *words, uint32_t bytes) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < bytes / sizeof(uint32_t); i++) {
+        sum += words[i];
+    }
+    return sum;
+}
+
+/* Print one benchmark result line */
+static void bench_report(const char *label, uint64_t cycles, uint32_t ticks, uint32_t megabytes, uint32_t pages) {
+    terminal_writestring(label);
+    terminal_writedec((uint32_t)(cycles / pages));
+    terminal_writestring(" cycles/page");
+    if (ticks) {
+        terminal_writestring(", ");
+        terminal_writedec((megabytes * timer_get_frequency()) / ticks);
+        terminal_writestring(" MB/s");
+    }
+    terminal_writestring("\n");
+}
+
+/* Compare scanning a file through mmap() against file_read() */
+void vm_mmap_benchmark(uint32_t megabytes) {
+    process_t *process = process_current();
+    uint32_t npages = megabytes * (1024 * 1024 / PAGE_SIZE);
+    uint32_t filled = 0;
+    
+    if (!process || !process->page_directory || npages == 0) {
+        terminal_writestring("mmap: no address space to map into\n");
+        return;
+    }
+    
+    uint32_t *frames = (uint32_t*)kmalloc(npages * sizeof(uint32_t));
+    fs_node_t *node = vfs_alloc_node();
+    uint8_t *buffer = (uint8_t*)kmalloc(PAGE_SIZE);
+    if (!frames || !node || !buffer) {
+        terminal_writestring("mmap: out of memory\n");
+        goto out;
+    }
+    
+    // Build the file in frames with a known pattern
+    for (; filled < npages; filled++) {
+        uint32_t frame = frame_alloc();
+        if (frame == FRAME_NONE) {
+            terminal_writestring("mmap: not enough free memory for the file\n");
+            goto out;
+        }
+        frames[filled] = frame;
+        
+        uint32_t *data = (uint32_t*)kmap_frame(frame);
+        for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+            data[i] = (filled * 1024 + i) * 2654435761u;
+        }
+        kunmap_frame(data);
+    }
+    
+    strcpy(node->name, "mmap-bench");
+    node->mask = 0444;
+    node->flags = VFS_FILE;
+    node->length = npages * PAGE_SIZE;
+    node->impl = (uint32_t)frames;
+    node->read = bench_file_read;
+    node->map = bench_file_map;
+    
+    terminal_writestring("mmap: sequential scan of a ");
+    terminal_writedec(megabytes);
+    terminal_writestring("MB file\n");
+    
+    // Read path: copy through a 4KB buffer
+    int fd = file_open_node(node, O_RDONLY);
+    uint32_t read_sum = 0;
+    uint32_t start_tick = timer_get_ticks();
+    uint64_t start = rdtsc();
+    int n;
+    while ((n = file_read(fd, buffer, PAGE_SIZE)) > 0) {
+        read_sum += bench_scan((uint32_t*)buffer, n);
+    }
+    uint64_t read_cycles = rdtsc() - start;
+    uint32_t read_ticks = timer_get_ticks() - start_tick;
+    
+    // Map path: first pass takes one fault per page, second runs mapped
+    uint32_t addr = vm_map(process, 0, node->length, PROT_READ, MAP_PRIVATE, file_get_node(fd), 0);
+    if (addr == MAP_FAILED) {
+        terminal_writestring("mmap: mapping failed\n");
+        file_close(fd);
+        goto out;
+    }
+    
+    uint32_t faults = process->minor_faults;
+    start_tick = timer_get_ticks();
+    start = rdtsc();
+    uint32_t map_sum = bench_scan((uint32_t*)addr, node->length);
+    uint64_t fault_cycles = rdtsc() - start;
+    uint32_t fault_ticks = timer_get_ticks() - start_tick;
+    faults = process->minor_faults - faults;
+    
+    start_tick = timer_get_ticks();
+    start = rdtsc();
+    bench_scan((uint32_t*)addr, node->length);
+    uint64_t mapped_cycles = rdtsc() - start;
+    uint32_t mapped_ticks = timer_get_ticks() - start_tick;
+    
+    vm_release(process, addr, node->length);
+    file_close(fd);
+    
+    bench_report("  file_read (4KB): ", read_cycles, read_ticks, megabytes, npages);
+    bench_report("  mmap, faulting:  ", fault_cycles, fault_ticks, megabytes, npages);
+    bench_report("  mmap, mapped:    ", mapped_cycles, mapped_ticks, megabytes, npages);
+    terminal_writestring("  ");
+    terminal_writedec(faults);
+    terminal_writestring(" minor faults, checksums ");
+    terminal_writestring(read_sum == map_sum ? "match\n" : "DIFFER\n");
+    
+out:
+    while (filled) {
+        frame_free(frames[--filled]);
+    }
+    kfree(buffer);
+    vfs_free_node(node);
+    kfree(frames);
+}
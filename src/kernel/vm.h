@@ -0,0 +1,81 @@
+#ifndef VM_H
+#define VM_H
+
+#include "process.h"
+#include <stdint.h>
+
+/* User address space layout */
+#define USER_SPACE_START  0x40000000
+#define USER_HEAP_START   0x40000000
+#define USER_HEAP_SIZE    0x10000000  // 256MB reserved, committed on first touch
+#define USER_MMAP_START   0x50000000  // mmap() places mappings from here up
+#define USER_STACK_TOP    0xC0000000
+#define USER_STACK_SIZE   0x00100000  // 1MB reserved, committed on first touch
+
+/* Virtual memory area flags */
+#define VM_READ   0x1
+#define VM_WRITE  0x2
+#define VM_SHARED 0x4  // Writes go to the backing file's pages
+
+/* mmap() protection and flags */
+#define PROT_READ      VM_READ
+#define PROT_WRITE     VM_WRITE
+#define MAP_SHARED     0x01
+#define MAP_PRIVATE    0x02
+#define MAP_FIXED      0x10
+#define MAP_ANONYMOUS  0x20
+#define MAP_FAILED     0xFFFFFFFF
+
+struct fs_node;
+
+/* A reserved range of user virtual memory */
+typedef struct vm_area {
+    uint32_t start;            // First address (page aligned)
+    uint32_t end;              // One past the last address (page aligned)
+    uint32_t flags;            // VM_* flags
+    struct fs_node *file;      // Backing file, or NULL for anonymous memory
+    uint32_t offset;           // File offset of start
+    struct vm_area *next;      // Next area, sorted by address
+} vm_area_t;
+
+/* Reserve a virtual range in a process without committing frames */
+int vm_reserve(process_t *process, uint32_t start, uint32_t size, uint32_t flags);
+
+/* Map anonymous memory or a file; returns the address or MAP_FAILED */
+uint32_t vm_map(process_t *process, uint32_t addr, uint32_t length, uint32_t prot,
+                uint32_t flags, struct fs_node *file, uint32_t offset);
+
+/* Release a virtual range, freeing any frames committed to it */
+int vm_release(process_t *process, uint32_t start, uint32_t size);
+
+/* Find the area containing an address */
+vm_area_t *vm_find(process_t *process, uint32_t address);
+
+/* Reserve the default heap and stack regions of a new process */
+void vm_setup_process(process_t *process);
+
+/* Copy the area list of one process into another (for fork) */
+int vm_clone_areas(process_t *dst, process_t *src);
+
+/* Free every area of a process */
+void vm_free_areas(process_t *process);
+
+/* Resolve a not-present fault; returns 0 if the fault was handled */
+int vm_handle_fault(uint32_t address, uint32_t error);
+
+/* Check that a user range is mapped, committing its pages, before the
+ * kernel touches it; write asks for a writable range. 0 if it is usable */
+int vm_check_user(uint32_t addr, uint32_t size, int write);
+
+/* Copy to or from user memory; -1 without copying if the range is bad */
+int copy_from_user(void *dst, uint32_t src, uint32_t size);
+int copy_to_user(uint32_t dst, const void *src, uint32_t size);
+
+/* Compare scanning a file through mmap() against file_read() */
+void vm_mmap_benchmark(uint32_t megabytes);
+
+/* Pages reserved by, and frames committed to, a process */
+uint32_t vm_reserved_pages(process_t *process);
+uint32_t vm_committed_pages(process_t *process);
+
+#endif /* VM_H */
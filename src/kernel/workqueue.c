@@ -0,0 +1,186 @@
+#include "workqueue.h"
+#include "softirq.h"
+#include "process.h"
+#include "memory.h"
+#include "timer.h"
+#include "cpu.h"
+#include "kernel.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Shared kernel queue */
+static workqueue_t *system_wq = NULL;
+
+/* Set up a work item */
+void work_init(work_t *work, void (*fn)(work_t*), void *data) {
+    work->fn = fn;
+    work->data = data;
+    work->next = NULL;
+    work->pending = 0;
+}
+
+/* Queue thread: run work in order, sleep when there is none */
+static void worker(void *arg) {
+    workqueue_t *wq = (workqueue_t*)arg;
+
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&wq->lock);
+        work_t *work = wq->head;
+        if (!work) {
+            process_block_unlock(&wq->lock);
+            irq_restore(flags);
+            continue;
+        }
+
+        wq->head = work->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+        work->next = NULL;
+        work->pending = 0; // May be queued again from here on
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        work->fn(work);
+        wq->runs++;
+    }
+}
+
+/* Create a queue and start its thread */
+workqueue_t *workqueue_create(const char *name, uint32_t priority) {
+    workqueue_t *wq = (workqueue_t*)kmalloc(sizeof(workqueue_t));
+    if (!wq) {
+        return NULL;
+    }
+    memset(wq, 0, sizeof(workqueue_t));
+    spin_init(&wq->lock);
+
+    wq->thread = process_create_kernel(name, worker, wq, priority, PROCESS_CPU_ALL);
+    return wq;
+}
+
+/* Queue work */
+int work_queue(workqueue_t *wq, work_t *work) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    if (work->pending) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return -1;
+    }
+
+    work->pending = 1;
+    work->next = NULL;
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+    spin_unlock(&wq->lock);
+
+    // After the unlock: the worker is either blocked already or will see
+    // the item before it blocks
+    process_wake(wq->thread);
+    irq_restore(flags);
+
+    return 0;
+}
+
+/* Queue work on the shared kernel queue */
+int schedule_work(work_t *work) {
+    return system_wq ? work_queue(system_wq, work) : -1;
+}
+
+/* Start the shared kernel queue */
+void workqueue_init() {
+    system_wq = workqueue_create("kworker", 1);
+}
+
+/* Benchmark state: when the last item was handed over, the total wait,
+ * and who waits for each item to run */
+static volatile uint64_t defer_start;
+static volatile uint64_t defer_cycles;
+static volatile uint32_t defer_runs;
+static spinlock_t defer_lock = SPINLOCK_INIT;
+static process_t *defer_waiter;
+
+/* Benchmark softirq and work: add up the time since the hand-over */
+static void defer_bench_softirq() {
+    uint64_t now = rdtsc();
+    uint32_t flags = spin_lock_irqsave(&defer_lock);
+
+    defer_cycles += now - defer_start;
+    defer_runs++;
+    spin_unlock(&defer_lock);
+
+    process_wake(defer_waiter);
+    irq_restore(flags);
+}
+
+static void defer_bench_work(work_t *work) {
+    (void)work;
+    defer_bench_softirq();
+}
+
+/* Wait until the benchmark item has run a number of times */
+static void defer_wait(uint32_t runs) {
+    uint32_t flags = spin_lock_irqsave(&defer_lock);
+
+    while (defer_runs < runs) {
+        process_block_unlock(&defer_lock);
+        spin_lock(&defer_lock);
+    }
+    spin_unlock_irqrestore(&defer_lock, flags);
+}
+
+/* Print one benchmark line */
+static void defer_report(const char *method, uint64_t cycles, uint32_t rounds) {
+    uint32_t tsc_per_us = timer_tsc_per_us();
+
+    terminal_writestring(method);
+    if (tsc_per_us) {
+        terminal_writedec((uint32_t)(cycles * 1000 / tsc_per_us / rounds));
+        terminal_writestring(" ns (");
+        terminal_writedec((uint32_t)(cycles / rounds));
+        terminal_writestring(" cycles)\n");
+    } else {
+        terminal_writedec((uint32_t)(cycles / rounds));
+        terminal_writestring(" cycles\n");
+    }
+}
+
+/* Time from raising a softirq and from queueing work until it runs */
+void deferred_benchmark(uint32_t rounds) {
+    work_t work;
+
+    if (rounds == 0 || !system_wq) {
+        return;
+    }
+
+    terminal_writestring("defer: ");
+    terminal_writedec(rounds);
+    terminal_writestring(" hand-overs each\n");
+    defer_waiter = process_current();
+
+    // ksoftirqd runs on this CPU
+    softirq_register(SOFTIRQ_BENCH, defer_bench_softirq);
+    defer_cycles = 0;
+    defer_runs = 0;
+    for (uint32_t i = 0; i < rounds; i++) {
+        defer_start = rdtsc();
+        softirq_raise(SOFTIRQ_BENCH);
+        defer_wait(i + 1);
+    }
+    softirq_register(SOFTIRQ_BENCH, 0);
+    defer_report("  softirq raise to run: ", defer_cycles, rounds);
+
+    // kworker may run on any CPU
+    work_init(&work, defer_bench_work, NULL);
+    defer_cycles = 0;
+    defer_runs = 0;
+    for (uint32_t i = 0; i < rounds; i++) {
+        defer_start = rdtsc();
+        schedule_work(&work);
+        defer_wait(i + 1);
+    }
+    defer_report("  work queue to run:    ", defer_cycles, rounds);
+}
@@ -0,0 +1,49 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "spinlock.h"
+#include <stdint.h>
+
+/*
+ * Work queues: functions queued from anywhere, interrupt handlers
+ * included, and run one after another by the queue's kernel thread. Work
+ * may block, unlike a softirq handler, which holds up every other softirq
+ * on its CPU while it runs.
+ */
+
+/* A function to run later; a work item is queued at most once at a time */
+typedef struct work {
+    void (*fn)(struct work*);
+    void *data;                  // For the function
+    struct work *next;           // Next queued item
+    volatile uint32_t pending;   // Queued and not yet started
+} work_t;
+
+/* A queue and the thread that runs it */
+typedef struct workqueue {
+    spinlock_t lock;             // Protects head and tail
+    work_t *head;
+    work_t *tail;
+    struct process *thread;
+    uint32_t runs;               // Work items run
+} workqueue_t;
+
+/* Set up a work item */
+void work_init(work_t *work, void (*fn)(work_t*), void *data);
+
+/* Create a queue and start its thread */
+workqueue_t *workqueue_create(const char *name, uint32_t priority);
+
+/* Queue work; returns -1 if it is already queued */
+int work_queue(workqueue_t *wq, work_t *work);
+
+/* Queue work on the shared kernel queue (kworker) */
+int schedule_work(work_t *work);
+
+/* Start the shared kernel queue */
+void workqueue_init(void);
+
+/* Time from raising a softirq and from queueing work until it runs */
+void deferred_benchmark(uint32_t rounds);
+
+#endif /* WORKQUEUE_H */
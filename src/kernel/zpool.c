@@ -0,0 +1,207 @@
+#include "zpool.h"
+#include "frame.h"
+#include "memory.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Frames are zeroed ahead of time by the idle loop and kept in a small
+ * stack, so page tables, demand-zero faults and new stacks can take a
+ * clean frame without clearing 4KB on the critical path. When the pool
+ * runs dry the frame is zeroed inline.
+ */
+
+static uint32_t pool[ZPOOL_SIZE];
+static uint32_t pool_count = 0;
+static zpool_stats_t stats;
+static spinlock_t pool_lock = SPINLOCK_INIT;
+
+/* Zero one mapped page */
+void zero_page(void *page) {
+    uint32_t count = PAGE_SIZE / sizeof(uint32_t);
+    asm volatile("cld; rep stosl" : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+/* Zero a frame through a temporary mapping */
+static void zero_frame(uint32_t frame) {
+    void *page = kmap_frame(frame);
+    zero_page(page);
+    kunmap_frame(page);
+}
+
+/* Allocate a zero-filled frame */
+uint32_t alloc_zeroed_frame() {
+    uint32_t flags = spin_lock_irqsave(&pool_lock);
+    
+    if (pool_count > 0) {
+        uint32_t frame = pool[--pool_count];
+        stats.hits++;
+        spin_unlock_irqrestore(&pool_lock, flags);
+        return frame;
+    }
+    
+    stats.misses++;
+    spin_unlock_irqrestore(&pool_lock, flags);
+    
+    uint32_t frame = frame_alloc();
+    if (frame != FRAME_NONE) {
+        zero_frame(frame);
+    }
+    return frame;
+}
+
+/* Zero up to max frames into the pool */
+uint32_t zpool_refill(uint32_t max) {
+    uint32_t added = 0;
+    
+    while (added < max && pool_count < ZPOOL_SIZE) {
+        // Leave the last free frames to real allocations
+        if (frame_count_free() <= ZPOOL_SIZE) {
+            break;
+        }
+        
+        uint32_t frame = frame_alloc();
+        if (frame == FRAME_NONE) {
+            break;
+        }
+        
+        // Zero with interrupts on; only the push is atomic
+        zero_frame(frame);
+        
+        uint32_t flags = spin_lock_irqsave(&pool_lock);
+        if (pool_count < ZPOOL_SIZE) {
+            pool[pool_count++] = frame;
+            stats.refilled++;
+            frame = FRAME_NONE;
+        }
+        spin_unlock_irqrestore(&pool_lock, flags);
+        
+        if (frame != FRAME_NONE) {
+            frame_free(frame); // Filled by someone else meanwhile
+            break;
+        }
+        added++;
+    }
+    
+    return added;
+}
+
+/* Get pool statistics */
+void zpool_get_stats(zpool_stats_t *out) {
+    *out = stats;
+    out->ready = pool_count;
+}
+
+/* Reference: the field-by-field loop get_page() used for new tables */
+static void zero_page_fields(page_table_t *table) {
+    for (int i = 0; i < 1024; i++) {
+        table->pages[i].present = 0;
+        table->pages[i].rw = 0;
+        table->pages[i].user = 0;
+        table->pages[i].cow = 0;
+        table->pages[i].frame = 0;
+    }
+}
+
+/* SSE2 non-temporal stores; needs CR4.OSFXSR */
+static void zero_page_sse2(void *page) {
+    uint32_t blocks = PAGE_SIZE / 64;
+    asm volatile("pxor %%xmm0, %%xmm0\n"
+                 "1: movntdq %%xmm0, (%0)\n"
+                 "movntdq %%xmm0, 16(%0)\n"
+                 "movntdq %%xmm0, 32(%0)\n"
+                 "movntdq %%xmm0, 48(%0)\n"
+                 "add $64, %0\n"
+                 "dec %1\n"
+                 "jnz 1b\n"
+                 "sfence"
+                 : "+r"(page), "+r"(blocks) : : "memory");
+}
+
+/* Print one benchmark line */
+static void bench_report(const char *label, uint64_t cycles, uint32_t pages) {
+    terminal_writestring(label);
+    terminal_writedec((uint32_t)(cycles / pages));
+    terminal_writestring(" cycles/page\n");
+}
+
+/* Compare page zeroing methods and report the pool hit rate */
+void zpool_benchmark(uint32_t pages) {
+    page_table_t *buffer = (page_table_t*)kmalloc_aligned(PAGE_SIZE);
+    if (!buffer || pages == 0) {
+        terminal_writestring("zero: out of memory\n");
+        return;
+    }
+    
+    terminal_writestring("zero: ");
+    terminal_writedec(pages);
+    terminal_writestring(" pages\n");
+    
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < pages; i++) {
+        zero_page_fields(buffer);
+    }
+    bench_report("  per-field loop: ", rdtsc() - start, pages);
+    
+    start = rdtsc();
+    for (uint32_t i = 0; i < pages; i++) {
+        zero_page(buffer);
+    }
+    bench_report("  rep stosl:      ", rdtsc() - start, pages);
+    
+    // The kernel does not save SSE state, so SSE is only switched on here
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_EDX_SSE2) {
+        uint32_t flags = irq_save();
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 | CR4_OSFXSR);
+        
+        start = rdtsc();
+        for (uint32_t i = 0; i < pages; i++) {
+            zero_page_sse2(buffer);
+        }
+        uint64_t cycles = rdtsc() - start;
+        
+        write_cr4(cr4);
+        irq_restore(flags);
+        bench_report("  SSE2 movntdq:   ", cycles, pages);
+    } else {
+        terminal_writestring("  SSE2 movntdq:   not supported\n");
+    }
+    
+    // Inline zeroing of a fresh frame, as on a pool miss. The frame is
+    // taken straight from the allocator so the pool and its statistics
+    // are left alone.
+    uint32_t frame = frame_alloc();
+    if (frame != FRAME_NONE) {
+        start = rdtsc();
+        zero_frame(frame);
+        bench_report("  inline frame zeroing (pool miss): ", rdtsc() - start, 1);
+        frame_free(frame);
+    }
+    
+    uint32_t total = stats.hits + stats.misses;
+    terminal_writestring("  pool: ");
+    terminal_writedec(pool_count);
+    terminal_writestring("/");
+    terminal_writedec(ZPOOL_SIZE);
+    terminal_writestring(" ready, ");
+    terminal_writedec(stats.hits);
+    terminal_writestring(" hits, ");
+    terminal_writedec(stats.misses);
+    terminal_writestring(" misses");
+    if (total) {
+        terminal_writestring(" (");
+        terminal_writedec((uint32_t)(((uint64_t)stats.hits * 100) / total));
+        terminal_writestring("% hit rate)");
+    }
+    terminal_writestring(", ");
+    terminal_writedec(stats.refilled);
+    terminal_writestring(" zeroed in idle time\n");
+    
+    kfree(buffer);
+}
@@ -0,0 +1,35 @@
+#ifndef ZPOOL_H
+#define ZPOOL_H
+
+#include <stdint.h>
+
+/* Pre-zeroed frames kept ready (1MB) */
+#define ZPOOL_SIZE   256
+
+/* Frames zeroed per idle-loop pass */
+#define ZPOOL_BATCH  8
+
+/* Zeroed-frame pool statistics */
+typedef struct {
+    uint32_t ready;      // Frames in the pool now
+    uint32_t hits;       // Allocations served from the pool
+    uint32_t misses;     // Allocations that zeroed inline
+    uint32_t refilled;   // Frames zeroed in idle time
+} zpool_stats_t;
+
+/* Allocate a zero-filled frame, or FRAME_NONE */
+uint32_t alloc_zeroed_frame(void);
+
+/* Zero up to max frames into the pool; returns how many were added */
+uint32_t zpool_refill(uint32_t max);
+
+/* Zero one mapped page */
+void zero_page(void *page);
+
+/* Get pool statistics */
+void zpool_get_stats(zpool_stats_t *stats);
+
+/* Compare page zeroing methods and report the pool hit rate */
+void zpool_benchmark(uint32_t pages);
+
+#endif /* ZPOOL_H */
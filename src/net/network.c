@@ -1,5 +1,8 @@
 #include "network.h"
 #include "../kernel/kernel.h"
+#include "../kernel/kmem.h"
+#include "../kernel/softirq.h"
+#include "../kernel/spinlock.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -10,6 +13,40 @@
 static net_interface_t* interfaces[MAX_INTERFACES];
 static uint32_t num_interfaces = 0;
 
+/* Cache for net_packet_t */
+static kmem_cache_t* packet_cache = NULL;
+
+/* Received packets waiting for the NET_RX softirq */
+#define RX_BACKLOG 256
+static net_packet_t* rx_backlog[RX_BACKLOG];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+static uint32_t rx_dropped = 0;
+static spinlock_t rx_lock = SPINLOCK_INIT;
+
+/* Packets processed per softirq run before letting other softirqs in */
+#define RX_BUDGET 64
+
+/* NET_RX softirq: run queued packets through the stack */
+static void network_rx_softirq() {
+    for (int i = 0; i < RX_BUDGET; i++) {
+        uint32_t flags = spin_lock_irqsave(&rx_lock);
+        if (rx_head == rx_tail) {
+            spin_unlock_irqrestore(&rx_lock, flags);
+            return;
+        }
+        net_packet_t* packet = rx_backlog[rx_head % RX_BACKLOG];
+        rx_head++;
+        spin_unlock_irqrestore(&rx_lock, flags);
+        
+        network_process_packet(packet);
+        network_free_packet(packet);
+    }
+    
+    // Budget used up: come back after the other softirqs
+    softirq_raise(SOFTIRQ_NET_RX);
+}
+
 /* Initialize the network stack */
 void network_init() {
     terminal_writestring("Initializing network stack...\n");
@@ -19,6 +56,9 @@ void network_init() {
         interfaces[i] = NULL;
     }
     
+    packet_cache = kmem_cache_create("net_packet", sizeof(net_packet_t));
+    softirq_register(SOFTIRQ_NET_RX, network_rx_softirq);
+    
     // Create loopback interface
     net_interface_t* loopback = (net_interface_t*)kmalloc(sizeof(net_interface_t));
     memset(loopback, 0, sizeof(net_interface_t));
@@ -87,6 +127,34 @@ net_packet_t* network_receive_packet() {
     return NULL;
 }
 
+/* Hand a received packet to the stack; called by drivers from their
+ * interrupt handlers, the protocol work runs later in the NET_RX softirq */
+int network_rx(net_packet_t* packet) {
+    if (!packet) {
+        return -1;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&rx_lock);
+    if (rx_tail - rx_head >= RX_BACKLOG) {
+        rx_dropped++;
+        spin_unlock_irqrestore(&rx_lock, flags);
+        network_free_packet(packet);
+        return -1;
+    }
+    rx_backlog[rx_tail % RX_BACKLOG] = packet;
+    rx_tail++;
+    spin_unlock(&rx_lock);
+    
+    softirq_raise(SOFTIRQ_NET_RX);
+    irq_restore(flags);
+    return 0;
+}
+
+/* Get the number of received packets dropped for a full backlog */
+uint32_t network_rx_dropped() {
+    return rx_dropped;
+}
+
 /* Process a received packet */
 void network_process_packet(net_packet_t* packet) {
     if (!packet || !packet->data) {
@@ -115,7 +183,7 @@ void network_process_packet(net_packet_t* packet) {
 /* Allocate a packet buffer */
 net_packet_t* network_alloc_packet(uint32_t size) {
     // Allocate the packet structure
-    net_packet_t* packet = (net_packet_t*)kmalloc(sizeof(net_packet_t));
+    net_packet_t* packet = (net_packet_t*)kmem_cache_alloc(packet_cache);
     if (!packet) {
         return NULL;
     }
@@ -123,7 +191,7 @@ net_packet_t* network_alloc_packet(uint32_t size) {
     // Allocate the data buffer
     packet->data = (uint8_t*)kmalloc(size);
     if (!packet->data) {
-        kfree(packet);
+        kmem_cache_free(packet_cache, packet);
         return NULL;
     }
     
@@ -147,7 +215,7 @@ void network_free_packet(net_packet_t* packet) {
     }
     
     // Free the packet structure
-    kfree(packet);
+    kmem_cache_free(packet_cache, packet);
 }
 
 /* Get an interface by name */
@@ -99,7 +99,14 @@ int network_send_packet(net_packet_t* packet);
 /* Receive a packet */
 net_packet_t* network_receive_packet(void);
 
-/* Process a received packet */
+/* Hand a received packet to the stack from a driver's interrupt handler;
+ * it is processed and freed later in the NET_RX softirq */
+int network_rx(net_packet_t* packet);
+
+/* Get the number of received packets dropped for a full backlog */
+uint32_t network_rx_dropped(void);
+
+/* Process a received packet (NET_RX softirq) */
 void network_process_packet(net_packet_t* packet);
 
 /* Allocate a packet buffer */
@@ -2,12 +2,20 @@
 #include "network.h"
 #include "ip.h"
 #include "../kernel/kernel.h"
+#include "../kernel/kmem.h"
 #include <stdint.h>
 #include <string.h>
 
 /* TCP connections list */
 static tcp_connection_t* tcp_connections = NULL;
 
+/* Largest segment payload carved from the segment cache */
+#define TCP_SEGMENT_DATA 1460
+
+/* Caches for connections and outgoing segments */
+static kmem_cache_t* conn_cache = NULL;
+static kmem_cache_t* segment_cache = NULL;
+
 /* TCP port allocator */
 static uint16_t next_ephemeral_port = 49152; // Start of dynamic/private ports
 
@@ -18,6 +26,9 @@ void tcp_init() {
     // Initialize the connections list
     tcp_connections = NULL;
     
+    conn_cache = kmem_cache_create("tcp_connection", sizeof(tcp_connection_t));
+    segment_cache = kmem_cache_create("tcp_segment", sizeof(tcp_header_t) + TCP_SEGMENT_DATA);
+    
     terminal_writestring("TCP protocol handler initialized\n");
 }
 
@@ -41,7 +52,7 @@ static tcp_connection_t* tcp_find_connection(uint32_t local_ip, uint16_t local_p
 static tcp_connection_t* tcp_create_connection(uint32_t local_ip, uint16_t local_port,
                                              uint32_t remote_ip, uint16_t remote_port) {
     // Allocate a new connection
-    tcp_connection_t* conn = (tcp_connection_t*)kmalloc(sizeof(tcp_connection_t));
+    tcp_connection_t* conn = (tcp_connection_t*)kmem_cache_alloc(conn_cache);
     if (!conn) {
         return NULL;
     }
@@ -283,8 +294,9 @@ int tcp_send_packet(tcp_connection_t* conn, uint8_t flags, void* data, uint32_t
     // Calculate the total packet size
     uint32_t total_size = sizeof(tcp_header_t) + length;
     
-    // Allocate a buffer for the TCP packet
-    uint8_t* buffer = (uint8_t*)kmalloc(total_size);
+    // Allocate a buffer for the TCP packet; full-size segments come from the cache
+    int cached = (length <= TCP_SEGMENT_DATA);
+    uint8_t* buffer = cached ? (uint8_t*)kmem_cache_alloc(segment_cache) : (uint8_t*)kmalloc(total_size);
     if (!buffer) {
         return -1;
     }
@@ -323,7 +335,11 @@ int tcp_send_packet(tcp_connection_t* conn, uint8_t flags, void* data, uint32_t
     int result = ip_send_packet(network_get_interface("eth0"), IP_PROTO_TCP, conn->remote_ip, buffer, total_size);
     
     // Free the buffer
-    kfree(buffer);
+    if (cached) {
+        kmem_cache_free(segment_cache, buffer);
+    } else {
+        kfree(buffer);
+    }
     
     // Update the sequence number if we sent data or SYN/FIN
     if (length > 0) {
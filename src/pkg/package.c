@@ -1,5 +1,6 @@
 #include "package.h"
 #include "../kernel/kernel.h"
+#include "../boot/initcall.h"
 #include "../fs/file.h"
 #include "../security/user.h"
 #include <stdint.h>
@@ -67,6 +68,8 @@ void package_init() {
 
 /* Refresh the package database */
 int package_refresh() {
+    initcall_require("package");
+    
     terminal_writestring("Refreshing package database...\n");
     
     // In a real implementation, this would download package lists from repositories
@@ -173,6 +176,8 @@ int package_refresh() {
 
 /* Search for packages */
 package_t** package_search(const char* query, uint32_t* count) {
+    initcall_require("package");
+    
     if (!query || !count) {
         return NULL;
     }
@@ -206,6 +211,8 @@ package_t** package_search(const char* query, uint32_t* count) {
 
 /* Get package information */
 package_t* package_get_info(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return NULL;
     }
@@ -222,6 +229,8 @@ package_t* package_get_info(const char* name) {
 
 /* Install a package */
 int package_install(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return -1;
     }
@@ -268,6 +277,8 @@ int package_install(const char* name) {
 
 /* Remove a package */
 int package_remove(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return -1;
     }
@@ -311,6 +322,8 @@ int package_remove(const char* name) {
 
 /* Upgrade a package */
 int package_upgrade(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return -1;
     }
@@ -355,6 +368,8 @@ int package_upgrade(const char* name) {
 
 /* Upgrade all packages */
 int package_upgrade_all() {
+    initcall_require("package");
+    
     terminal_writestring("Upgrading all packages...\n");
     
     int upgraded_count = 0;
@@ -377,6 +392,8 @@ int package_upgrade_all() {
 
 /* Check if a package is installed */
 int package_is_installed(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return 0;
     }
@@ -392,6 +409,8 @@ int package_is_installed(const char* name) {
 
 /* Get the list of installed packages */
 package_t** package_get_installed(uint32_t* count) {
+    initcall_require("package");
+    
     if (!count) {
         return NULL;
     }
@@ -431,6 +450,8 @@ package_t** package_get_installed(uint32_t* count) {
 
 /* Verify the integrity of an installed package */
 int package_verify(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return 0;
     }
@@ -454,6 +475,8 @@ int package_verify(const char* name) {
 
 /* Add a package repository */
 int package_add_repo(const char* url, const char* name, const char* key) {
+    initcall_require("package");
+    
     if (!url || !name) {
         return -1;
     }
@@ -494,6 +517,8 @@ int package_add_repo(const char* url, const char* name, const char* key) {
 
 /* Remove a package repository */
 int package_remove_repo(const char* name) {
+    initcall_require("package");
+    
     if (!name) {
         return -1;
     }
@@ -522,6 +547,8 @@ int package_remove_repo(const char* name) {
 
 /* Get the list of package repositories */
 char** package_get_repos(uint32_t* count) {
+    initcall_require("package");
+    
     if (!count) {
         return NULL;
     }
@@ -1,5 +1,6 @@
 #include "update.h"
 #include "../kernel/kernel.h"
+#include "../boot/initcall.h"
 #include "../fs/file.h"
 #include <stdint.h>
 #include <string.h>
@@ -45,6 +46,8 @@ void update_init() {
 
 /* Check for available updates */
 int update_check() {
+    initcall_require("update");
+    
     terminal_writestring("Checking for updates...\n");
     
     // In a real implementation, this would connect to an update server
@@ -97,11 +100,15 @@ int update_check() {
 
 /* Get the number of available updates */
 int update_get_count() {
+    initcall_require("update");
+    
     return update_count;
 }
 
 /* Get an update package by index */
 update_package_t* update_get_package(int index) {
+    initcall_require("update");
+    
     if (index < 0 || index >= update_count) {
         return NULL;
     }
@@ -111,6 +118,8 @@ update_package_t* update_get_package(int index) {
 
 /* Download an update package */
 int update_download(int index) {
+    initcall_require("update");
+    
     if (index < 0 || index >= update_count) {
         return -1;
     }
@@ -136,6 +145,8 @@ int update_download(int index) {
 
 /* Install an update package */
 int update_install(int index) {
+    initcall_require("update");
+    
     if (index < 0 || index >= update_count) {
         return -1;
     }
@@ -168,6 +179,8 @@ int update_install(int index) {
 
 /* Install all available updates */
 int update_install_all() {
+    initcall_require("update");
+    
     if (update_count == 0) {
         return 0; // No updates to install
     }
@@ -198,11 +211,15 @@ int update_install_all() {
 
 /* Get the current update status */
 int update_get_status() {
+    initcall_require("update");
+    
     return update_status;
 }
 
 /* Verify the integrity of an update package */
 int update_verify(int index) {
+    initcall_require("update");
+    
     if (index < 0 || index >= update_count) {
         return 0;
     }
@@ -215,6 +232,8 @@ int update_verify(int index) {
 
 /* Roll back the last update */
 int update_rollback() {
+    initcall_require("update");
+    
     // In a real implementation, this would roll back the last update
     // For now, we'll just simulate the rollback
     
@@ -230,6 +249,8 @@ int update_rollback() {
 
 /* Set automatic update settings */
 int update_set_auto(int enabled, int security_only) {
+    initcall_require("update");
+    
     auto_update_enabled = enabled ? 1 : 0;
     auto_update_security_only = security_only ? 1 : 0;
     
@@ -238,6 +259,8 @@ int update_set_auto(int enabled, int security_only) {
 
 /* Get automatic update settings */
 int update_get_auto(int* security_only) {
+    initcall_require("update");
+    
     if (security_only) {
         *security_only = auto_update_security_only;
     }
@@ -2,6 +2,23 @@
 #include "../kernel/kernel.h"
 #include "../fs/file.h"
 #include "../net/network.h"
+#include "../kernel/memory.h"
+#include "../kernel/heap.h"
+#include "../kernel/frame.h"
+#include "../kernel/process.h"
+#include "../kernel/vm.h"
+#include "../kernel/kmem.h"
+#include "../kernel/kmtrace.h"
+#include "../kernel/zpool.h"
+#include "../kernel/smp.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/trace.h"
+#include "../boot/bootlog.h"
+#include "../boot/initrd.h"
+#include "../kernel/syscall.h"
+#include "../kernel/sysring.h"
+#include "../kernel/workqueue.h"
+#include "../kernel/timer.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -46,6 +63,12 @@ void shell_init() {
     shell_register_command("ifconfig", "Configure network interfaces", shell_cmd_ifconfig);
     shell_register_command("ping", "Send ICMP ECHO_REQUEST to network hosts", shell_cmd_ping);
     shell_register_command("netstat", "Print network connections", shell_cmd_netstat);
+    shell_register_command("bench", "Run a kernel benchmark", shell_cmd_bench);
+    shell_register_command("kmem", "Show kernel object cache statistics", shell_cmd_kmem);
+    shell_register_command("kmprof", "Show top kmalloc call sites", shell_cmd_kmprof);
+    shell_register_command("interrupts", "Show interrupt counts or move an IRQ", shell_cmd_interrupts);
+    shell_register_command("trace", "Record kernel events and dump them to the serial port", shell_cmd_trace);
+    shell_register_command("bootlog", "Show how long each boot stage took", shell_cmd_bootlog);
     
     // Clear command history
     for (int i = 0; i < SHELL_HISTORY_SIZE; i++) {
@@ -344,14 +367,41 @@ int shell_cmd_touch(int argc, char** argv) {
     return 0;
 }
 
+/* Print a number right-aligned in a column */
+static void shell_write_column(uint32_t value, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    
+    while (width-- > digits) {
+        terminal_writestring(" ");
+    }
+    terminal_writedec(value);
+}
+
 /* Built-in command: ps */
 int shell_cmd_ps(int argc, char** argv) {
-    // In a real implementation, this would display process status
-    // For now, we'll just print a message
+    // Indexed by process_state_t: ready, running, blocked, terminated
+    static const char* states[] = { "S", "R", "B", "Z" };
+    
     terminal_writestring("Process status:\n");
-    terminal_writestring("  PID  TTY  TIME     CMD\n");
-    terminal_writestring("    1  tty1  00:00:01 init\n");
-    terminal_writestring("    2  tty1  00:00:00 shell\n");
+    terminal_writestring("  PID S CPU  MINFLT  MAJFLT  COWFLT   RSV(KB)   COM(KB) CMD\n");
+    
+    for (process_t* p = process_get_list(); p; p = p->next) {
+        shell_write_column(p->pid, 5);
+        terminal_writestring(" ");
+        terminal_writestring(states[p->state]);
+        shell_write_column(p->cpu, 4);
+        shell_write_column(p->minor_faults, 8);
+        shell_write_column(p->major_faults, 8);
+        shell_write_column(p->cow_faults, 8);
+        shell_write_column(vm_reserved_pages(p) * (PAGE_SIZE / 1024), 10);
+        shell_write_column(vm_committed_pages(p) * (PAGE_SIZE / 1024), 10);
+        terminal_writestring(" ");
+        terminal_writestring(p->name);
+        terminal_writestring("\n");
+    }
     
     return 0;
 }
@@ -409,3 +459,234 @@ int shell_cmd_netstat(int argc, char** argv) {
     
     return 0;
 }
+
+/* Parse an unsigned decimal argument, falling back to a default */
+static uint32_t shell_parse_uint(const char* str, uint32_t fallback) {
+    uint32_t value = 0;
+    
+    if (!str || !*str) {
+        return fallback;
+    }
+    
+    while (*str) {
+        if (*str < '0' || *str > '9') {
+            return fallback;
+        }
+        value = value * 10 + (*str - '0');
+        str++;
+    }
+    
+    return value;
+}
+
+/* Built-in command: bench */
+int shell_cmd_bench(int argc, char** argv) {
+    if (argc < 2) {
+        terminal_writestring("Usage: bench <heap|frames|tlb|mmap|zero|switch|sched|smp|idle|syscall|ring|defer|initrd> [iterations]\n");
+        return -1;
+    }
+    
+    if (strcmp(argv[1], "heap") == 0) {
+        heap_benchmark(shell_parse_uint(argv[2], 2000000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "frames") == 0) {
+        frame_benchmark(shell_parse_uint(argv[2], 1000000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "tlb") == 0) {
+        paging_benchmark(shell_parse_uint(argv[2], 1000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "mmap") == 0) {
+        vm_mmap_benchmark(shell_parse_uint(argv[2], 64));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "zero") == 0) {
+        zpool_benchmark(shell_parse_uint(argv[2], 10000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "switch") == 0) {
+        process_switch_benchmark(shell_parse_uint(argv[2], 100000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "sched") == 0) {
+        process_schedule_benchmark(shell_parse_uint(argv[2], 10000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "smp") == 0) {
+        smp_benchmark(shell_parse_uint(argv[2], 800000000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "idle") == 0) {
+        timer_idle_benchmark(shell_parse_uint(argv[2], 5));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "syscall") == 0) {
+        syscall_benchmark(shell_parse_uint(argv[2], 100000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "ring") == 0) {
+        sysring_benchmark(shell_parse_uint(argv[2], 100000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "defer") == 0) {
+        deferred_benchmark(shell_parse_uint(argv[2], 10000));
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "initrd") == 0) {
+        initrd_benchmark();
+        return 0;
+    }
+    
+    terminal_writestring("bench: unknown benchmark: ");
+    terminal_writestring(argv[1]);
+    terminal_writestring("\n");
+    
+    return -1;
+}
+
+/* Built-in command: kmem */
+int shell_cmd_kmem(int argc, char** argv) {
+    terminal_writestring("CACHE                    SIZE        HITS      MISSES  HIT%\n");
+    
+    for (kmem_cache_t* cache = kmem_cache_list(); cache; cache = cache->next) {
+        uint32_t hits, misses;
+        kmem_cache_get_stats(cache, &hits, &misses);
+        
+        terminal_writestring(cache->name);
+        for (uint32_t len = strlen(cache->name); len < KMEM_NAME_LEN; len++) {
+            terminal_writestring(" ");
+        }
+        shell_write_column(cache->size, 5);
+        shell_write_column(hits, 12);
+        shell_write_column(misses, 12);
+        shell_write_column(hits + misses ? (uint32_t)(((uint64_t)hits * 100) / (hits + misses)) : 0, 6);
+        terminal_writestring("\n");
+    }
+    
+    return 0;
+}
+
+/* Built-in command: kmprof */
+int shell_cmd_kmprof(int argc, char** argv) {
+    uint32_t count = 10;
+    int order = -1; // Both
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "bytes") == 0) {
+            order = KMTRACE_BY_BYTES;
+        } else if (strcmp(argv[i], "count") == 0) {
+            order = KMTRACE_BY_COUNT;
+        } else {
+            count = shell_parse_uint(argv[i], 0);
+            if (count == 0) {
+                terminal_writestring("Usage: kmprof [bytes|count] [N]\n");
+                return -1;
+            }
+        }
+    }
+    
+    if (order != KMTRACE_BY_COUNT) {
+        kmtrace_dump(count, KMTRACE_BY_BYTES);
+    }
+    if (order != KMTRACE_BY_BYTES) {
+        kmtrace_dump(count, KMTRACE_BY_COUNT);
+    }
+    
+    return 0;
+}
+
+/* Built-in command: interrupts */
+int shell_cmd_interrupts(int argc, char** argv) {
+    if (argc == 3) {
+        uint32_t irq = shell_parse_uint(argv[1], ~0u);
+        uint32_t cpu = shell_parse_uint(argv[2], ~0u);
+        
+        if (irq_set_affinity(irq, cpu) != 0) {
+            terminal_writestring("interrupts: cannot move that IRQ (needs the I/O APIC and an online CPU)\n");
+            return -1;
+        }
+        return 0;
+    }
+    if (argc != 1) {
+        terminal_writestring("Usage: interrupts [irq cpu]\n");
+        return -1;
+    }
+    
+    uint32_t cpus = smp_cpu_count();
+    
+    terminal_writestring("VEC");
+    for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+        terminal_writestring("        CPU");
+        terminal_writedec(cpu);
+    }
+    terminal_writestring(" SOURCE\n");
+    
+    // Vectors nothing arrived on are left out
+    for (uint32_t vector = 0; vector < 256; vector++) {
+        uint32_t total = 0;
+        for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+            total += interrupt_count(cpu, vector);
+        }
+        if (!total) {
+            continue;
+        }
+        
+        shell_write_column(vector, 3);
+        for (uint32_t cpu = 0; cpu < cpus; cpu++) {
+            shell_write_column(interrupt_count(cpu, vector), 12);
+        }
+        terminal_writestring(" ");
+        terminal_writestring(interrupt_name(vector));
+        terminal_writestring("\n");
+    }
+    
+    return 0;
+}
+
+/* Built-in command: trace */
+int shell_cmd_trace(int argc, char** argv) {
+    if (argc < 2 || strcmp(argv[1], "status") == 0) {
+        trace_status();
+    } else if (strcmp(argv[1], "start") == 0) {
+        trace_start();
+    } else if (strcmp(argv[1], "stop") == 0) {
+        trace_stop();
+    } else if (strcmp(argv[1], "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(argv[1], "dump") == 0) {
+        uint32_t events = trace_dump();
+        terminal_writestring("trace: ");
+        terminal_writedec(events);
+        terminal_writestring(" events written to the serial port\n");
+    } else {
+        terminal_writestring("Usage: trace [start|stop|clear|dump|status]\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* Built-in command: bootlog */
+int shell_cmd_bootlog(int argc, char** argv) {
+    bootlog_print();
+    
+    terminal_writestring("Kernel entry to end of initialization: ");
+    terminal_writedec(bootlog_total_us());
+    terminal_writestring(timer_tsc_per_us() ? " us\n" : " cycles\n");
+    
+    return 0;
+}
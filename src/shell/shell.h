@@ -51,5 +51,11 @@ int shell_cmd_kill(int argc, char** argv);
 int shell_cmd_ifconfig(int argc, char** argv);
 int shell_cmd_ping(int argc, char** argv);
 int shell_cmd_netstat(int argc, char** argv);
+int shell_cmd_bench(int argc, char** argv);
+int shell_cmd_kmem(int argc, char** argv);
+int shell_cmd_kmprof(int argc, char** argv);
+int shell_cmd_interrupts(int argc, char** argv);
+int shell_cmd_trace(int argc, char** argv);
+int shell_cmd_bootlog(int argc, char** argv);
 
 #endif /* SHELL_H */
@@ -0,0 +1,80 @@
+#include "sysring.h"
+#include "../kernel/syscall.h"
+#include <stdint.h>
+
+/* Keep the compiler from moving ring accesses across this point; x86
+ * keeps loads in order and stores in order */
+static inline void barrier(void) {
+    asm volatile("" : : : "memory");
+}
+
+/* Enter the kernel with up to three arguments */
+static inline int syscall3(uint32_t num, uint32_t a, uint32_t b, uint32_t c) {
+    int result;
+    asm volatile("int $0x80" : "=a"(result) : "a"(num), "b"(a), "c"(b), "d"(c) : "memory");
+    return result;
+}
+
+/* Set up the calling process's ring */
+sysring_t* sysring_open(uint32_t flags) {
+    int addr = syscall3(SYS_RING_SETUP, flags, 0, 0);
+    return addr == -1 ? 0 : (sysring_t*)addr;
+}
+
+/* Queue a call */
+int sysring_queue(sysring_t* ring, uint32_t num, const uint32_t* args, uint32_t user_data) {
+    uint32_t tail = ring->sq_tail;
+
+    if (tail - ring->sq_head >= SYSRING_ENTRIES) {
+        return -1;
+    }
+
+    sysring_sqe_t* sqe = &ring->sq[tail & SYSRING_MASK];
+    sqe->num = num;
+    for (int i = 0; i < 6; i++) {
+        sqe->args[i] = args[i];
+    }
+    sqe->user_data = user_data;
+    barrier();
+    ring->sq_tail = tail + 1;
+    return 0;
+}
+
+/* Hand the queued calls to the kernel */
+int sysring_submit(sysring_t* ring) {
+    uint32_t pending = ring->sq_tail - ring->sq_head;
+
+    if (!(ring->flags & SYSRING_POLLED)) {
+        return syscall3(SYS_RING_ENTER, pending, 0, 0);
+    }
+
+    // The polling thread picks them up unless it sleeps; the full barrier
+    // orders the caller's tail store before the flags load
+    __sync_synchronize();
+    if (ring->flags & SYSRING_NEED_WAKEUP) {
+        return syscall3(SYS_RING_ENTER, pending, 0, SYSRING_ENTER_WAKEUP);
+    }
+    return 0;
+}
+
+/* Take the oldest completion */
+int sysring_complete(sysring_t* ring, sysring_cqe_t* cqe, int wait) {
+    uint32_t head = ring->cq_head;
+
+    while (head == ring->cq_tail) {
+        if (!wait) {
+            return -1;
+        }
+        // Wait in the kernel, which also wakes a sleeping polling thread
+        syscall3(SYS_RING_ENTER, 0, 1, SYSRING_ENTER_WAKEUP);
+        if (head == ring->cq_tail && ring->sq_head == ring->sq_tail) {
+            return -1; // Nothing pending either
+        }
+    }
+
+    barrier();
+    *cqe = ring->cq[head & SYSRING_MASK];
+    barrier();
+    ring->cq_head = head + 1;
+    return 0;
+}
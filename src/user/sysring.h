@@ -0,0 +1,29 @@
+#ifndef USER_SYSRING_H
+#define USER_SYSRING_H
+
+#include <stdint.h>
+#include "../kernel/sysring.h"
+
+/*
+ * Batched system calls through the ring shared with the kernel
+ * (kernel/sysring.h). Queue calls with sysring_queue(), hand them over
+ * with sysring_submit() and collect results with sysring_complete().
+ */
+
+/* Set up the calling process's ring; flags are SYSRING_SETUP_*.
+ * Returns the ring, or 0 on failure */
+sysring_t* sysring_open(uint32_t flags);
+
+/* Queue a call; returns -1 if the submission ring is full */
+int sysring_queue(sysring_t* ring, uint32_t num, const uint32_t* args, uint32_t user_data);
+
+/* Hand the queued calls to the kernel. Without a polling thread they
+ * have completed on return; with one, this only traps to wake the thread
+ * if it sleeps. Returns the number of calls run now, or -1 */
+int sysring_submit(sysring_t* ring);
+
+/* Take the oldest completion, waiting for it if wait is set; returns -1
+ * if there is none */
+int sysring_complete(sysring_t* ring, sysring_cqe_t* cqe, int wait);
+
+#endif /* USER_SYSRING_H */
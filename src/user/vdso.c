@@ -0,0 +1,53 @@
+#include "vdso.h"
+#include "../kernel/vdso.h"
+#include <stdint.h>
+
+/* Read the time-stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Keep the compiler from moving reads across the sequence checks; x86
+ * does not reorder loads with other loads */
+static inline void barrier(void) {
+    asm volatile("" : : : "memory");
+}
+
+/* Get the time since boot in nanoseconds */
+uint64_t vdso_time_ns() {
+    const vdso_data_t *data = (const vdso_data_t*)VDSO_DATA;
+    uint32_t seq, tsc_per_us, tick, frequency;
+    uint64_t tsc_base, ns_base, tsc;
+
+    // Retry while the kernel is updating the clock
+    do {
+        seq = data->seq;
+        barrier();
+        tsc_per_us = data->tsc_per_us;
+        tsc_base = data->tsc_base;
+        ns_base = data->ns_base;
+        tick = data->tick;
+        frequency = data->frequency;
+        tsc = rdtsc();
+        barrier();
+    } while ((seq & 1) || seq != data->seq);
+
+    // Not calibrated: tick resolution
+    if (!tsc_per_us) {
+        return (uint64_t)tick * (1000000000 / frequency);
+    }
+    return ns_base + (tsc - tsc_base) * 1000 / tsc_per_us;
+}
+
+/* Get the timer ticks since boot (as SYS_TIME returns) */
+uint32_t vdso_ticks() {
+    const vdso_data_t *data = (const vdso_data_t*)VDSO_DATA;
+    return (uint32_t)(vdso_time_ns() / (1000000000 / data->frequency));
+}
+
+/* Get the ID of the calling process (as SYS_GETPID returns) */
+uint32_t vdso_getpid() {
+    return ((const vdso_process_t*)VDSO_PROCESS)->pid;
+}
@@ -0,0 +1,20 @@
+#ifndef USER_VDSO_H
+#define USER_VDSO_H
+
+#include <stdint.h>
+
+/*
+ * Reads of the pages the kernel maps into every process (kernel/vdso.h).
+ * None of these trap into the kernel.
+ */
+
+/* Get the time since boot in nanoseconds */
+uint64_t vdso_time_ns(void);
+
+/* Get the timer ticks since boot (as SYS_TIME returns) */
+uint32_t vdso_ticks(void);
+
+/* Get the ID of the calling process (as SYS_GETPID returns) */
+uint32_t vdso_getpid(void);
+
+#endif /* USER_VDSO_H */
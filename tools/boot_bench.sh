@@ -0,0 +1,108 @@
+#!/bin/bash
+# Boot MinOS in QEMU several times and report boot time percentiles
+#
+# Usage: boot_bench.sh [runs]   (10 by default)
+#
+# Each boot loads the kernel straight from QEMU (no GRUB menu) with the
+# serial port going to a file, and waits for the "BOOTLOG done" line the
+# kernel prints once initialization is complete (see src/boot/bootlog.c).
+# Set INITRD to boot with an initial ramdisk module, e.g. to compare raw
+# and compressed images made by tools/initrd_create; the wall clock time
+# includes QEMU loading it.
+
+set -e
+
+# Configuration
+BUILD_DIR=${BUILD_DIR:-/home/ubuntu/MinOS-Implementation/build}
+KERNEL_BIN=${KERNEL_BIN:-$BUILD_DIR/iso/boot/kernel.bin}
+QEMU=${QEMU:-qemu-system-i386}
+QEMU_ARGS=${QEMU_ARGS:--m 512 -smp 2}
+TIMEOUT=${TIMEOUT:-30}
+INITRD=${INITRD:-}
+RUNS=${1:-10}
+
+if [ ! -f "$KERNEL_BIN" ]; then
+    echo "Error: kernel not found at $KERNEL_BIN"
+    echo "Please run build.sh first, or set KERNEL_BIN."
+    exit 1
+fi
+
+if [ -n "$INITRD" ] && [ ! -f "$INITRD" ]; then
+    echo "Error: initrd not found at $INITRD"
+    exit 1
+fi
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Print min, p50, p90, p99 and max of the numbers in a file
+percentiles() {
+    sort -n "$1" | awk '
+        { v[NR] = $1 }
+        END {
+            if (NR == 0) { print "no samples"; exit }
+            p50 = v[int((NR - 1) * 0.50) + 1]
+            p90 = v[int((NR - 1) * 0.90) + 1]
+            p99 = v[int((NR - 1) * 0.99) + 1]
+            printf "min %d  p50 %d  p90 %d  p99 %d  max %d\n", v[1], p50, p90, p99, v[NR]
+        }'
+}
+
+echo "Booting $KERNEL_BIN${INITRD:+ with $INITRD} $RUNS times..."
+
+failed=0
+for run in $(seq 1 "$RUNS"); do
+    log="$WORK_DIR/run$run.log"
+    started=$(date +%s%N)
+    $QEMU -kernel "$KERNEL_BIN" ${INITRD:+-initrd "$INITRD"} $QEMU_ARGS -display none -no-reboot \
+        -serial "file:$log" > /dev/null 2>&1 &
+    qemu_pid=$!
+
+    # Wait for the kernel's summary line
+    waited=0
+    while ! grep -q "^BOOTLOG done" "$log" 2>/dev/null; do
+        if [ "$waited" -ge $((TIMEOUT * 100)) ] || ! kill -0 "$qemu_pid" 2>/dev/null; then
+            break
+        fi
+        sleep 0.01
+        waited=$((waited + 1))
+    done
+    wall_ms=$((($(date +%s%N) - started) / 1000000))
+    kill "$qemu_pid" 2>/dev/null || true
+    wait "$qemu_pid" 2>/dev/null || true
+
+    done_line=$(grep "^BOOTLOG done" "$log" | head -n 1 | tr -d '\r')
+    if [ -z "$done_line" ]; then
+        echo "  run $run: no BOOTLOG line within ${TIMEOUT}s"
+        failed=$((failed + 1))
+        continue
+    fi
+
+    unit=$(echo "$done_line" | awk '{ print $4 }')
+    echo "$done_line" | awk '{ print $3 }' >> "$WORK_DIR/total"
+    echo "$wall_ms" >> "$WORK_DIR/wall"
+    grep "^BOOTLOG stage" "$log" | tr -d '\r' | awk -v dir="$WORK_DIR" '{ print $4 >> (dir "/stage." $3) }'
+    grep "^BOOTLOG stage" "$log" | tr -d '\r' | awk '{ print $3 }' > "$WORK_DIR/order"
+    echo "  run $run: $(echo "$done_line" | awk '{ print $3, $4 }'), ${wall_ms} ms wall"
+done
+
+if [ ! -s "$WORK_DIR/total" ]; then
+    echo "No boot completed"
+    exit 1
+fi
+
+echo
+echo "Kernel entry to end of initialization ($unit), $((RUNS - failed)) of $RUNS boots:"
+echo "  $(percentiles "$WORK_DIR/total")"
+echo
+echo "QEMU start to end of initialization (ms, wall clock):"
+echo "  $(percentiles "$WORK_DIR/wall")"
+echo
+echo "Per stage ($unit):"
+while read -r stage; do
+    printf "  %-20s %s\n" "$stage" "$(percentiles "$WORK_DIR/stage.$stage")"
+done < "$WORK_DIR/order"
+
+if [ "$failed" -ne 0 ]; then
+    exit 1
+fi
@@ -0,0 +1,305 @@
+/*
+ * Build a MinOS initial ramdisk from the regular files in a directory
+ *
+ * Usage: initrd_create [-r] <directory> <output>
+ *
+ * By default each file is cut into 64KB chunks compressed as independent
+ * LZ4 blocks (format version 2), which the kernel decodes as the file is
+ * read. -r writes the uncompressed version 1 format instead. Build with
+ * "cc -O2 -o initrd_create tools/initrd_create.c". The format is described
+ * in src/boot/initrd.h; the definitions below must match it.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define INITRD_MAGIC       0x52444E49
+#define INITRD_VERSION     0x0001
+#define INITRD_VERSION_LZ4 0x0002
+#define INITRD_CHUNK_SIZE  0x10000
+#define INITRD_NAME_SIZE   64
+
+/* LZ4 block rules: the last 5 bytes are literals and the last match
+ * starts at least 12 bytes before the end */
+#define LZ4_LAST_LITERALS  5
+#define LZ4_MATCH_LIMIT    12
+#define LZ4_MIN_MATCH      4
+#define LZ4_MAX_OFFSET     65535
+#define LZ4_HASH_BITS      14
+
+/* Worst case size of a compressed chunk */
+#define LZ4_BOUND(n)       ((n) + (n) / 255 + 16)
+
+/* A file going into the image */
+typedef struct {
+    char name[INITRD_NAME_SIZE];
+    uint8_t* data;
+    uint32_t length;
+    uint8_t* stored;      /* Bytes written for the file */
+    uint32_t stored_length;
+} entry_t;
+
+/* Read a little-endian 32-bit word from unaligned memory */
+static uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Write a little-endian 32-bit word */
+static void write32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* Write an LZ4 length extension for a length of 15 or more */
+static uint8_t* lz4_write_length(uint8_t* op, uint32_t length) {
+    for (length -= 15; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* Write one sequence: literals, then a match unless match_length is 0 */
+static uint8_t* lz4_write_sequence(uint8_t* op, const uint8_t* literals, uint32_t literal_length,
+                                   uint32_t offset, uint32_t match_length) {
+    uint8_t* token = op++;
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15) {
+        op = lz4_write_length(op, literal_length);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        match_length -= LZ4_MIN_MATCH;
+        *token |= match_length < 15 ? match_length : 15;
+        if (match_length >= 15) {
+            op = lz4_write_length(op, match_length);
+        }
+    }
+    return op;
+}
+
+/* Compress one block with greedy hash matching; returns the compressed
+ * size, at most LZ4_BOUND(length) */
+static uint32_t lz4_compress(const uint8_t* src, uint32_t length, uint8_t* dst) {
+    static uint32_t table[1 << LZ4_HASH_BITS];  /* Position + 1 of the last 4 bytes with each hash */
+    uint8_t* op = dst;
+    uint32_t anchor = 0;
+    uint32_t ip = 0;
+
+    memset(table, 0, sizeof(table));
+
+    if (length > LZ4_MATCH_LIMIT) {
+        while (ip < length - LZ4_MATCH_LIMIT) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            uint32_t ref = table[hash];
+            table[hash] = ip + 1;
+
+            if (!ref || ip - (ref - 1) > LZ4_MAX_OFFSET || read32(src + ref - 1) != sequence) {
+                ip++;
+                continue;
+            }
+            ref--;
+
+            /* Extend the match forwards, then backwards over pending literals */
+            uint32_t match_length = LZ4_MIN_MATCH;
+            while (ip + match_length < length - LZ4_LAST_LITERALS && src[ref + match_length] == src[ip + match_length]) {
+                match_length++;
+            }
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+                match_length++;
+            }
+
+            op = lz4_write_sequence(op, src + anchor, ip - anchor, ip - ref, match_length);
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    op = lz4_write_sequence(op, src + anchor, length - anchor, 0, 0);
+    return op - dst;
+}
+
+/* Store a file as a chunk table followed by its chunks, each compressed
+ * unless that would not make it smaller */
+static void store_lz4(entry_t* entry) {
+    uint32_t nchunks = (entry->length + INITRD_CHUNK_SIZE - 1) / INITRD_CHUNK_SIZE;
+    uint32_t table_size = nchunks * 4;
+    uint8_t* out = malloc(table_size + nchunks * LZ4_BOUND(INITRD_CHUNK_SIZE) + 1);
+    uint8_t* chunk = out + table_size;
+    if (!out) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < nchunks; i++) {
+        const uint8_t* src = entry->data + i * INITRD_CHUNK_SIZE;
+        uint32_t length = entry->length - i * INITRD_CHUNK_SIZE;
+        if (length > INITRD_CHUNK_SIZE) {
+            length = INITRD_CHUNK_SIZE;
+        }
+
+        uint32_t size = lz4_compress(src, length, chunk);
+        if (size >= length) {
+            memcpy(chunk, src, length);
+            size = length;
+        }
+        chunk += size;
+        write32(out + i * 4, chunk - (out + table_size));
+    }
+
+    entry->stored = out;
+    entry->stored_length = chunk - out;
+}
+
+/* Load a whole file */
+static uint8_t* read_file(const char* path, uint32_t* length) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || size > 0x7FFFFFFF) {
+        fprintf(stderr, "%s: too large\n", path);
+        exit(1);
+    }
+
+    uint8_t* data = malloc(size + 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+
+    *length = size;
+    return data;
+}
+
+/* Sort files by name so images are reproducible */
+static int compare_entries(const void* a, const void* b) {
+    return strcmp(((const entry_t*)a)->name, ((const entry_t*)b)->name);
+}
+
+int main(int argc, char** argv) {
+    int raw = 0;
+    if (argc == 4 && strcmp(argv[1], "-r") == 0) {
+        raw = 1;
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s [-r] <directory> <output>\n", argv[0]);
+        return 1;
+    }
+
+    DIR* dir = opendir(argv[1]);
+    if (!dir) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    /* The kernel's initrd is flat: take the regular files only */
+    entry_t* entries = NULL;
+    uint32_t count = 0;
+    struct dirent* dirent;
+    while ((dirent = readdir(dir))) {
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", argv[1], dirent->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (strlen(dirent->d_name) >= INITRD_NAME_SIZE) {
+            fprintf(stderr, "%s: name longer than %d characters, skipped\n", path, INITRD_NAME_SIZE - 1);
+            continue;
+        }
+
+        entries = realloc(entries, (count + 1) * sizeof(entry_t));
+        if (!entries) {
+            perror("realloc");
+            return 1;
+        }
+        entry_t* entry = &entries[count++];
+        memset(entry, 0, sizeof(*entry));
+        strcpy(entry->name, dirent->d_name);
+        entry->data = read_file(path, &entry->length);
+    }
+    closedir(dir);
+    qsort(entries, count, sizeof(entry_t), compare_entries);
+
+    /* Header, file headers, then each file's data in order */
+    uint32_t header_size = raw ? INITRD_NAME_SIZE + 8 : INITRD_NAME_SIZE + 12;
+    uint64_t offset = 16 + (uint64_t)count * header_size;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (raw) {
+            entries[i].stored = entries[i].data;
+            entries[i].stored_length = entries[i].length;
+        } else {
+            store_lz4(&entries[i]);
+        }
+        total += entries[i].length;
+    }
+
+    uint64_t size = offset;
+    for (uint32_t i = 0; i < count; i++) {
+        size += entries[i].stored_length;
+    }
+    if (size > 0xFFFFFFFF) {
+        fprintf(stderr, "image would be larger than 4GB\n");
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    uint8_t header[16];
+    write32(header, INITRD_MAGIC);
+    write32(header + 4, raw ? INITRD_VERSION : INITRD_VERSION_LZ4);
+    write32(header + 8, count);
+    write32(header + 12, size);
+    fwrite(header, 1, sizeof(header), out);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t file_header[INITRD_NAME_SIZE + 12];
+        memset(file_header, 0, sizeof(file_header));
+        memcpy(file_header, entries[i].name, strlen(entries[i].name));
+        write32(file_header + INITRD_NAME_SIZE, offset);
+        write32(file_header + INITRD_NAME_SIZE + 4, entries[i].length);
+        write32(file_header + INITRD_NAME_SIZE + 8, entries[i].stored_length);
+        fwrite(file_header, 1, header_size, out);
+        offset += entries[i].stored_length;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        fwrite(entries[i].stored, 1, entries[i].stored_length, out);
+    }
+
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("%s: %u files, %llu bytes (%llu bytes uncompressed)\n", argv[2], count,
+           (unsigned long long)size, (unsigned long long)total);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+# Decode a MinOS kernel trace dump and print latency histograms
+#
+# Capture the dump by running QEMU with the first serial port going to a
+# file, e.g. "-serial file:trace.bin", then in the MinOS shell:
+#
+#   trace start
+#   ...workload...
+#   trace dump
+#
+# and decode it with "tools/trace_decode.py trace.bin". The format is
+# described in src/kernel/trace.h.
+
+import struct
+import sys
+
+TRACE_MAGIC = 0x4352544D
+TRACE_VERSION = 1
+
+IRQ_ENTRY, IRQ_EXIT = 1, 2
+SYSCALL_ENTRY, SYSCALL_EXIT = 3, 4
+SWITCH = 5
+FAULT_ENTRY, FAULT_EXIT = 6, 7
+
+# Names for the vectors and system calls the kernel defines
+VECTOR_NAMES = {
+    14: "page fault", 32: "timer", 33: "keyboard", 35: "serial 2", 36: "serial 1",
+    38: "floppy", 40: "rtc", 44: "mouse", 46: "ata 0", 47: "ata 1",
+    0x40: "local timer", 0x41: "tlb shootdown", 0x42: "reschedule", 0x80: "syscall",
+}
+SYSCALL_NAMES = {
+    1: "exit", 2: "fork", 3: "read", 4: "write", 5: "open", 6: "close", 7: "waitpid",
+    8: "exec", 9: "getpid", 10: "sleep", 11: "kill", 12: "mmap", 13: "munmap",
+    14: "stat", 15: "mkdir", 16: "rmdir", 17: "chdir", 18: "getcwd", 19: "time",
+    20: "chmod", 21: "ring_setup", 22: "ring_enter",
+}
+
+
+def read_dump(data):
+    """Return (tsc_per_us, {cpu: (lost, [(tsc, type, arg, pid), ...])})"""
+    start = data.find(struct.pack("<I", TRACE_MAGIC))
+    if start < 0:
+        sys.exit("no trace header found")
+
+    magic, version, ncpus, tsc_per_us, entry_size = struct.unpack_from("<IHHII", data, start)
+    if version != TRACE_VERSION or entry_size != 16:
+        sys.exit("unsupported trace version %d (entry size %d)" % (version, entry_size))
+
+    offset = start + 16
+    cpus = {}
+    for _ in range(ncpus):
+        if offset + 12 > len(data):
+            sys.exit("dump truncated")
+        cpu, count, lost = struct.unpack_from("<III", data, offset)
+        offset += 12
+        if offset + count * 16 > len(data):
+            sys.exit("dump truncated in CPU %d's events" % cpu)
+
+        events = []
+        for i in range(count):
+            tsc, arg, kind, pid = struct.unpack_from("<QIHH", data, offset + i * 16)
+            events.append((tsc, kind, arg, pid))
+        cpus[cpu] = (lost, events)
+        offset += count * 16
+
+    return tsc_per_us, cpus
+
+
+class Histogram:
+    """Latencies in log2 buckets"""
+
+    def __init__(self):
+        self.samples = []
+
+    def add(self, value):
+        self.samples.append(value)
+
+    def percentile(self, fraction):
+        ordered = sorted(self.samples)
+        return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+    def show(self, title, unit, scale):
+        def fmt(value):
+            return "%.2f%s" % (value / scale, unit)
+
+        n = len(self.samples)
+        print("%s: %d events, min %s, p50 %s, p99 %s, max %s" % (
+            title, n, fmt(min(self.samples)), fmt(self.percentile(0.5)),
+            fmt(self.percentile(0.99)), fmt(max(self.samples))))
+
+        buckets = {}
+        for value in self.samples:
+            bucket = max(0, int(value).bit_length() - 1)
+            buckets[bucket] = buckets.get(bucket, 0) + 1
+
+        peak = max(buckets.values())
+        for bucket in range(min(buckets), max(buckets) + 1):
+            count = buckets.get(bucket, 0)
+            low = fmt(1 << bucket) if bucket else fmt(0)
+            bar = "#" * ((count * 40 + peak - 1) // peak)
+            print("  >= %12s %8d %s" % (low, count, bar))
+        print()
+
+
+def pair_events(cpus):
+    """Match entry and exit events into latency histograms (TSC cycles)"""
+    irqs, syscalls, faults = {}, {}, Histogram()
+    switches = 0
+    open_syscalls, open_faults = {}, {}
+
+    for cpu in sorted(cpus):
+        # Interrupts nest on a CPU; a handler that switches process is
+        # closed by the next exit on that CPU
+        stack = []
+        for tsc, kind, arg, pid in cpus[cpu][1]:
+            if kind == IRQ_ENTRY:
+                stack.append((arg, tsc))
+            elif kind == IRQ_EXIT:
+                while stack:
+                    vector, entered = stack.pop()
+                    if vector == arg:
+                        irqs.setdefault(arg, Histogram()).add(tsc - entered)
+                        break
+            elif kind == SWITCH:
+                switches += 1
+
+    # System calls and page faults may block and finish on another CPU,
+    # so they are matched by process over the merged, time-ordered events
+    merged = sorted((tsc, kind, arg, pid) for _, events in cpus.values() for tsc, kind, arg, pid in events)
+    for tsc, kind, arg, pid in merged:
+        if kind == SYSCALL_ENTRY:
+            open_syscalls[pid] = (arg, tsc)
+        elif kind == SYSCALL_EXIT and pid in open_syscalls:
+            num, entered = open_syscalls.pop(pid)
+            if num == arg:
+                syscalls.setdefault(arg, Histogram()).add(tsc - entered)
+        elif kind == FAULT_ENTRY:
+            open_faults[pid] = tsc
+        elif kind == FAULT_EXIT and pid in open_faults:
+            faults.add(tsc - open_faults.pop(pid))
+
+    return irqs, syscalls, faults, switches
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s trace.bin" % sys.argv[0])
+
+    with open(sys.argv[1], "rb") as f:
+        tsc_per_us, cpus = read_dump(f.read())
+
+    # Report in microseconds when the kernel knew the TSC rate
+    unit, scale = ("us", float(tsc_per_us)) if tsc_per_us else (" cycles", 1.0)
+
+    for cpu in sorted(cpus):
+        lost, events = cpus[cpu]
+        span = events[-1][0] - events[0][0] if events else 0
+        print("CPU %d: %d events over %.2f%s, %d overwritten" % (cpu, len(events), span / scale, unit, lost))
+    print()
+
+    irqs, syscalls, faults, switches = pair_events(cpus)
+    print("%d context switches\n" % switches)
+
+    for vector in sorted(irqs):
+        irqs[vector].show("vector %d (%s)" % (vector, VECTOR_NAMES.get(vector, "other")), unit, scale)
+    for num in sorted(syscalls):
+        syscalls[num].show("syscall %d (%s)" % (num, SYSCALL_NAMES.get(num, "?")), unit, scale)
+    if faults.samples:
+        faults.show("page faults", unit, scale)
+
+
+if __name__ == "__main__":
+    main()